@@ -2,6 +2,9 @@
 #include "ui_CreatePointCloudDialog.h"
 #include <climits>
 
+// Upper limit for streamed benchmark scenes
+static const double MaxScenePoints = 1e10;
+
 CreatePointCloudDialog::CreatePointCloudDialog(QWidget *parent) :
     QDialog(parent),
     ui(new Ui::CreatePointCloudDialog)
@@ -10,20 +13,37 @@ CreatePointCloudDialog::CreatePointCloudDialog(QWidget *parent) :
     ui->pointCountSpinBox->setMaximum(INT_MAX);
     ui->pointCountSpinBox->setValue(100000);
     ui->volumeRadioButton->setChecked(true);
+    shapeChanged(ui->shapeComboBox->currentText());
 
     adjustSize();
 
     connect(this, SIGNAL(accepted()), SLOT(apply()));
+    connect(ui->shapeComboBox, SIGNAL(currentIndexChanged(QString)),
+            SLOT(shapeChanged(QString)));
 }
 
 void CreatePointCloudDialog::apply()
 {
   // Gather values from boxes
-  int pointCount = ui->pointCountSpinBox->value();
+  qint64 pointCount = ui->pointCountSpinBox->value();
   QString shape = ui->shapeComboBox->currentText();
   bool surface = ui->surfaceRadioButton->isChecked();
 
-  emit accepted(shape, pointCount, surface);
+  if(shape == "Benchmark Scene")
+    emit benchmarkSceneAccepted(pointCount, ui->seedSpinBox->value());
+  else
+    emit accepted(shape, (int)pointCount, surface);
+}
+
+void CreatePointCloudDialog::shapeChanged(const QString &shape)
+{
+  // Scenes are streamed to a file and may be larger than memory; shapes are
+  // held in a PointCloud
+  bool scene = (shape == "Benchmark Scene");
+  ui->pointCountSpinBox->setMaximum(scene ? MaxScenePoints : INT_MAX);
+  ui->groupBox->setEnabled(!scene);
+  ui->seedLabel->setEnabled(scene);
+  ui->seedSpinBox->setEnabled(scene);
 }
 
 CreatePointCloudDialog::~CreatePointCloudDialog()
@@ -21,6 +21,11 @@ public slots:
 
 signals:
   void accepted(QString type, int count, bool surface);
+  // Benchmark scenes are written to a file rather than held in memory
+  void benchmarkSceneAccepted(qint64 count, int seed);
+
+private slots:
+  void shapeChanged(const QString& shape);
 
 private:
     Ui::CreatePointCloudDialog *ui;
@@ -7,6 +7,10 @@ DisplayOptionsDialog::DisplayOptionsDialog(QWidget *parent) :
 {
   ui->setupUi(this);
 
+  ui->vertexFormatComboBox->addItem("Automatic", Viewer::AutomaticFormat);
+  ui->vertexFormatComboBox->addItem("Full Precision", Viewer::FullFormat);
+  ui->vertexFormatComboBox->addItem("Compact", Viewer::CompactFormat);
+
   // Signal to Signal connections;  cause changes of private UI elements to
   // trigger public signals.
   connect(ui->pointSizeSpinBox, SIGNAL(valueChanged(int)), this,
@@ -21,8 +25,34 @@ DisplayOptionsDialog::DisplayOptionsDialog(QWidget *parent) :
           this, SIGNAL(pointDepthChanged(bool)));
   connect(ui->multisampleCheckBox, SIGNAL(toggled(bool)),
           this, SIGNAL(multiSampleChanged(bool)));
+  connect(ui->spatialOrderCheckBox, SIGNAL(toggled(bool)),
+          this, SIGNAL(spatialOrderChanged(bool)));
+  connect(ui->vertexFormatComboBox, SIGNAL(currentIndexChanged(int)),
+          this, SLOT(updateVertexFormat(int)));
   connect(ui->fastInteractionCheckBox, SIGNAL(toggled(bool)),
           this, SIGNAL(fastInteractionChanged(bool)));
+  connect(ui->targetFrameRateSpinBox, SIGNAL(valueChanged(int)),
+          this, SIGNAL(targetFrameRateChanged(int)));
+
+  // Target only applies with fast interaction
+  connect(ui->fastInteractionCheckBox, SIGNAL(toggled(bool)),
+          ui->targetFrameRateLabel, SLOT(setEnabled(bool)));
+  connect(ui->fastInteractionCheckBox, SIGNAL(toggled(bool)),
+          ui->targetFrameRateSpinBox, SLOT(setEnabled(bool)));
+  connect(ui->eyeDomeLightingGroupBox, SIGNAL(toggled(bool)),
+          this, SIGNAL(eyeDomeLightingChanged(bool)));
+  connect(ui->eyeDomeStrengthSpinBox, SIGNAL(valueChanged(double)),
+          this, SIGNAL(eyeDomeStrengthChanged(double)));
+  connect(ui->eyeDomeRadiusSpinBox, SIGNAL(valueChanged(double)),
+          this, SIGNAL(eyeDomeRadiusChanged(double)));
+  connect(ui->levelOfDetailGroupBox, SIGNAL(toggled(bool)),
+          this, SIGNAL(levelOfDetailChanged(bool)));
+  connect(ui->pointBudgetSpinBox, SIGNAL(valueChanged(int)),
+          this, SLOT(pointBudgetEdited(int)));
+  connect(ui->gpuMemoryBudgetSpinBox, SIGNAL(valueChanged(int)),
+          this, SIGNAL(gpuMemoryBudgetChanged(int)));
+  connect(ui->hostMemoryBudgetSpinBox, SIGNAL(valueChanged(int)),
+          this, SIGNAL(hostMemoryBudgetChanged(int)));
 }
 
 DisplayOptionsDialog::~DisplayOptionsDialog()
@@ -80,7 +110,76 @@ void DisplayOptionsDialog::setMultisampleAvailable(bool available)
   ui->multisampleCheckBox->setEnabled(available);
 }
 
+void DisplayOptionsDialog::setSpatialOrder(bool spatialOrder)
+{
+  ui->spatialOrderCheckBox->setChecked(spatialOrder);
+}
+
 void DisplayOptionsDialog::setFastInteraction(bool fastInteraction)
 {
   ui->fastInteractionCheckBox->setChecked(fastInteraction);
 }
+
+void DisplayOptionsDialog::setTargetFrameRate(int framesPerSecond)
+{
+  if(ui->targetFrameRateSpinBox->value() != framesPerSecond)
+  {
+    ui->targetFrameRateSpinBox->setValue(framesPerSecond);
+  }
+}
+
+void DisplayOptionsDialog::setEyeDomeLighting(bool eyeDomeLighting)
+{
+  ui->eyeDomeLightingGroupBox->setChecked(eyeDomeLighting);
+}
+
+void DisplayOptionsDialog::setEyeDomeStrength(double strength)
+{
+  if(ui->eyeDomeStrengthSpinBox->value() != strength)
+  {
+    ui->eyeDomeStrengthSpinBox->setValue(strength);
+  }
+}
+
+void DisplayOptionsDialog::setEyeDomeRadius(double radius)
+{
+  if(ui->eyeDomeRadiusSpinBox->value() != radius)
+  {
+    ui->eyeDomeRadiusSpinBox->setValue(radius);
+  }
+}
+
+void DisplayOptionsDialog::setLevelOfDetail(bool levelOfDetail)
+{
+  ui->levelOfDetailGroupBox->setChecked(levelOfDetail);
+}
+
+void DisplayOptionsDialog::setPointBudget(int points)
+{
+  // Spin box is in thousands of points
+  int thousands = points/1000;
+  if(ui->pointBudgetSpinBox->value() != thousands)
+  {
+    ui->pointBudgetSpinBox->setValue(thousands);
+  }
+}
+
+void DisplayOptionsDialog::pointBudgetEdited(int thousands)
+{
+  emit pointBudgetChanged(thousands * 1000);
+}
+
+void DisplayOptionsDialog::setVertexFormat(Viewer::VertexFormat format)
+{
+  int index = ui->vertexFormatComboBox->findData(format);
+
+  if(ui->vertexFormatComboBox->currentIndex() != index)
+    ui->vertexFormatComboBox->setCurrentIndex(index);
+}
+
+void DisplayOptionsDialog::updateVertexFormat(int index)
+{
+  int format = ui->vertexFormatComboBox->itemData(index).toInt();
+
+  emit vertexFormatChanged((Viewer::VertexFormat)format);
+}
@@ -2,6 +2,7 @@
 #define DISPLAYOPTIONSDIALOG_H
 
 #include <QDialog>
+#include "Viewer.h"
 
 namespace Ui {
     class DisplayOptionsDialog;
@@ -22,7 +23,18 @@ signals:
   void pointColorChanged(bool value);
   void pointDepthChanged(bool value);
   void multiSampleChanged(bool value);
+  void spatialOrderChanged(bool value);
+  void vertexFormatChanged(Viewer::VertexFormat format);
   void fastInteractionChanged(bool value);
+  void targetFrameRateChanged(int framesPerSecond);
+  void eyeDomeLightingChanged(bool value);
+  void eyeDomeStrengthChanged(double strength);
+  void eyeDomeRadiusChanged(double radius);
+  void levelOfDetailChanged(bool value);
+  void pointBudgetChanged(int points);
+  // Megabytes; 0 leaves the choice to the viewer
+  void gpuMemoryBudgetChanged(int megabytes);
+  void hostMemoryBudgetChanged(int megabytes);
 
 public slots:
   void setPointSize(int pointSize);
@@ -32,7 +44,19 @@ public slots:
   void setDepthMask(bool mask);
   void setMultisample(bool multisample);
   void setMultisampleAvailable(bool available);
+  void setSpatialOrder(bool spatialOrder);
+  void setVertexFormat(Viewer::VertexFormat format);
   void setFastInteraction(bool fastInteraction);
+  void setTargetFrameRate(int framesPerSecond);
+  void setEyeDomeLighting(bool eyeDomeLighting);
+  void setEyeDomeStrength(double strength);
+  void setEyeDomeRadius(double radius);
+  void setLevelOfDetail(bool levelOfDetail);
+  void setPointBudget(int points);
+
+private slots:
+  void pointBudgetEdited(int thousands);
+  void updateVertexFormat(int index);
 
 private:
     Ui::DisplayOptionsDialog *ui;
@@ -0,0 +1,226 @@
+#include "EyeDomeLighting.h"
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QGLFramebufferObject>
+#include <QVector2D>
+#include <QDebug>
+
+#ifndef GL_DEPTH_COMPONENT24
+#define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+#ifndef GL_RGBA8
+#define GL_RGBA8 0x8058
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+#ifndef GL_FRAMEBUFFER_BINDING
+#define GL_FRAMEBUFFER_BINDING 0x8CA6
+#endif
+
+static const char *VertexShader =
+    "#version 120\n"
+    "attribute vec2 position;\n"
+    "varying vec2 coordinate;\n"
+    "void main()\n"
+    "{\n"
+    "  coordinate = 0.5 * position + 0.5;\n"
+    "  gl_Position = vec4(position, 0.0, 1.0);\n"
+    "}\n";
+
+// Shading follows Boucheny's formulation: the log of eye depth is compared
+// with eight neighbors and only neighbors in front darken.  Background
+// neighbors are skipped so the cloud isn't outlined against empty space
+// twice.
+static const char *FragmentShader =
+    "#version 120\n"
+    "uniform sampler2D colorTexture;\n"
+    "uniform sampler2D depthTexture;\n"
+    "uniform vec2 pixel;\n"
+    "uniform float strength;\n"
+    "uniform float radius;\n"
+    "uniform float zNear;\n"
+    "uniform float zFar;\n"
+    "uniform bool perspective;\n"
+    "varying vec2 coordinate;\n"
+    "float logDepth(float depth)\n"
+    "{\n"
+    "  float z = perspective ? zNear * zFar/(zFar - depth * (zFar - zNear))\n"
+    "                        : zNear + depth * (zFar - zNear);\n"
+    "  return log2(max(z, 1e-6));\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "  float depth = texture2D(depthTexture, coordinate).r;\n"
+    "  if(depth >= 1.0)\n"
+    "    discard;\n"
+    "  float center = logDepth(depth);\n"
+    "  float sum = 0.0;\n"
+    "  for(int i = 0; i < 8; ++i)\n"
+    "  {\n"
+    "    float angle = 0.785398 * float(i);\n"
+    "    vec2 offset = radius * pixel * vec2(cos(angle), sin(angle));\n"
+    "    float neighbor = texture2D(depthTexture, coordinate + offset).r;\n"
+    "    if(neighbor < 1.0)\n"
+    "      sum += max(0.0, center - logDepth(neighbor));\n"
+    "  }\n"
+    "  float shade = exp(-300.0 * strength * sum/8.0);\n"
+    "  vec4 color = texture2D(colorTexture, coordinate);\n"
+    "  gl_FragColor = vec4(shade * color.rgb, color.a);\n"
+    "  gl_FragDepth = depth;\n"
+    "}\n";
+
+EyeDomeLighting::EyeDomeLighting() : m_functions(NULL), m_framebuffer(0),
+  m_colorTexture(0), m_depthTexture(0), m_previousFramebuffer(0)
+{
+}
+
+EyeDomeLighting::~EyeDomeLighting()
+{
+  // Called with the context current
+  destroyBuffers();
+}
+
+bool EyeDomeLighting::create()
+{
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  if(!context || !QGLShaderProgram::hasOpenGLShaderPrograms()
+     || !QGLFramebufferObject::hasOpenGLFramebufferObjects())
+    return false;
+
+  // Depth textures are core since 1.4
+  if(context->isOpenGLES() || context->format().version() < qMakePair(1, 4))
+    return false;
+
+  if(!m_program.addShaderFromSourceCode(QGLShader::Vertex, VertexShader)
+     || !m_program.addShaderFromSourceCode(QGLShader::Fragment, FragmentShader)
+     || !m_program.link())
+  {
+    qDebug() << "Eye-dome lighting shader failed:" << m_program.log();
+    return false;
+  }
+
+  m_functions = context->functions();
+  return true;
+}
+
+bool EyeDomeLighting::begin()
+{
+  glGetIntegerv(GL_VIEWPORT, m_viewport);
+  glGetIntegerv(GL_FRAMEBUFFER_BINDING, &m_previousFramebuffer);
+
+  if(!resize(QSize(m_viewport[2], m_viewport[3])))
+    return false;
+
+  m_functions->glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  glViewport(0, 0, m_size.width(), m_size.height());
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  return true;
+}
+
+void EyeDomeLighting::end(float strength, float radius, float zNear,
+                          float zFar, bool perspective)
+{
+  m_functions->glBindFramebuffer(GL_FRAMEBUFFER, m_previousFramebuffer);
+  glViewport(m_viewport[0], m_viewport[1], m_viewport[2], m_viewport[3]);
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+
+  // Depth is written as is so later drawing is still hidden by the points
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_ALWAYS);
+  glDepthMask(GL_TRUE);
+  glDisable(GL_BLEND);
+
+  m_functions->glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+  m_functions->glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+
+  m_program.bind();
+  m_program.setUniformValue("colorTexture", 0);
+  m_program.setUniformValue("depthTexture", 1);
+  m_program.setUniformValue("pixel", QVector2D(1.0f/m_size.width(),
+                                               1.0f/m_size.height()));
+  m_program.setUniformValue("strength", strength);
+  m_program.setUniformValue("radius", radius);
+  m_program.setUniformValue("zNear", zNear);
+  m_program.setUniformValue("zFar", zFar);
+  m_program.setUniformValue("perspective", perspective);
+
+  static const GLfloat quad[] = { -1.0f, -1.0f,  1.0f, -1.0f,
+                                  -1.0f,  1.0f,  1.0f,  1.0f };
+  m_program.enableAttributeArray("position");
+  m_program.setAttributeArray("position", quad, 2);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  m_program.disableAttributeArray("position");
+
+  m_program.release();
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPopAttrib();
+}
+
+bool EyeDomeLighting::resize(const QSize &size)
+{
+  if(m_framebuffer && size == m_size)
+    return true;
+
+  destroyBuffers();
+  if(size.isEmpty())
+    return false;
+
+  glGenTextures(1, &m_colorTexture);
+  glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.width(), size.height(), 0,
+               GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+  glGenTextures(1, &m_depthTexture);
+  glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size.width(),
+               size.height(), 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  m_functions->glGenFramebuffers(1, &m_framebuffer);
+  m_functions->glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  m_functions->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                      GL_TEXTURE_2D, m_colorTexture, 0);
+  m_functions->glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                      GL_TEXTURE_2D, m_depthTexture, 0);
+  GLenum status = m_functions->glCheckFramebufferStatus(GL_FRAMEBUFFER);
+  m_functions->glBindFramebuffer(GL_FRAMEBUFFER, m_previousFramebuffer);
+
+  if(status != GL_FRAMEBUFFER_COMPLETE)
+  {
+    qDebug() << "Eye-dome lighting framebuffer incomplete:" << status;
+    destroyBuffers();
+    return false;
+  }
+
+  m_size = size;
+  return true;
+}
+
+void EyeDomeLighting::destroyBuffers()
+{
+  if(m_framebuffer)
+    m_functions->glDeleteFramebuffers(1, &m_framebuffer);
+  if(m_colorTexture)
+    glDeleteTextures(1, &m_colorTexture);
+  if(m_depthTexture)
+    glDeleteTextures(1, &m_depthTexture);
+
+  m_framebuffer = 0;
+  m_colorTexture = 0;
+  m_depthTexture = 0;
+  m_size = QSize();
+}
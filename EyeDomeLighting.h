@@ -0,0 +1,51 @@
+#ifndef EYEDOMELIGHTING_H
+#define EYEDOMELIGHTING_H
+
+#include <QGLShaderProgram>
+#include <QSize>
+
+class QOpenGLFunctions;
+
+// Eye-dome lighting: screen space shading from the depth buffer alone.
+// Points are drawn to an offscreen buffer between begin() and end(), and
+// end() darkens each pixel by how far its neighbors in the depth buffer
+// lie in front of it, which outlines silhouettes and brings out surface
+// shape without normals or color.
+//
+// The result is drawn into the framebuffer and viewport that were current
+// at begin() with the current color mask, so it works for each eye of the
+// stereo modes.
+class EyeDomeLighting
+{
+public:
+  EyeDomeLighting();
+  ~EyeDomeLighting();
+
+  // With the context current; false if shaders, framebuffer objects or
+  // depth textures aren't supported
+  bool create();
+
+  bool begin();
+  // Strength scales the shading; radius is the neighbor distance in pixels.
+  // Near and far are the camera clipping planes.
+  void end(float strength, float radius, float zNear, float zFar,
+           bool perspective);
+
+private:
+  bool resize(const QSize& size);
+  void destroyBuffers();
+
+  QGLShaderProgram m_program;
+  QOpenGLFunctions *m_functions;
+
+  GLuint m_framebuffer;
+  GLuint m_colorTexture;
+  GLuint m_depthTexture;
+  QSize m_size;
+
+  // State restored by end()
+  GLint m_previousFramebuffer;
+  GLint m_viewport[4];
+};
+
+#endif // EYEDOMELIGHTING_H
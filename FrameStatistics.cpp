@@ -0,0 +1,201 @@
+#include "FrameStatistics.h"
+#include <QOpenGLContext>
+#include <QOpenGLTimerQuery>
+#include <QDebug>
+
+// Frames with queries in flight before waiting on the oldest
+static const int MaxPendingFrames = 8;
+
+FrameStatistics::FrameStatistics() : m_initialized(false), m_gpuTiming(false),
+  m_activeQuery(NULL), m_frameQueries(0), m_frameIndex(0), m_drawing(false)
+{
+  m_frame.index = 0;
+}
+
+FrameStatistics::~FrameStatistics()
+{
+  stopLog();
+
+  // Queries should have been released with the context current
+  if(!m_freeQueries.isEmpty() || !m_pendingQueries.isEmpty())
+    qWarning() << "Frame statistics destroyed without releasing queries";
+}
+
+void FrameStatistics::beginFrame()
+{
+  // Timer queries are available from GL 3.3 or with ARB_timer_query
+  if(!m_initialized)
+  {
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    m_gpuTiming = context && !context->isOpenGLES()
+        && (context->format().version() >= qMakePair(3, 3)
+            || context->hasExtension("GL_ARB_timer_query"));
+    m_initialized = true;
+  }
+
+  collectQueries(m_pendingFrames.count() >= MaxPendingFrames);
+
+  m_frame.index = m_frameIndex++;
+  m_frame.intervalMs = m_frameTimer.isValid()
+      ? m_frameTimer.nsecsElapsed()/1e6 : 0.0;
+  m_frame.cpuMs = 0.0;
+  m_frame.gpuMs = m_gpuTiming ? 0.0 : -1.0;
+  m_frame.points = 0;
+  m_frame.bufferMemory = 0;
+  m_frameQueries = 0;
+
+  m_frameTimer.start();
+}
+
+void FrameStatistics::beginDraw()
+{
+  if(m_gpuTiming)
+  {
+    QOpenGLTimerQuery *query = takeQuery();
+    if(query)
+    {
+      query->begin();
+      m_activeQuery = query;
+      PendingQuery pending = { m_frame.index, query };
+      m_pendingQueries.enqueue(pending);
+      ++m_frameQueries;
+    }
+  }
+
+  m_drawing = true;
+  m_drawTimer.start();
+}
+
+void FrameStatistics::endDraw(int points)
+{
+  if(!m_drawing)
+    return;
+
+  m_frame.cpuMs += m_drawTimer.nsecsElapsed()/1e6;
+  m_frame.points += points;
+  m_drawing = false;
+
+  if(m_activeQuery)
+  {
+    m_activeQuery->end();
+    m_activeQuery = NULL;
+  }
+}
+
+void FrameStatistics::endFrame(qint64 bufferMemory)
+{
+  m_frame.bufferMemory = bufferMemory;
+
+  // Without queries the frame is complete once the older ones are
+  PendingFrame pending = { m_frame, m_frameQueries };
+  m_pendingFrames.enqueue(pending);
+  collectQueries(false);
+}
+
+QOpenGLTimerQuery *FrameStatistics::takeQuery()
+{
+  if(!m_freeQueries.isEmpty())
+    return m_freeQueries.takeLast();
+
+  QOpenGLTimerQuery *query = new QOpenGLTimerQuery;
+  if(!query->create())
+  {
+    delete query;
+    m_gpuTiming = false;
+    if(m_frameQueries == 0)
+      m_frame.gpuMs = -1.0;
+    return NULL;
+  }
+
+  return query;
+}
+
+void FrameStatistics::collectQueries(bool wait)
+{
+  // Queries finish in order; stop at the first one still running unless
+  // the oldest frame has to be completed
+  while(!m_pendingQueries.isEmpty())
+  {
+    PendingQuery pending = m_pendingQueries.head();
+    bool oldest = !m_pendingFrames.isEmpty()
+        && pending.frame == m_pendingFrames.head().frame.index;
+    if(!pending.query->isResultAvailable() && !(wait && oldest))
+      break;
+
+    m_pendingQueries.dequeue();
+    for(int i = 0; i < m_pendingFrames.count(); ++i)
+    {
+      PendingFrame& frame = m_pendingFrames[i];
+      if(frame.frame.index == pending.frame)
+      {
+        frame.frame.gpuMs += pending.query->waitForResult()/1e6;
+        --frame.queries;
+        break;
+      }
+    }
+    m_freeQueries.push_back(pending.query);
+  }
+
+  // Complete frames in order as their last query is collected
+  while(!m_pendingFrames.isEmpty() && m_pendingFrames.head().queries == 0)
+    complete(m_pendingFrames.dequeue().frame);
+}
+
+void FrameStatistics::complete(const Frame &frame)
+{
+  m_history.push_back(frame);
+  if(m_history.count() > HistorySize)
+    m_history.remove(0, m_history.count() - HistorySize);
+
+  if(m_log.isOpen())
+  {
+    m_logStream << frame.index << ',' << m_logTimer.elapsed() << ','
+                << frame.intervalMs << ',' << frame.cpuMs << ',';
+    if(frame.gpuMs >= 0.0)
+      m_logStream << frame.gpuMs;
+    m_logStream << ',' << frame.points << ','
+                << frame.bufferMemory/(1024.0 * 1024.0) << '\n';
+  }
+}
+
+bool FrameStatistics::startLog(const QString &path)
+{
+  stopLog();
+
+  m_log.setFileName(path);
+  if(!m_log.open(QIODevice::WriteOnly | QIODevice::Text))
+    return false;
+
+  m_logStream.setDevice(&m_log);
+  m_logStream << "frame,time_ms,interval_ms,cpu_ms,gpu_ms,points,buffer_mb\n";
+  m_logTimer.start();
+
+  return true;
+}
+
+void FrameStatistics::stopLog()
+{
+  if(!m_log.isOpen())
+    return;
+
+  m_logStream.flush();
+  m_logStream.setDevice(NULL);
+  m_log.close();
+}
+
+void FrameStatistics::release()
+{
+  foreach(const PendingQuery& pending, m_pendingQueries)
+    delete pending.query;
+  m_pendingQueries.clear();
+
+  qDeleteAll(m_freeQueries);
+  m_freeQueries.clear();
+
+  // Frames left without GPU time are dropped; a new context is checked
+  // for timer queries again
+  m_pendingFrames.clear();
+  m_activeQuery = NULL;
+  m_drawing = false;
+  m_initialized = false;
+}
@@ -0,0 +1,95 @@
+#ifndef FRAMESTATISTICS_H
+#define FRAMESTATISTICS_H
+
+#include <QVector>
+#include <QQueue>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTextStream>
+
+class QOpenGLTimerQuery;
+
+// Per frame timings of point drawing.  CPU time is measured around the draw
+// calls, GPU time with timer queries around the same calls where GL 3.3 or
+// ARB_timer_query is available.  Query results are collected a few frames
+// later so drawing never waits on the GPU.  All calls are made with the
+// viewer's context current.
+class FrameStatistics
+{
+public:
+  struct Frame
+  {
+    int index;
+    // Time since the start of the previous frame
+    double intervalMs;
+    double cpuMs;
+    // Negative until known, or if timer queries are unavailable
+    double gpuMs;
+    int points;
+    qint64 bufferMemory;
+  };
+
+  // Frames kept for the graph
+  static const int HistorySize = 120;
+
+  FrameStatistics();
+  ~FrameStatistics();
+
+  void beginFrame();
+  void beginDraw();
+  void endDraw(int points);
+  void endFrame(qint64 bufferMemory);
+
+  bool hasGPUTiming() const { return m_gpuTiming; }
+  // Completed frames, oldest first
+  const QVector<Frame>& history() const { return m_history; }
+
+  // Writes a CSV line per completed frame until stopped
+  bool startLog(const QString& path);
+  void stopLog();
+  bool isLogging() const { return m_log.isOpen(); }
+
+  // Drops queries; call before the context goes away
+  void release();
+
+private:
+  QOpenGLTimerQuery *takeQuery();
+  void collectQueries(bool wait);
+  void complete(const Frame& frame);
+
+  struct PendingQuery
+  {
+    int frame;
+    QOpenGLTimerQuery *query;
+  };
+
+  struct PendingFrame
+  {
+    Frame frame;
+    // Queries of the frame not yet collected
+    int queries;
+  };
+
+  bool m_initialized;
+  bool m_gpuTiming;
+  QVector<QOpenGLTimerQuery *> m_freeQueries;
+  QQueue<PendingQuery> m_pendingQueries;
+  QOpenGLTimerQuery *m_activeQuery;
+
+  // Frames waiting for their GPU time, oldest first
+  QQueue<PendingFrame> m_pendingFrames;
+  QVector<Frame> m_history;
+
+  Frame m_frame;
+  int m_frameQueries;
+  int m_frameIndex;
+  QElapsedTimer m_frameTimer;
+  QElapsedTimer m_drawTimer;
+  bool m_drawing;
+
+  QFile m_log;
+  QTextStream m_logStream;
+  QElapsedTimer m_logTimer;
+};
+
+#endif // FRAMESTATISTICS_H
@@ -0,0 +1,308 @@
+#include "KdTree.h"
+#include <algorithm>
+#include <queue>
+#include <cfloat>
+#include "PointCloud.h"
+#include "Parallel.h"
+
+// Points per block when copying positions into the tree
+static const int CopyBlockSize = 1 << 20;
+
+static inline float distance2(const float *a, const float *b)
+{
+  float x = a[0] - b[0];
+  float y = a[1] - b[1];
+  float z = a[2] - b[2];
+  return x * x + y * y + z * z;
+}
+
+// Closest k entries seen so far, farthest on top
+class KdTree::Neighbors
+{
+public:
+  Neighbors(int k, float bound) : m_k(k), m_bound(bound) { }
+
+  // Squared distance beyond which entries can't be among the closest
+  float bound() const { return m_bound; }
+
+  void add(float distance2, int entry)
+  {
+    if(distance2 > m_bound)
+      return;
+
+    m_heap.push(std::make_pair(distance2, entry));
+    if((int)m_heap.size() > m_k)
+      m_heap.pop();
+    if((int)m_heap.size() == m_k)
+      m_bound = m_heap.top().first;
+  }
+
+  // Entries closest first; empties the heap
+  QVector<int> take()
+  {
+    QVector<int> result(m_heap.size());
+    for(int i = result.count() - 1; i >= 0; --i)
+    {
+      result[i] = m_heap.top().second;
+      m_heap.pop();
+    }
+    return result;
+  }
+
+private:
+  int m_k;
+  float m_bound;
+  std::priority_queue<std::pair<float, int> > m_heap;
+};
+
+KdTree::KdTree()
+{
+}
+
+KdTree::KdTree(const PointCloud &cloud)
+{
+  const int count = cloud.count();
+  if(count == 0)
+    return;
+
+  m_entries.resize(count);
+
+  const float *points = cloud.pointData();
+  const int blocks = (count + CopyBlockSize - 1)/CopyBlockSize;
+  Parallel::forEach(blocks, [&](int block) {
+    int last = qMin(count, (block + 1) * CopyBlockSize);
+    for(int i = block * CopyBlockSize; i < last; ++i)
+    {
+      Entry& entry = m_entries[i];
+      const float *p = points + (size_t)i * 3;
+      entry.position[0] = p[0];
+      entry.position[1] = p[1];
+      entry.position[2] = p[2];
+      entry.index = i;
+    }
+  });
+
+  // Ranges halve at each level, so only the first levels are split
+  int levels = 0;
+  while((count >> levels) > LeafSize)
+    ++levels;
+  if(levels == 0)
+    return;
+
+  m_axes.resize(((size_t)1 << levels) - 1);
+
+  // Upper levels are split one level at a time, in parallel over the ranges
+  // of the level; once there are enough ranges to keep every thread busy,
+  // each subtree is finished by a single task
+  QVector<Range> ranges;
+  Range root = { 0, 0, count };
+  ranges.append(root);
+
+  const int enough = 4 * Parallel::threadCount();
+  while(!ranges.isEmpty() && ranges.count() < enough)
+  {
+    QVector<QVector<Range> > children(ranges.count());
+    Parallel::forEach(ranges.count(), [&](int i) {
+      split(ranges[i], children[i]);
+    });
+
+    ranges.clear();
+    foreach(const QVector<Range>& pair, children)
+      ranges += pair;
+  }
+
+  Parallel::forEach(ranges.count(), [&](int i) {
+    buildSubtree(ranges[i]);
+  });
+}
+
+void KdTree::split(const Range &range, QVector<Range> &children)
+{
+  Entry *first = &m_entries[0] + range.first;
+  Entry *last = &m_entries[0] + range.last;
+
+  float minimum[3], maximum[3];
+  for(int k = 0; k < 3; ++k)
+    minimum[k] = maximum[k] = first->position[k];
+
+  for(const Entry *entry = first; entry != last; ++entry)
+  {
+    for(int k = 0; k < 3; ++k)
+    {
+      minimum[k] = qMin(minimum[k], entry->position[k]);
+      maximum[k] = qMax(maximum[k], entry->position[k]);
+    }
+  }
+
+  int axis = 0;
+  for(int k = 1; k < 3; ++k)
+  {
+    if(maximum[k] - minimum[k] > maximum[axis] - minimum[axis])
+      axis = k;
+  }
+
+  // Entries before the middle are no greater along the axis, those after
+  // no less
+  int middle = range.first + (range.last - range.first)/2;
+  std::nth_element(first, &m_entries[0] + middle, last,
+                   [axis](const Entry& a, const Entry& b) {
+    return a.position[axis] < b.position[axis];
+  });
+  m_axes[range.node] = axis;
+
+  Range left = { 2 * range.node + 1, range.first, middle };
+  Range right = { 2 * range.node + 2, middle + 1, range.last };
+  if(left.last - left.first > LeafSize)
+    children.append(left);
+  if(right.last - right.first > LeafSize)
+    children.append(right);
+}
+
+void KdTree::buildSubtree(const Range &range)
+{
+  QVector<Range> stack;
+  stack.append(range);
+
+  while(!stack.isEmpty())
+    split(stack.takeLast(), stack);
+}
+
+int KdTree::nearest(const QVector3D &position) const
+{
+  QVector<int> result = nearest(position, 1);
+  return result.isEmpty() ? -1 : result.first();
+}
+
+QVector<int> KdTree::nearest(const QVector3D &position, int k,
+                             float maxDistance) const
+{
+  if(isEmpty() || k <= 0)
+    return QVector<int>();
+
+  float p[3] = { position.x(), position.y(), position.z() };
+  Neighbors neighbors(k, maxDistance > 0.0f ? maxDistance * maxDistance
+                                            : FLT_MAX);
+  search(0, 0, count(), p, neighbors);
+
+  QVector<int> result = neighbors.take();
+  for(int i = 0; i < result.count(); ++i)
+    result[i] = m_entries[result[i]].index;
+
+  return result;
+}
+
+QVector<int> KdTree::withinRadius(const QVector3D &center, float radius) const
+{
+  QVector<int> result;
+  if(isEmpty() || radius < 0.0f)
+    return result;
+
+  float c[3] = { center.x(), center.y(), center.z() };
+  searchRadius(0, 0, count(), c, radius * radius, result);
+
+  return result;
+}
+
+QVector<int> KdTree::withinBox(const QVector3D &minimum,
+                               const QVector3D &maximum) const
+{
+  QVector<int> result;
+  if(isEmpty())
+    return result;
+
+  float low[3] = { minimum.x(), minimum.y(), minimum.z() };
+  float high[3] = { maximum.x(), maximum.y(), maximum.z() };
+  searchBox(0, 0, count(), low, high, result);
+
+  return result;
+}
+
+qint64 KdTree::memoryUsage() const
+{
+  return m_entries.capacity() * sizeof(Entry) + m_axes.capacity();
+}
+
+void KdTree::search(int node, int first, int last, const float *position,
+                    Neighbors &neighbors) const
+{
+  if(last - first <= LeafSize)
+  {
+    for(int i = first; i < last; ++i)
+      neighbors.add(distance2(m_entries[i].position, position), i);
+    return;
+  }
+
+  int middle = first + (last - first)/2;
+  const Entry& entry = m_entries[middle];
+  neighbors.add(distance2(entry.position, position), middle);
+
+  // Nearer side first so the bound shrinks before the far side is tested
+  int axis = m_axes[node];
+  float offset = position[axis] - entry.position[axis];
+  if(offset < 0.0f)
+  {
+    search(2 * node + 1, first, middle, position, neighbors);
+    if(offset * offset <= neighbors.bound())
+      search(2 * node + 2, middle + 1, last, position, neighbors);
+  } else {
+    search(2 * node + 2, middle + 1, last, position, neighbors);
+    if(offset * offset <= neighbors.bound())
+      search(2 * node + 1, first, middle, position, neighbors);
+  }
+}
+
+void KdTree::searchRadius(int node, int first, int last, const float *center,
+                          float radius2, QVector<int> &result) const
+{
+  if(last - first <= LeafSize)
+  {
+    for(int i = first; i < last; ++i)
+    {
+      if(distance2(m_entries[i].position, center) <= radius2)
+        result.append(m_entries[i].index);
+    }
+    return;
+  }
+
+  int middle = first + (last - first)/2;
+  const Entry& entry = m_entries[middle];
+  if(distance2(entry.position, center) <= radius2)
+    result.append(entry.index);
+
+  int axis = m_axes[node];
+  float offset = center[axis] - entry.position[axis];
+  if(offset <= 0.0f || offset * offset <= radius2)
+    searchRadius(2 * node + 1, first, middle, center, radius2, result);
+  if(offset >= 0.0f || offset * offset <= radius2)
+    searchRadius(2 * node + 2, middle + 1, last, center, radius2, result);
+}
+
+void KdTree::searchBox(int node, int first, int last, const float *minimum,
+                       const float *maximum, QVector<int> &result) const
+{
+  if(last - first <= LeafSize)
+  {
+    for(int i = first; i < last; ++i)
+    {
+      const float *p = m_entries[i].position;
+      if(p[0] >= minimum[0] && p[0] <= maximum[0]
+         && p[1] >= minimum[1] && p[1] <= maximum[1]
+         && p[2] >= minimum[2] && p[2] <= maximum[2])
+        result.append(m_entries[i].index);
+    }
+    return;
+  }
+
+  int middle = first + (last - first)/2;
+  const float *p = m_entries[middle].position;
+  if(p[0] >= minimum[0] && p[0] <= maximum[0]
+     && p[1] >= minimum[1] && p[1] <= maximum[1]
+     && p[2] >= minimum[2] && p[2] <= maximum[2])
+    result.append(m_entries[middle].index);
+
+  int axis = m_axes[node];
+  if(minimum[axis] <= p[axis])
+    searchBox(2 * node + 1, first, middle, minimum, maximum, result);
+  if(maximum[axis] >= p[axis])
+    searchBox(2 * node + 2, middle + 1, last, minimum, maximum, result);
+}
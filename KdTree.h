@@ -0,0 +1,78 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+#include <QVector>
+#include <QVector3D>
+#include <vector>
+
+class PointCloud;
+
+// Spatial index over the positions of a point cloud: a balanced k-d tree
+// in an implicit layout.  Positions are copied with their indices and
+// reordered so that every subtree is a contiguous range whose middle entry
+// splits it; split axes are the only other storage.  Small ranges are
+// scanned as leaves.  Queries return indices into the source cloud and are
+// safe to run from several threads at once.
+class KdTree
+{
+public:
+  // Largest range scanned as a leaf
+  static const int LeafSize = 16;
+
+  KdTree();
+  // Builds in parallel on the global thread pool
+  explicit KdTree(const PointCloud& cloud);
+
+  int count() const { return m_entries.size(); }
+  bool isEmpty() const { return m_entries.empty(); }
+
+  // Index of the point closest to position, or -1 if empty
+  int nearest(const QVector3D& position) const;
+  // Up to k closest points, closest first; only those within maxDistance
+  // if it is positive
+  QVector<int> nearest(const QVector3D& position, int k,
+                       float maxDistance = -1.0f) const;
+  // Points within radius of center, in no particular order
+  QVector<int> withinRadius(const QVector3D& center, float radius) const;
+  // Points inside the box, bounds included, in no particular order
+  QVector<int> withinBox(const QVector3D& minimum,
+                         const QVector3D& maximum) const;
+
+  // Bytes of host memory held by the tree
+  qint64 memoryUsage() const;
+
+private:
+  struct Entry
+  {
+    float position[3];
+    int index;
+  };
+
+  struct Range
+  {
+    int node;
+    int first;
+    int last;
+  };
+
+  class Neighbors;
+
+  // Splits range at its middle along its longest side and returns the
+  // ranges of the children that aren't leaves
+  void split(const Range& range, QVector<Range>& children);
+  void buildSubtree(const Range& range);
+
+  void search(int node, int first, int last, const float *position,
+              Neighbors& neighbors) const;
+  void searchRadius(int node, int first, int last, const float *center,
+                    float radius2, QVector<int>& result) const;
+  void searchBox(int node, int first, int last, const float *minimum,
+                 const float *maximum, QVector<int>& result) const;
+
+  std::vector<Entry> m_entries;
+  // Split axis of each range larger than a leaf, in heap order: the
+  // children of node n are 2n + 1 and 2n + 2
+  std::vector<unsigned char> m_axes;
+};
+
+#endif // KDTREE_H
@@ -1,6 +1,8 @@
 #include "MainWindow.h"
 #include "ui_MainWindow.h"
 #include <QMenu>
+#include <QActionGroup>
+#include <QStatusBar>
 #include <QGLFormat>
 #include <QDebug>
 
@@ -13,24 +15,46 @@
 
 #include <QProgressDialog>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QMessageBox>
+#include <QInputDialog>
 
 #include <QtCore/qmath.h>
 
 #include <QMimeData>
+#include <QThread>
+#include <QTimer>
 
 #include "rply.h"
 
 #include "PointCloud.h"
 #include "PLYLoader.h"
+#include "Octree.h"
+#include "OctreeWriter.h"
+#include "NimbusFile.h"
 #include "PointGenerator.h"
+#include "MemoryUsage.h"
+
+// Milliseconds between memory samples while loading
+static const int LoadMemoryInterval = 20;
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
-  ui(new Ui::MainWindow), m_viewer(NULL)
+  ui(new Ui::MainWindow), m_viewer(NULL), m_loader(NULL),
+  m_loadProgress(NULL), m_writer(NULL), m_writeProgress(NULL),
+  m_writeCacheAction(NULL), m_performanceOverlayAction(NULL),
+  m_recordFramesAction(NULL),
+  m_loadPeakMemory(0), m_loadMemoryTimer(NULL)
 {
     ui->setupUi(this);
 
+    m_loadMemoryTimer = new QTimer(this);
+    m_loadMemoryTimer->setInterval(LoadMemoryInterval);
+    connect(m_loadMemoryTimer, SIGNAL(timeout()), SLOT(sampleLoadMemory()));
+
+    // Point clouds are passed from the loader thread through queued signals
+    qRegisterMetaType<PointCloud>("PointCloud");
+
     // Get default OpenGL format
     QGLFormat format = QGLFormat::defaultFormat();
 
@@ -68,8 +92,17 @@ MainWindow::MainWindow(QWidget *parent) :
                         QKeySequence::Open);
     fileMenu->addAction("Create Point Cloud...", m_createOptions,
                         SLOT(show()));
+    fileMenu->addAction("Build Out-of-Core Hierarchy...", this,
+                        SLOT(buildHierarchy()));
+
+    // Caches reopen without parsing or shuffling
+    m_writeCacheAction = fileMenu->addAction("Write Cache on Load");
+    m_writeCacheAction->setCheckable(true);
+    m_writeCacheAction->setChecked(true);
     connect(m_createOptions, SIGNAL(accepted(QString,int,bool)),
             SLOT(createPointCloud(QString,int,bool)));
+    connect(m_createOptions, SIGNAL(benchmarkSceneAccepted(qint64,int)),
+            SLOT(createBenchmarkScene(qint64,int)));
 
     // Hide option to export movie from flight path; Not ready for other users
     // fileMenu->addAction("Save Path Movie", m_viewer, SLOT(savePathMovie()));
@@ -96,8 +129,22 @@ MainWindow::MainWindow(QWidget *parent) :
             m_displayOptions, SLOT(setDepthMask(bool)));
     connect(m_viewer, SIGNAL(multisampleChanged(bool)),
             m_displayOptions, SLOT(setMultisample(bool)));
+    connect(m_viewer, SIGNAL(spatialOrderChanged(bool)),
+            m_displayOptions, SLOT(setSpatialOrder(bool)));
     connect(m_viewer, SIGNAL(fastInteractionChanged(bool)),
             m_displayOptions, SLOT(setFastInteraction(bool)));
+    connect(m_viewer, SIGNAL(targetFrameRateChanged(int)),
+            m_displayOptions, SLOT(setTargetFrameRate(int)));
+    connect(m_viewer, SIGNAL(eyeDomeLightingChanged(bool)),
+            m_displayOptions, SLOT(setEyeDomeLighting(bool)));
+    connect(m_viewer, SIGNAL(eyeDomeStrengthChanged(double)),
+            m_displayOptions, SLOT(setEyeDomeStrength(double)));
+    connect(m_viewer, SIGNAL(eyeDomeRadiusChanged(double)),
+            m_displayOptions, SLOT(setEyeDomeRadius(double)));
+    connect(m_viewer, SIGNAL(levelOfDetailChanged(bool)),
+            m_displayOptions, SLOT(setLevelOfDetail(bool)));
+    connect(m_viewer, SIGNAL(pointBudgetChanged(int)),
+            m_displayOptions, SLOT(setPointBudget(int)));
 
 
     // Sync display options dialog to viewer
@@ -113,8 +160,33 @@ MainWindow::MainWindow(QWidget *parent) :
             m_viewer, SLOT(setDepthMasking(bool)));
     connect(m_displayOptions, SIGNAL(multiSampleChanged(bool)),
             m_viewer, SLOT(setMultisample(bool)));
+    connect(m_displayOptions, SIGNAL(spatialOrderChanged(bool)),
+            m_viewer, SLOT(setSpatialOrder(bool)));
     connect(m_displayOptions, SIGNAL(fastInteractionChanged(bool)),
             m_viewer, SLOT(setFastInteraction(bool)));
+    connect(m_displayOptions, SIGNAL(targetFrameRateChanged(int)),
+            m_viewer, SLOT(setTargetFrameRate(int)));
+    connect(m_displayOptions, SIGNAL(eyeDomeLightingChanged(bool)),
+            m_viewer, SLOT(setEyeDomeLighting(bool)));
+    connect(m_displayOptions, SIGNAL(eyeDomeStrengthChanged(double)),
+            m_viewer, SLOT(setEyeDomeStrength(double)));
+    connect(m_displayOptions, SIGNAL(eyeDomeRadiusChanged(double)),
+            m_viewer, SLOT(setEyeDomeRadius(double)));
+    connect(m_displayOptions, SIGNAL(levelOfDetailChanged(bool)),
+            m_viewer, SLOT(setLevelOfDetail(bool)));
+    connect(m_displayOptions, SIGNAL(pointBudgetChanged(int)),
+            m_viewer, SLOT(setPointBudget(int)));
+    connect(m_displayOptions, SIGNAL(gpuMemoryBudgetChanged(int)),
+            m_viewer, SLOT(setGPUMemoryBudget(int)));
+    connect(m_displayOptions, SIGNAL(hostMemoryBudgetChanged(int)),
+            m_viewer, SLOT(setHostMemoryBudget(int)));
+
+    // Vertex format carries an enum; connected by pointer like stereo modes
+    connect(m_viewer, &Viewer::vertexFormatChanged, m_displayOptions,
+            &DisplayOptionsDialog::setVertexFormat);
+    connect(m_displayOptions, &DisplayOptionsDialog::vertexFormatChanged,
+            m_viewer, &Viewer::setVertexFormat);
+    m_displayOptions->setVertexFormat(m_viewer->vertexFormat());
 
     m_displayOptions->setMultisampleAvailable(m_viewer->multisampleAvailable());
 
@@ -160,6 +232,42 @@ MainWindow::MainWindow(QWidget *parent) :
 
     // Create menu item
     displayMenu->addAction("Stereo Options...", m_stereoOptions, SLOT(show()));
+    displayMenu->addAction("Voxel Downsample...", this, SLOT(downsample()));
+
+    displayMenu->addSeparator();
+    m_performanceOverlayAction = displayMenu->addAction("Performance Overlay");
+    m_performanceOverlayAction->setCheckable(true);
+    connect(m_performanceOverlayAction, SIGNAL(toggled(bool)),
+            m_viewer, SLOT(setPerformanceOverlay(bool)));
+    connect(m_viewer, SIGNAL(performanceOverlayChanged(bool)),
+            m_performanceOverlayAction, SLOT(setChecked(bool)));
+
+    m_recordFramesAction = displayMenu->addAction("Record Frame Statistics...");
+    m_recordFramesAction->setCheckable(true);
+    connect(m_recordFramesAction, SIGNAL(triggered(bool)),
+            SLOT(recordFrameStatistics(bool)));
+
+    // Measurements are picked with Shift-click in the viewer
+    QMenu *measureMenu = menuBar()->addMenu("Measure");
+    QActionGroup *measureGroup = new QActionGroup(this);
+    QStringList measureNames;
+    measureNames << "Off" << "Distance" << "Area" << "Height";
+    for(int i = 0; i < measureNames.count(); ++i)
+    {
+      QAction *action = measureMenu->addAction(measureNames[i]);
+      action->setCheckable(true);
+      action->setChecked(i == Viewer::NoMeasure);
+      action->setData(i);
+      measureGroup->addAction(action);
+    }
+    connect(measureGroup, SIGNAL(triggered(QAction*)),
+            SLOT(selectMeasureMode(QAction*)));
+
+    measureMenu->addSeparator();
+    measureMenu->addAction("Clear Measurement", m_viewer,
+                           SLOT(clearMeasurement()));
+    connect(m_viewer, SIGNAL(measurementChanged(QString)),
+            statusBar(), SLOT(showMessage(QString)));
 
     QMenu *helpMenu = menuBar()->addMenu("Help");
     helpMenu->addAction("Help...", m_viewer, SLOT(help()));
@@ -192,83 +300,286 @@ void MainWindow::openFile()
 
 void MainWindow::openFile(const QString &path)
 {
-  // Try to open PLY file
-  if(PLYLoader::canRead(path))
+  // Prefer an up to date hierarchy built from the file
+  QFileInfo hierarchy(OctreeWriter::hierarchyPath(path));
+  if(hierarchy.exists()
+     && hierarchy.lastModified() >= QFileInfo(path).lastModified()
+     && Octree::canRead(hierarchy.filePath()))
+  {
+    openFile(hierarchy.filePath());
+    return;
+  }
+
+  // Prefer an up to date native cache of the file
+  QFileInfo cache(NimbusFile::cachePath(path));
+  if(cache.exists() && cache.lastModified() >= QFileInfo(path).lastModified()
+     && NimbusFile::canRead(cache.filePath()))
   {
     PLYLoader loader;
-    if(loader.open(path))
+    if(loader.open(cache.filePath()))
     {
-      QProgressDialog progress(this);
-      progress.setWindowModality(Qt::WindowModal);
-      progress.setRange(0, 100);
-      progress.setMinimumDuration(1000);
-      progress.setAutoClose(false);
-
-      connect(&loader, SIGNAL(progress(int)), &progress, SLOT(setValue(int)));
-      connect(&progress, SIGNAL(canceled()), &loader, SLOT(cancel()));
-
-      PointCloud cloud = loader.load();
-      cloud.shuffle();
-      m_viewer->setPointCloud(cloud);
+      openFile(cache.filePath());
+      return;
+    }
+  }
 
-      // Load cameras
-      for(int i = 0; i < loader.cameraPositions().count(); i += 3)
-      {
-        Vec position(loader.cameraPositions().at(i + 0),
-                     loader.cameraPositions().at(i + 1),
-                     loader.cameraPositions().at(i + 2));
+  // Try to open out of core hierarchy
+  if(Octree::canRead(path))
+  {
+    abandonLoad();
 
-        m_viewer->camera()->setPosition(position);
+    m_loadPeakMemory = 0;
+    sampleLoadMemory();
+    if(m_viewer->openOctree(path))
+    {
+      sampleLoadMemory();
+      return;
+    }
+  }
 
-        Vec up(loader.cameraUpVectors().at(i + 0),
-               loader.cameraUpVectors().at(i + 1),
-               loader.cameraUpVectors().at(i + 2));
+  // Try to open PLY file
+  if(PLYLoader::canRead(path))
+  {
+    PLYLoader *loader = new PLYLoader();
+    if(loader->open(path))
+    {
+      abandonLoad();
+      m_loader = loader;
 
-        m_viewer->camera()->setUpVector(up);
+      if(m_writeCacheAction->isChecked() && !NimbusFile::canRead(path))
+        loader->setCachePath(NimbusFile::cachePath(path));
 
-        Vec aim(loader.cameraAimVectors().at(i + 0),
-                loader.cameraAimVectors().at(i + 1),
-                loader.cameraAimVectors().at(i + 2));
-        m_viewer->camera()->setViewDirection(aim);
+      if(!m_loadProgress)
+      {
+        // Not modal; the viewer stays usable and shows points as they arrive
+        m_loadProgress = new QProgressDialog(this);
+        m_loadProgress->setRange(0, 100);
+        m_loadProgress->setMinimumDuration(1000);
+        m_loadProgress->setAutoClose(false);
+        m_loadProgress->setAutoReset(false);
+        connect(m_loadProgress, SIGNAL(canceled()), SLOT(cancelLoad()));
+      }
+      m_loadProgress->setLabelText("Loading " + QFileInfo(path).fileName());
+      m_loadProgress->reset();
 
-        Vec aspect(loader.cameraAspectRatios().at(i + 0),
-                   loader.cameraAspectRatios().at(i + 1),
-                   loader.cameraAspectRatios().at(i + 2));
+      // Load in a worker thread
+      QThread *thread = new QThread(this);
+      loader->moveToThread(thread);
 
-        m_viewer->camera()->setFieldOfView(2 * qAtan((0.5 * aspect.y)/aspect.z));
+      connect(thread, SIGNAL(started()), loader, SLOT(run()));
+      connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+      connect(loader, SIGNAL(progress(int)), m_loadProgress,
+              SLOT(setValue(int)));
+      connect(loader, SIGNAL(chunkLoaded(int,PointCloud)), m_viewer,
+              SLOT(appendPoints(int,PointCloud)));
+      connect(loader, SIGNAL(loaded(PointCloud)),
+              SLOT(loadFinished(PointCloud)));
 
-        m_viewer->m_fov.push_back(2 * qAtan((0.5 * aspect.y)/aspect.z));
-        m_viewer->camera()->addKeyFrameToPath(1);
-      }
+      m_viewer->beginPointCloud(loader->pointCount(), loader->hasColor());
 
-      // Check that keyframes have been added to path 1
-      if(m_viewer->camera()->keyFrameInterpolator(1) != NULL)
-      {
-        connect(m_viewer->camera()->keyFrameInterpolator(1),
-                SIGNAL(interpolated()), m_viewer, SLOT(updateGL()));
+      m_loadPeakMemory = 0;
+      sampleLoadMemory();
+      m_loadMemoryTimer->start();
 
-        m_viewer->camera()->keyFrameInterpolator(1)->setInterpolationSpeed(4.0);
-      }
-      progress.close();
+      thread->start();
 
       return;
     }
+
+    delete loader;
   }
 
   QMessageBox::critical(this, "Unable to open file",
                         path + " is not a supported format.");
 }
 
+void MainWindow::abandonLoad()
+{
+  // Abandon any load still in progress; its thread cleans up on its own
+  if(m_loader)
+  {
+    disconnect(m_loader, 0, m_viewer, 0);
+    disconnect(m_loader, 0, m_loadProgress, 0);
+    m_loader->cancel();
+    m_loader = NULL;
+    m_loadProgress->close();
+    m_loadMemoryTimer->stop();
+  }
+}
+
+void MainWindow::sampleLoadMemory()
+{
+  m_loadPeakMemory = qMax(m_loadPeakMemory, MemoryUsage::currentResident());
+}
+
+void MainWindow::buildHierarchy()
+{
+  if(m_writer)
+  {
+    QMessageBox::information(this, "Build Out-of-Core Hierarchy",
+                             "A hierarchy is already being built.");
+    return;
+  }
+
+  QString source = QFileDialog::getOpenFileName(this, "Build Out-of-Core "
+                                                "Hierarchy", QString(),
+                                                "PLY Files (*.ply)");
+  if(source.isEmpty())
+    return;
+
+  if(!PLYLoader::canRead(source))
+  {
+    QMessageBox::critical(this, "Unable to open file",
+                          source + " is not a supported format.");
+    return;
+  }
+
+  m_writer = new OctreeWriter(source, OctreeWriter::hierarchyPath(source));
+
+  if(!m_writeProgress)
+  {
+    m_writeProgress = new QProgressDialog(this);
+    m_writeProgress->setRange(0, 100);
+    m_writeProgress->setAutoClose(false);
+    m_writeProgress->setAutoReset(false);
+  }
+  m_writeProgress->setLabelText("Building hierarchy for "
+                                + QFileInfo(source).fileName());
+  m_writeProgress->reset();
+  m_writeProgress->show();
+
+  // Build in a worker thread like loads
+  QThread *thread = new QThread(this);
+  m_writer->moveToThread(thread);
+
+  connect(thread, SIGNAL(started()), m_writer, SLOT(run()));
+  connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+  connect(m_writer, SIGNAL(progress(int)), m_writeProgress,
+          SLOT(setValue(int)));
+  connect(m_writer, SIGNAL(finished(bool)), SLOT(writerFinished(bool)));
+  // The writer's thread is busy until done, so cancel directly
+  connect(m_writeProgress, SIGNAL(canceled()), m_writer, SLOT(cancel()),
+          Qt::DirectConnection);
+
+  thread->start();
+}
+
+void MainWindow::writerFinished(bool success)
+{
+  OctreeWriter *writer = qobject_cast<OctreeWriter *>(sender());
+  if(!writer)
+    return;
+
+  writer->thread()->quit();
+  writer->deleteLater();
+
+  bool canceled = m_writeProgress->wasCanceled();
+  m_writeProgress->close();
+  m_writer = NULL;
+
+  if(success)
+    openFile(writer->destination());
+  else if(!canceled)
+    QMessageBox::critical(this, "Unable to build hierarchy",
+                          "Unable to write " + writer->destination() + ".");
+}
+
+void MainWindow::cancelLoad()
+{
+  if(m_loader)
+    m_loader->cancel();
+}
+
+void MainWindow::loadFinished(PointCloud cloud)
+{
+  PLYLoader *loader = qobject_cast<PLYLoader *>(sender());
+  if(!loader)
+    return;
+
+  // Loader is done; let its thread finish and clean up
+  loader->thread()->quit();
+  loader->deleteLater();
+
+  // Ignore results of abandoned loads
+  if(loader != m_loader)
+    return;
+
+  m_loader = NULL;
+
+  // Includes the VBO upload, which may be staged in host memory
+  sampleLoadMemory();
+  m_viewer->setPointCloud(cloud);
+  sampleLoadMemory();
+  m_loadMemoryTimer->stop();
+
+  loadCameras(loader->cameraPositions(), loader->cameraUpVectors(),
+              loader->cameraAimVectors(), loader->cameraAspectRatios());
+
+  m_loadProgress->close();
+}
+
+void MainWindow::loadCameras(const QVector<double> &positions,
+                             const QVector<double> &ups,
+                             const QVector<double> &aims,
+                             const QVector<double> &aspects)
+{
+  // Load cameras
+  for(int i = 0; i + 2 < positions.count(); i += 3)
+  {
+    Vec position(positions.at(i + 0),
+                 positions.at(i + 1),
+                 positions.at(i + 2));
+
+    m_viewer->camera()->setPosition(position);
+
+    Vec up(ups.at(i + 0),
+           ups.at(i + 1),
+           ups.at(i + 2));
+
+    m_viewer->camera()->setUpVector(up);
+
+    Vec aim(aims.at(i + 0),
+            aims.at(i + 1),
+            aims.at(i + 2));
+    m_viewer->camera()->setViewDirection(aim);
+
+    Vec aspect(aspects.at(i + 0),
+               aspects.at(i + 1),
+               aspects.at(i + 2));
+
+    m_viewer->camera()->setFieldOfView(2 * qAtan((0.5 * aspect.y)/aspect.z));
+
+    m_viewer->m_fov.push_back(2 * qAtan((0.5 * aspect.y)/aspect.z));
+    m_viewer->camera()->addKeyFrameToPath(1);
+  }
+
+  // Check that keyframes have been added to path 1
+  if(m_viewer->camera()->keyFrameInterpolator(1) != NULL)
+  {
+    connect(m_viewer->camera()->keyFrameInterpolator(1),
+            SIGNAL(interpolated()), m_viewer, SLOT(updateGL()));
+
+    m_viewer->camera()->keyFrameInterpolator(1)->setInterpolationSpeed(4.0);
+  }
+}
+
 void MainWindow::showInfo()
 {
   m_infoDialog->setOpenGLInfo(m_viewer->openGLInfo());
-  m_infoDialog->setPointCloudInfo(m_viewer->pointCloudInfo());
+  QStringList info = m_viewer->pointCloudInfo();
+  if(m_loadPeakMemory > 0)
+  {
+    info << ("Peak Memory During Load;"
+             + QString("%L1 MB").arg(m_loadPeakMemory/(1024.0 * 1024.0), 0, 'f', 1));
+  }
+
+  m_infoDialog->setPointCloudInfo(info);
   m_infoDialog->show();
 }
 
 bool MainWindow::canRead(const QString &path)
 {
-  return PLYLoader::canRead(path);
+  return PLYLoader::canRead(path) || Octree::canRead(path);
 }
 
 void MainWindow::createPointCloud(QString shape, int count, bool asSurface)
@@ -286,7 +597,122 @@ void MainWindow::createPointCloud(QString shape, int count, bool asSurface)
 
   progress.hide();
 
-  m_viewer->setPointCloud(cloud);
+  // Empty if canceled
+  if(!cloud.isEmpty())
+  {
+    abandonLoad();
+    m_viewer->setPointCloud(cloud);
+  }
+}
+
+void MainWindow::recordFrameStatistics(bool record)
+{
+  if(!record)
+  {
+    m_viewer->stopFrameLog();
+    return;
+  }
+
+  QString path = QFileDialog::getSaveFileName(this, "Record Frame Statistics",
+                                              "frames.csv",
+                                              "CSV Files (*.csv)");
+
+  if(path.isEmpty())
+  {
+    m_recordFramesAction->setChecked(false);
+    return;
+  }
+
+  if(!m_viewer->startFrameLog(path))
+  {
+    m_recordFramesAction->setChecked(false);
+    QMessageBox::critical(this, "Unable to record frame statistics",
+                          "Could not write " + path);
+  }
+}
+
+void MainWindow::downsample()
+{
+  const PointCloud cloud = m_viewer->pointCloud();
+  if(cloud.isEmpty())
+  {
+    QMessageBox::information(this, "Voxel Downsample",
+                             "Downsampling needs a point cloud held in "
+                             "memory; out-of-core hierarchies are not "
+                             "supported.");
+    return;
+  }
+
+  // Default gives about a thousand cells along the longest side
+  QVector3D extent = cloud.boundingBoxMaximum() - cloud.boundingBoxMinimum();
+  double longest = qMax(extent.x(), qMax(extent.y(), extent.z()));
+
+  bool ok = false;
+  double size = QInputDialog::getDouble(this, "Voxel Downsample",
+                                        "Voxel size:", longest/1000.0,
+                                        1e-6, 1e9, 4, &ok);
+  if(!ok)
+    return;
+
+  QApplication::setOverrideCursor(Qt::WaitCursor);
+  PointCloud reduced = cloud.voxelDownsample(size);
+  reduced.shuffle();
+  QApplication::restoreOverrideCursor();
+
+  // A load still streaming would overwrite the result
+  abandonLoad();
+  m_viewer->setPointCloud(reduced);
+  statusBar()->showMessage(QString("Downsampled %1 points to %2")
+                           .arg(cloud.count()).arg(reduced.count()));
+}
+
+void MainWindow::selectMeasureMode(QAction *action)
+{
+  m_viewer->setMeasureMode((Viewer::MeasureMode)action->data().toInt());
+}
+
+void MainWindow::createBenchmarkScene(qint64 count, int seed)
+{
+  QString path = QFileDialog::getSaveFileName(this, "Save Benchmark Scene",
+                                              QString("scene-%1.ply").arg(seed),
+                                              "PLY Files (*.ply);;"
+                                              "Nimbus Files (*.nimbus)");
+  if(path.isEmpty())
+    return;
+
+  PointGenerator generator;
+  generator.setSeed(seed);
+
+  QProgressDialog progress(this);
+  progress.setWindowModality(Qt::WindowModal);
+  progress.setLabelText("Writing " + QFileInfo(path).fileName());
+
+  connect(&generator, SIGNAL(setRange(int,int)), &progress,
+          SLOT(setRange(int,int)));
+  connect(&generator, SIGNAL(progress(int)), &progress, SLOT(setValue(int)));
+  connect(&progress, SIGNAL(canceled()), &generator, SLOT(cancel()));
+
+  bool result = generator.writeBenchmarkScene(path, count);
+  bool canceled = progress.wasCanceled();
+
+  progress.hide();
+
+  if(!result)
+  {
+    if(!canceled)
+      QMessageBox::critical(this, "Unable to write scene",
+                            "Unable to write " + path + ".");
+    return;
+  }
+
+  if(QMessageBox::question(this, "Benchmark Scene",
+                           QString("Wrote %L1 points to %2. Open it now?")
+                           .arg(count).arg(QFileInfo(path).fileName()),
+                           QMessageBox::Yes | QMessageBox::No)
+     == QMessageBox::Yes)
+  {
+    openFile(path);
+  }
 }
 
 void MainWindow::closeEvent(QCloseEvent *)
@@ -339,5 +765,15 @@ void MainWindow::dropEvent(QDropEvent *e)
 
 MainWindow::~MainWindow()
 {
+    // Stop loads in progress before their threads are destroyed
+    cancelLoad();
+    if(m_writer)
+      m_writer->cancel();
+    foreach(QThread *thread, findChildren<QThread *>())
+    {
+      thread->quit();
+      thread->wait();
+    }
+
     delete ui;
 }
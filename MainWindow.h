@@ -9,6 +9,13 @@
 #include "StereoOptionsDialog.h"
 #include "InfoDialog.h"
 #include "Viewer.h"
+#include "PointCloud.h"
+
+class PLYLoader;
+class OctreeWriter;
+class QProgressDialog;
+class QAction;
+class QTimer;
 
 namespace Ui {
 class MainWindow;
@@ -29,6 +36,23 @@ public slots:
   void openFile(const QString& path);
   void showInfo();
   void createPointCloud(QString shape, int points, bool asSurface);
+  // Streams a seeded benchmark scene to a file chosen by the user
+  void createBenchmarkScene(qint64 count, int seed);
+  void cancelLoad();
+  // Converts a PLY file into an out of core hierarchy and opens it
+  void buildHierarchy();
+  // Starts or stops writing frame statistics to a CSV file
+  void recordFrameStatistics(bool record);
+  // Replaces the cloud with one thinned to a voxel grid chosen by the user
+  void downsample();
+  // Measure menu; the mode is the action's data
+  void selectMeasureMode(QAction *action);
+
+protected slots:
+  void loadFinished(PointCloud cloud);
+  void writerFinished(bool success);
+  // Folds current resident memory into the peak of the running load
+  void sampleLoadMemory();
 
 protected:
   void closeEvent(QCloseEvent *);
@@ -36,6 +60,11 @@ protected:
   void dropEvent(QDropEvent *);
 
 private:
+  void abandonLoad();
+  void loadCameras(const QVector<double>& positions, const QVector<double>& ups,
+                   const QVector<double>& aims,
+                   const QVector<double>& aspects);
+
   Ui::MainWindow *ui;
 
   Viewer* m_viewer;
@@ -44,6 +73,25 @@ private:
   CreatePointCloudDialog* m_createOptions;
   StereoOptionsDialog* m_stereoOptions;
   InfoDialog* m_infoDialog;
+
+  // Loader running in a worker thread, if any
+  PLYLoader* m_loader;
+  QProgressDialog* m_loadProgress;
+
+  // Hierarchy being built in a worker thread, if any
+  OctreeWriter* m_writer;
+  QProgressDialog* m_writeProgress;
+
+  // Whether loads write a native cache next to the file
+  QAction* m_writeCacheAction;
+
+  QAction* m_performanceOverlayAction;
+  QAction* m_recordFramesAction;
+
+  // Peak resident memory of the last file load, sampled while it runs; the
+  // process peak would keep reporting the largest file ever loaded
+  qint64 m_loadPeakMemory;
+  QTimer* m_loadMemoryTimer;
 };
 
 #endif // MAINWINDOW_H
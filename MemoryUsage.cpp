@@ -0,0 +1,66 @@
+#include "MemoryUsage.h"
+
+#if defined(Q_OS_WIN)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(Q_OS_MAC)
+#include <sys/resource.h>
+#include <mach/mach.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/resource.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+qint64 MemoryUsage::peakResident()
+{
+#if defined(Q_OS_WIN)
+  PROCESS_MEMORY_COUNTERS counters;
+  if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return counters.PeakWorkingSetSize;
+  return 0;
+#elif defined(Q_OS_UNIX)
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if defined(Q_OS_MAC)
+  // Reported in bytes on OS X
+  return usage.ru_maxrss;
+#else
+  // Reported in kilobytes on Linux
+  return (qint64)usage.ru_maxrss * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+qint64 MemoryUsage::currentResident()
+{
+#if defined(Q_OS_WIN)
+  PROCESS_MEMORY_COUNTERS counters;
+  if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return counters.WorkingSetSize;
+  return 0;
+#elif defined(Q_OS_MAC)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info,
+               &count) != KERN_SUCCESS)
+    return 0;
+  return info.resident_size;
+#elif defined(Q_OS_UNIX)
+  // Second field is resident pages
+  FILE *file = fopen("/proc/self/statm", "r");
+  if(!file)
+    return 0;
+
+  long size = 0, resident = 0;
+  int fields = fscanf(file, "%ld %ld", &size, &resident);
+  fclose(file);
+
+  return fields == 2 ? (qint64)resident * sysconf(_SC_PAGESIZE) : 0;
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,15 @@
+#ifndef MEMORYUSAGE_H
+#define MEMORYUSAGE_H
+
+#include <QtGlobal>
+
+class MemoryUsage
+{
+public:
+  // Peak resident set size of this process in bytes; 0 if unavailable
+  static qint64 peakResident();
+  // Current resident set size of this process in bytes; 0 if unavailable
+  static qint64 currentResident();
+};
+
+#endif // MEMORYUSAGE_H
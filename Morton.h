@@ -0,0 +1,35 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include <QtGlobal>
+
+namespace Morton
+{
+  // Bits of each coordinate in a code; codes are 63 bits
+  const int AxisBits = 21;
+
+  // Z-order curve index of a cell: the bits of x, y and z interleaved, x
+  // highest.  Sorting by code keeps nearby cells close, and the cells of
+  // every octant of a cube contiguous.
+  inline quint64 code(quint32 x, quint32 y, quint32 z)
+  {
+    // Spread the 21 bits of each coordinate out to every third bit
+    struct Spread
+    {
+      static quint64 bits(quint64 v)
+      {
+        v &= 0x1fffff;
+        v = (v | v << 32) & Q_UINT64_C(0x1f00000000ffff);
+        v = (v | v << 16) & Q_UINT64_C(0x1f0000ff0000ff);
+        v = (v | v << 8) & Q_UINT64_C(0x100f00f00f00f00f);
+        v = (v | v << 4) & Q_UINT64_C(0x10c30c30c30c30c3);
+        v = (v | v << 2) & Q_UINT64_C(0x1249249249249249);
+        return v;
+      }
+    };
+
+    return (Spread::bits(x) << 2) | (Spread::bits(y) << 1) | Spread::bits(z);
+  }
+}
+
+#endif // MORTON_H
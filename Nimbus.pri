@@ -0,0 +1,97 @@
+# Point cloud loading and rendering shared by Nimbus and its tools; the
+# dialogs and main window are in Nimbus.pro
+
+QT       += core gui opengl xml
+
+CONFIG(release)
+{
+  CONFIG += optimize_full
+}
+
+win32 {
+DEFINES += QGLVIEWER_STATIC
+LIBS += -lopengl32 -lglu32 -lpsapi
+}
+
+unix:!macx {
+DEFINES += NO_VBLANK_SYNC
+LIBS += -lGLU
+}
+
+INCLUDEPATH += $$PWD $$PWD/3rdparty/rply
+
+SOURCES += $$PWD/Viewer.cpp \
+    $$PWD/3rdparty/rply/rply.c \
+    $$PWD/PointCloud.cpp \
+    $$PWD/PLYLoader.cpp \
+    $$PWD/PointGenerator.cpp \
+    $$PWD/MemoryUsage.cpp \
+    $$PWD/Octree.cpp \
+    $$PWD/OctreeWriter.cpp \
+    $$PWD/NimbusFile.cpp \
+    $$PWD/PLYWriter.cpp \
+    $$PWD/FrameStatistics.cpp \
+    $$PWD/PointShader.cpp \
+    $$PWD/EyeDomeLighting.cpp \
+    $$PWD/KdTree.cpp
+
+HEADERS  += $$PWD/Viewer.h \
+    $$PWD/3rdparty/rply/rply.h \
+    $$PWD/PointCloud.h \
+    $$PWD/PLYLoader.h \
+    $$PWD/PointGenerator.h \
+    $$PWD/MemoryUsage.h \
+    $$PWD/Parallel.h \
+    $$PWD/Random.h \
+    $$PWD/Octree.h \
+    $$PWD/OctreeWriter.h \
+    $$PWD/NimbusFile.h \
+    $$PWD/PLYWriter.h \
+    $$PWD/FrameStatistics.h \
+    $$PWD/PointShader.h \
+    $$PWD/EyeDomeLighting.h \
+    $$PWD/KdTree.h \
+    $$PWD/RadixSort.h \
+    $$PWD/Morton.h
+
+RESOURCES += \
+    $$PWD/Nimbus.qrc
+
+CONFIG(static):{
+  message(Static compile enabled)
+  DEFINES += NIMBUS_STATIC
+  DEFINES += QGLVIEWER_STATIC
+}
+
+
+# libQGLViewer source and headers
+DEFINES *= NO_VECTORIAL_RENDER
+
+INCLUDEPATH += $$PWD/3rdparty
+
+HEADERS *= $$PWD/3rdparty/QGLViewer/qglviewer.h \
+    $$PWD/3rdparty/QGLViewer/camera.h \
+    $$PWD/3rdparty/QGLViewer/manipulatedFrame.h \
+    $$PWD/3rdparty/QGLViewer/manipulatedCameraFrame.h \
+    $$PWD/3rdparty/QGLViewer/frame.h \
+    $$PWD/3rdparty/QGLViewer/constraint.h \
+    $$PWD/3rdparty/QGLViewer/keyFrameInterpolator.h \
+    $$PWD/3rdparty/QGLViewer/mouseGrabber.h \
+    $$PWD/3rdparty/QGLViewer/quaternion.h \
+    $$PWD/3rdparty/QGLViewer/vec.h \
+    $$PWD/3rdparty/QGLViewer/domUtils.h \
+    $$PWD/3rdparty/QGLViewer/config.h
+
+SOURCES *= $$PWD/3rdparty/QGLViewer/qglviewer.cpp \
+    $$PWD/3rdparty/QGLViewer/camera.cpp \
+    $$PWD/3rdparty/QGLViewer/manipulatedFrame.cpp \
+    $$PWD/3rdparty/QGLViewer/manipulatedCameraFrame.cpp \
+    $$PWD/3rdparty/QGLViewer/frame.cpp \
+    $$PWD/3rdparty/QGLViewer/saveSnapshot.cpp \
+    $$PWD/3rdparty/QGLViewer/constraint.cpp \
+    $$PWD/3rdparty/QGLViewer/keyFrameInterpolator.cpp \
+    $$PWD/3rdparty/QGLViewer/mouseGrabber.cpp \
+    $$PWD/3rdparty/QGLViewer/quaternion.cpp \
+    $$PWD/3rdparty/QGLViewer/vec.cpp
+
+FORMS *= $$PWD/3rdparty/QGLViewer/ImageInterface.ui
@@ -0,0 +1,407 @@
+#include "NimbusFile.h"
+#include <QDataStream>
+#include <QBuffer>
+#include <QSaveFile>
+#include <QDebug>
+#include <cstring>
+#include <climits>
+
+const char NimbusFile::FileMagic[8] = { 'N', 'I', 'M', 'B', 'U', 'S', 'P', 'C' };
+
+// Header flags
+static const quint32 ColorFlag = 1;
+static const quint32 ShuffledFlag = 2;
+
+// Attribute value types; only floats so far
+static const quint32 Float32Attribute = 0;
+
+// Blocks start on page boundaries so they can be mapped and uploaded as is
+static const qint64 BlockAlignment = 4096;
+
+// Bytes written per call; keeps single writes of huge blocks off some
+// platforms' limits
+static const qint64 WriteSize = 64 << 20;
+
+static qint64 align(qint64 offset)
+{
+  return (offset + BlockAlignment - 1)/BlockAlignment * BlockAlignment;
+}
+
+static bool writeBlock(QIODevice *device, qint64 offset, const void *data,
+                       qint64 size)
+{
+  if(!device->seek(offset))
+    return false;
+
+  const char *p = static_cast<const char *>(data);
+  for(qint64 written = 0; written < size; written += WriteSize)
+  {
+    qint64 n = qMin(WriteSize, size - written);
+    if(device->write(p + written, n) != n)
+      return false;
+  }
+
+  return true;
+}
+
+NimbusFile::NimbusFile() : m_mapped(NULL), m_output(NULL), m_written(0),
+  m_pointCount(0), m_shuffled(false), m_pointOffset(0), m_colorOffset(0)
+{
+}
+
+NimbusFile::~NimbusFile()
+{
+  if(m_mapped)
+    m_file.unmap(m_mapped);
+
+  // Never committed; discard
+  delete m_output;
+}
+
+QString NimbusFile::cachePath(const QString &source)
+{
+  return source + ".nimbus";
+}
+
+bool NimbusFile::canRead(const QString &path)
+{
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly))
+    return false;
+
+  return file.read(sizeof(FileMagic)) == QByteArray(FileMagic, sizeof(FileMagic));
+}
+
+bool NimbusFile::write(const QString &path, const PointCloud &cloud,
+                       const QVector<double> &cameraPositions,
+                       const QVector<double> &cameraUps,
+                       const QVector<double> &cameraAims,
+                       const QVector<double> &cameraAspects,
+                       bool shuffled)
+{
+  NimbusFile file;
+  file.setCameras(cameraPositions, cameraUps, cameraAims, cameraAspects);
+
+  return file.create(path, cloud.count(), cloud.hasColor(),
+                     cloud.attributeNames(), shuffled)
+      && file.append(cloud) && file.commit();
+}
+
+void NimbusFile::setCameras(const QVector<double> &positions,
+                            const QVector<double> &ups,
+                            const QVector<double> &aims,
+                            const QVector<double> &aspects)
+{
+  m_cameraPositions = positions;
+  m_cameraUps = ups;
+  m_cameraAims = aims;
+  m_cameraAspects = aspects;
+}
+
+bool NimbusFile::create(const QString &path, int count, bool hasColor,
+                        const QStringList &attributeNames, bool shuffled)
+{
+  if(Q_BYTE_ORDER != Q_LITTLE_ENDIAN || count <= 0 || m_output)
+    return false;
+
+  m_pointCount = count;
+  m_shuffled = shuffled;
+  m_attributeNames = attributeNames;
+  m_attributeOffsets = QVector<qint64>(attributeNames.count(), 0);
+  m_pointOffset = m_colorOffset = 0;
+  m_written = 0;
+
+  // Lay out blocks after the header; its size does not depend on the
+  // offsets and bounds filled in later
+  m_pointOffset = align(header().size());
+  qint64 end = m_pointOffset + (qint64)count * 3 * sizeof(float);
+
+  if(hasColor)
+  {
+    m_colorOffset = align(end);
+    end = m_colorOffset + (qint64)count * 3;
+  }
+
+  for(int i = 0; i < m_attributeNames.count(); ++i)
+  {
+    m_attributeOffsets[i] = align(end);
+    end = m_attributeOffsets[i] + (qint64)count * sizeof(float);
+  }
+
+  // Written to a temporary file first, so an interrupted write never leaves
+  // a file behind that looks valid
+  m_output = new QSaveFile(path);
+  if(!m_output->open(QIODevice::WriteOnly))
+  {
+    delete m_output;
+    m_output = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+bool NimbusFile::append(const PointCloud &points)
+{
+  if(!m_output || m_written + points.count() > m_pointCount)
+    return false;
+
+  const qint64 first = m_written;
+  const qint64 count = points.count();
+
+  bool result = writeBlock(m_output, m_pointOffset + first * 3 * sizeof(float),
+                           points.pointData(), count * 3 * sizeof(float));
+
+  if(result && hasColor())
+  {
+    result = points.hasColor()
+        && writeBlock(m_output, m_colorOffset + first * 3, points.colorData(),
+                      count * 3);
+  }
+
+  for(int i = 0; result && i < m_attributeNames.count(); ++i)
+  {
+    const float *attribute = points.attributeData(m_attributeNames.at(i));
+    result = attribute
+        && writeBlock(m_output, m_attributeOffsets.at(i)
+                      + first * sizeof(float), attribute,
+                      count * sizeof(float));
+  }
+
+  if(!result)
+  {
+    qWarning() << "Unable to write" << m_output->fileName();
+    return false;
+  }
+
+  // Bounds of everything written so far
+  if(count > 0)
+  {
+    const QVector3D& min = points.boundingBoxMinimum();
+    const QVector3D& max = points.boundingBoxMaximum();
+    if(m_written == 0)
+    {
+      m_min = min;
+      m_max = max;
+    } else {
+      m_min = QVector3D(qMin(min.x(), m_min.x()), qMin(min.y(), m_min.y()),
+                        qMin(min.z(), m_min.z()));
+      m_max = QVector3D(qMax(max.x(), m_max.x()), qMax(max.y(), m_max.y()),
+                        qMax(max.z(), m_max.z()));
+    }
+  }
+
+  m_written += count;
+
+  return true;
+}
+
+bool NimbusFile::commit()
+{
+  if(!m_output)
+    return false;
+
+  QByteArray data = header();
+
+  bool result = m_written == m_pointCount && m_output->seek(0)
+      && m_output->write(data) == data.size();
+
+  if(result)
+  {
+    result = m_output->commit();
+  } else {
+    qWarning() << "Unable to write" << m_output->fileName();
+    m_output->cancelWriting();
+  }
+
+  delete m_output;
+  m_output = NULL;
+
+  return result;
+}
+
+QByteArray NimbusFile::header() const
+{
+  QByteArray result;
+  QBuffer buffer(&result);
+  buffer.open(QIODevice::WriteOnly);
+
+  QDataStream stream(&buffer);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+  quint32 flags = (m_shuffled ? ShuffledFlag : 0)
+      | (hasColor() ? ColorFlag : 0);
+
+  stream.writeRawData(FileMagic, sizeof(FileMagic));
+  stream << FileVersion << flags << (qint64)m_pointCount;
+  stream << m_min.x() << m_min.y() << m_min.z()
+         << m_max.x() << m_max.y() << m_max.z();
+
+  stream << m_pointOffset << m_colorOffset;
+
+  stream << (quint32)m_attributeNames.count();
+  for(int i = 0; i < m_attributeNames.count(); ++i)
+  {
+    stream << m_attributeNames.at(i).toUtf8() << Float32Attribute
+           << m_attributeOffsets.at(i);
+  }
+
+  // Cameras keep full precision
+  stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+  int cameras = qMin(qMin(m_cameraPositions.count(), m_cameraUps.count()),
+                     qMin(m_cameraAims.count(), m_cameraAspects.count()))/3;
+  stream << (quint32)cameras;
+  for(int i = 0; i < cameras * 3; ++i)
+  {
+    stream << m_cameraPositions.at(i) << m_cameraUps.at(i)
+           << m_cameraAims.at(i) << m_cameraAspects.at(i);
+  }
+
+  return result;
+}
+
+bool NimbusFile::open(const QString &path)
+{
+  if(Q_BYTE_ORDER != Q_LITTLE_ENDIAN)
+    return false;
+
+  m_file.setFileName(path);
+  if(!m_file.open(QIODevice::ReadOnly))
+    return false;
+
+  QDataStream stream(&m_file);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+  char magic[sizeof(FileMagic)];
+  quint32 version, flags, attributeCount, cameraCount;
+  qint64 pointCount;
+  float bounds[6];
+
+  if(stream.readRawData(magic, sizeof(magic)) != sizeof(magic)
+     || memcmp(magic, FileMagic, sizeof(magic)) != 0)
+    return false;
+
+  stream >> version;
+  if(version != FileVersion)
+  {
+    qWarning() << path << "has unsupported version" << version;
+    return false;
+  }
+
+  stream >> flags >> pointCount;
+  for(int i = 0; i < 6; ++i)
+    stream >> bounds[i];
+  stream >> m_pointOffset >> m_colorOffset;
+
+  // Counts are limited like PointCloud's
+  if(pointCount <= 0 || pointCount > INT_MAX)
+    return false;
+
+  m_pointCount = pointCount;
+  m_shuffled = flags & ShuffledFlag;
+  if(!(flags & ColorFlag))
+    m_colorOffset = 0;
+  m_min = QVector3D(bounds[0], bounds[1], bounds[2]);
+  m_max = QVector3D(bounds[3], bounds[4], bounds[5]);
+
+  stream >> attributeCount;
+  for(quint32 i = 0; i < attributeCount && stream.status() == QDataStream::Ok;
+      ++i)
+  {
+    QByteArray name;
+    quint32 type;
+    qint64 offset;
+    stream >> name >> type >> offset;
+
+    if(type != Float32Attribute)
+    {
+      qWarning() << "Ignoring attribute" << name << "of unknown type";
+      continue;
+    }
+
+    m_attributeNames << QString::fromUtf8(name);
+    m_attributeOffsets << offset;
+  }
+
+  stream.setFloatingPointPrecision(QDataStream::DoublePrecision);
+
+  stream >> cameraCount;
+  for(quint32 i = 0; i < cameraCount * 3 && stream.status() == QDataStream::Ok;
+      ++i)
+  {
+    double position, up, aim, aspect;
+    stream >> position >> up >> aim >> aspect;
+    m_cameraPositions << position;
+    m_cameraUps << up;
+    m_cameraAims << aim;
+    m_cameraAspects << aspect;
+  }
+
+  if(stream.status() != QDataStream::Ok)
+    return false;
+
+  // Every block must be within the file
+  qint64 size = m_file.size();
+  bool complete = m_pointOffset + (qint64)m_pointCount * 3 * sizeof(float) <= size
+      && m_colorOffset + (hasColor() ? (qint64)m_pointCount * 3 : 0) <= size;
+  foreach(qint64 offset, m_attributeOffsets)
+    complete = complete && offset + (qint64)m_pointCount * sizeof(float) <= size;
+
+  if(!complete)
+  {
+    qWarning() << path << "is truncated";
+    return false;
+  }
+
+  // Read through buffered reads if the file can't be mapped (e.g. address
+  // space on 32-bit builds)
+  m_mapped = m_file.map(0, size);
+
+  return true;
+}
+
+bool NimbusFile::read(int first, int count, PointCloud &cloud, int offset)
+{
+  if(first < 0 || count < 0 || first + count > m_pointCount
+     || offset + count > cloud.count())
+    return false;
+
+  bool result = readBlock(m_pointOffset + (qint64)first * 3 * sizeof(float),
+                          cloud.pointData() + (size_t)offset * 3,
+                          (qint64)count * 3 * sizeof(float));
+
+  if(result && hasColor() && cloud.hasColor())
+  {
+    result = readBlock(m_colorOffset + (qint64)first * 3,
+                       cloud.colorData() + (size_t)offset * 3,
+                       (qint64)count * 3);
+  }
+
+  for(int i = 0; result && i < m_attributeNames.count(); ++i)
+  {
+    float *attribute = cloud.attributeData(m_attributeNames.at(i));
+    if(!attribute)
+      continue;
+
+    result = readBlock(m_attributeOffsets.at(i)
+                       + (qint64)first * sizeof(float),
+                       attribute + offset, (qint64)count * sizeof(float));
+  }
+
+  return result;
+}
+
+bool NimbusFile::readBlock(qint64 offset, void *destination, qint64 size)
+{
+  if(m_mapped)
+  {
+    memcpy(destination, m_mapped + offset, size);
+    return true;
+  }
+
+  return m_file.seek(offset)
+      && m_file.read(static_cast<char *>(destination), size) == size;
+}
@@ -0,0 +1,105 @@
+#ifndef NIMBUSFILE_H
+#define NIMBUSFILE_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QVector3D>
+#include <QFile>
+
+class QSaveFile;
+#include "PointCloud.h"
+
+// Native point cloud file used to cache loaded clouds.  Points are stored
+// already shuffled, as the x,y,z floats and r,g,b bytes uploaded to the GPU,
+// so opening is a single copy out of a mapped file.  Blocks are little
+// endian; big endian hosts fall back to the source file.
+//
+// Layout: a header with bounds, point count, attribute descriptors and
+// cameras, followed by page aligned blocks of positions, colors and each
+// attribute.
+class NimbusFile
+{
+public:
+  NimbusFile();
+  ~NimbusFile();
+
+  // Default location of the cache for a point cloud file
+  static QString cachePath(const QString& source);
+
+  static bool canRead(const QString& path);
+
+  // Cameras are stored like PLYLoader provides them, three values per
+  // camera.  shuffled records whether the cloud is in random order already,
+  // so readers don't shuffle it again.
+  static bool write(const QString& path, const PointCloud& cloud,
+                    const QVector<double>& cameraPositions,
+                    const QVector<double>& cameraUps,
+                    const QVector<double>& cameraAims,
+                    const QVector<double>& cameraAspects,
+                    bool shuffled = true);
+
+  // Streaming write: create() the file, append() exactly count points in
+  // order and commit().  Nothing is left at path unless commit() succeeds.
+  // Cameras are set before creating.
+  void setCameras(const QVector<double>& positions,
+                  const QVector<double>& ups,
+                  const QVector<double>& aims,
+                  const QVector<double>& aspects);
+  bool create(const QString& path, int count, bool hasColor,
+              const QStringList& attributeNames = QStringList(),
+              bool shuffled = true);
+  bool append(const PointCloud& points);
+  bool commit();
+
+  // Reads the header and maps the blocks
+  bool open(const QString& path);
+
+  int pointCount() const { return m_pointCount; }
+  bool hasColor() const { return m_colorOffset > 0; }
+  bool isShuffled() const { return m_shuffled; }
+  QStringList attributeNames() const { return m_attributeNames; }
+
+  const QVector3D& boundingBoxMinimum() const { return m_min; }
+  const QVector3D& boundingBoxMaximum() const { return m_max; }
+
+  const QVector<double>& cameraPositions() const { return m_cameraPositions; }
+  const QVector<double>& cameraUpVectors() const { return m_cameraUps; }
+  const QVector<double>& cameraAimVectors() const { return m_cameraAims; }
+  const QVector<double>& cameraAspectRatios() const { return m_cameraAspects; }
+
+  // Copies points [first, first + count) of the file into the cloud starting
+  // at index offset.  The cloud must have color and the attributes of the
+  // file.
+  bool read(int first, int count, PointCloud& cloud, int offset = 0);
+
+  static const char FileMagic[8];
+  static const quint32 FileVersion = 1;
+
+private:
+  bool readBlock(qint64 offset, void *destination, qint64 size);
+  QByteArray header() const;
+
+  QFile m_file;
+  uchar *m_mapped;
+
+  QSaveFile *m_output;
+  int m_written;
+
+  int m_pointCount;
+  bool m_shuffled;
+  QVector3D m_min;
+  QVector3D m_max;
+
+  QStringList m_attributeNames;
+  QVector<qint64> m_attributeOffsets;
+  qint64 m_pointOffset;
+  qint64 m_colorOffset;
+
+  QVector<double> m_cameraPositions;
+  QVector<double> m_cameraUps;
+  QVector<double> m_cameraAims;
+  QVector<double> m_cameraAspects;
+};
+
+#endif // NIMBUSFILE_H
@@ -0,0 +1,694 @@
+#include "Octree.h"
+#include "Parallel.h"
+#include "Morton.h"
+#include <QDebug>
+#include <QCoreApplication>
+#include <QFile>
+#include <QDataStream>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <algorithm>
+#include <queue>
+#include <cstring>
+
+// Points per task when computing codes
+static const int CodeBlockSize = 1 << 20;
+// Cells per axis at the deepest level
+static const quint32 GridResolution = 1 << Morton::AxisBits;
+// Concurrent node reads out of core
+static const int ReaderThreads = 2;
+// Host memory for nodes read out of core
+static const qint64 DefaultHostMemoryBudget = Q_INT64_C(2) * 1024 * 1024 * 1024;
+
+const char Octree::FileMagic[8] = { 'N', 'I', 'M', 'B', 'U', 'S', 'O', 'T' };
+
+// Reads the points of one node from a hierarchy file and hands them back to
+// the octree's thread
+class NodeReader : public QRunnable
+{
+public:
+  NodeReader(Octree *octree, int index) : m_octree(octree), m_index(index),
+    m_path(octree->m_path), m_offset(octree->node(index).offset),
+    m_count(octree->node(index).count), m_hasColor(octree->hasColor()) { }
+
+  void run()
+  {
+    if(!m_octree->startRead(m_index))
+      return;
+
+    PointCloud points(m_count, m_hasColor);
+    qint64 pointBytes = (qint64)m_count * 3 * sizeof(float);
+    qint64 colorBytes = m_hasColor ? (qint64)m_count * 3 : 0;
+
+    QFile file(m_path);
+    bool result = file.open(QIODevice::ReadOnly) && file.seek(m_offset)
+        && file.read((char *)points.pointData(), pointBytes) == pointBytes
+        && (!m_hasColor
+            || file.read((char *)points.colorData(), colorBytes) == colorBytes);
+
+    if(!result)
+    {
+      qWarning() << "Failed reading octree node" << m_index << "from" << m_path;
+      points = PointCloud();
+    }
+
+    QMetaObject::invokeMethod(m_octree, "nodeRead", Qt::QueuedConnection,
+                              Q_ARG(int, m_index), Q_ARG(PointCloud, points));
+  }
+
+private:
+  Octree *m_octree;
+  int m_index;
+  QString m_path;
+  qint64 m_offset;
+  int m_count;
+  bool m_hasColor;
+};
+
+Octree::Node::Node() : size(0.0f), level(0), parent(-1), count(0), offset(0)
+{
+  for(int i = 0; i < 8; ++i)
+    children[i] = -1;
+}
+
+QVector3D Octree::Node::center() const
+{
+  return minimum + QVector3D(size, size, size) * 0.5f;
+}
+
+float Octree::Node::radius() const
+{
+  // Half the diagonal of the cube
+  return size * 0.8660254f;
+}
+
+bool Octree::Node::isLeaf() const
+{
+  for(int i = 0; i < 8; ++i)
+  {
+    if(children[i] >= 0)
+      return false;
+  }
+
+  return true;
+}
+
+Octree::Octree(const PointCloud &cloud, QObject *parent) :
+  QObject(parent),
+  m_cloud(cloud),
+  m_depth(0),
+  m_built(false),
+  m_hasColor(cloud.hasColor()),
+  m_pointCount(cloud.count()),
+  m_hasBounds(false),
+  m_boundsSize(0.0f),
+  m_maxDepth(MaxDepth),
+  m_collectOverflow(false),
+  m_cacheMemory(0),
+  m_hostMemoryBudget(DefaultHostMemoryBudget),
+  m_frame(0),
+  m_cancel(0)
+{
+  m_readers.setMaxThreadCount(ReaderThreads);
+}
+
+Octree::Octree(QObject *parent) :
+  QObject(parent),
+  m_depth(0),
+  m_built(false),
+  m_hasColor(false),
+  m_pointCount(0),
+  m_hasBounds(false),
+  m_boundsSize(0.0f),
+  m_maxDepth(MaxDepth),
+  m_collectOverflow(false),
+  m_cacheMemory(0),
+  m_hostMemoryBudget(DefaultHostMemoryBudget),
+  m_frame(0),
+  m_cancel(0)
+{
+  m_readers.setMaxThreadCount(ReaderThreads);
+}
+
+Octree::~Octree()
+{
+  // Readers refer back to this object
+  m_readers.clear();
+  m_readers.waitForDone();
+}
+
+bool Octree::isBuilt() const
+{
+  return m_built;
+}
+
+int Octree::nodeCount() const
+{
+  return m_nodes.count();
+}
+
+const Octree::Node &Octree::node(int index) const
+{
+  return m_nodes.at(index);
+}
+
+int Octree::depth() const
+{
+  return m_depth;
+}
+
+int Octree::pointCount() const
+{
+  return m_pointCount;
+}
+
+bool Octree::hasColor() const
+{
+  return m_hasColor;
+}
+
+const QVector3D &Octree::boundingBoxMinimum() const
+{
+  return m_min;
+}
+
+const QVector3D &Octree::boundingBoxMaximum() const
+{
+  return m_max;
+}
+
+void Octree::setBounds(const QVector3D &minimum, float size)
+{
+  m_hasBounds = true;
+  m_boundsMinimum = minimum;
+  m_boundsSize = size;
+}
+
+void Octree::setMaximumDepth(int depth, bool collectOverflow)
+{
+  m_maxDepth = qBound(0, depth, (int)MaxDepth);
+  m_collectOverflow = collectOverflow;
+}
+
+PointCloud Octree::overflow() const
+{
+  return m_overflow;
+}
+
+void Octree::run()
+{
+  build();
+
+  // Result is used by the GUI thread from here on
+  moveToThread(QCoreApplication::instance()->thread());
+  emit finished();
+}
+
+void Octree::cancel()
+{
+  m_cancel.storeRelease(1);
+}
+
+bool Octree::build()
+{
+  m_nodes.clear();
+  m_depth = 0;
+  m_built = false;
+  m_overflowIndices.clear();
+  m_overflow = PointCloud();
+
+  if(m_cloud.isEmpty())
+    return false;
+
+  m_min = m_cloud.boundingBoxMinimum();
+  m_max = m_cloud.boundingBoxMaximum();
+
+  // Root is the bounding cube of the cloud unless given
+  QVector3D min = m_min;
+  QVector3D extent = m_max - m_min;
+  float size = qMax(extent.x(), qMax(extent.y(), extent.z()));
+  if(size <= 0.0f)
+    size = 1.0f;
+
+  if(m_hasBounds)
+  {
+    min = m_boundsMinimum;
+    size = m_boundsSize;
+  }
+
+  Node root;
+  root.minimum = min;
+  root.size = size;
+  m_nodes.append(root);
+
+  computeCodes(min, size);
+  if(m_cancel.loadAcquire())
+    return false;
+  emit progress(10);
+
+  sortCodes();
+  if(m_cancel.loadAcquire())
+    return false;
+  emit progress(20);
+
+  // Split one level at a time; nodes of a level are independent
+  QVector<Range> pending;
+  Range all = { 0, 0, m_entries.size() };
+  pending.append(all);
+
+  size_t placed = 0;
+
+  while(!pending.isEmpty() && !m_cancel.loadAcquire())
+  {
+    QVector<QVector<Range> > children(pending.count());
+    QVector<Range> *childRanges = children.data();
+    Node *nodes = m_nodes.data();
+
+    Parallel::forEach(pending.count(), [&](int i)
+    {
+      const Range& range = pending.at(i);
+      splitNode(nodes[range.node], range, childRanges[i]);
+    });
+
+    // Create child nodes; node indices stay in breadth first order
+    QVector<Range> next;
+    for(int i = 0; i < pending.count(); ++i)
+    {
+      int parentIndex = pending.at(i).node;
+      placed += m_nodes.at(parentIndex).count;
+
+      foreach(Range range, children.at(i))
+      {
+        const Node& parentNode = m_nodes.at(parentIndex);
+        int octant = range.node;
+
+        Node child;
+        child.size = parentNode.size * 0.5f;
+        child.level = parentNode.level + 1;
+        child.parent = parentIndex;
+        child.minimum = parentNode.minimum
+            + QVector3D((octant >> 2) & 1, (octant >> 1) & 1, octant & 1)
+            * child.size;
+
+        range.node = m_nodes.count();
+        m_nodes[parentIndex].children[octant] = range.node;
+        m_nodes.append(child);
+        next.append(range);
+
+        m_depth = qMax(m_depth, child.level);
+      }
+    }
+
+    pending = next;
+    emit progress(20 + 80.0 * placed/m_entries.size());
+  }
+
+  // Done with working data
+  std::vector<Entry>().swap(m_entries);
+  if(m_collectOverflow)
+    m_overflow = gather(m_overflowIndices);
+  m_overflowIndices.clear();
+  m_cloud = PointCloud();
+
+  if(m_cancel.loadAcquire())
+  {
+    m_nodes.clear();
+    return false;
+  }
+
+  m_built = true;
+
+  return true;
+}
+
+int Octree::octant(quint64 code, int level)
+{
+  // Top three bits of the 63 bit code select the octant of the root
+  return (code >> (60 - 3 * level)) & 7;
+}
+
+void Octree::computeCodes(QVector3D min, float size)
+{
+  const int count = m_cloud.count();
+  m_entries.resize(count);
+
+  const PointCloud& cloud = m_cloud;
+  const float *points = cloud.pointData();
+  Entry *entries = m_entries.data();
+  const float scale = GridResolution/size;
+  int blocks = (count + CodeBlockSize - 1)/CodeBlockSize;
+
+  Parallel::forEach(blocks, [=](int block)
+  {
+    int first = block * CodeBlockSize;
+    int last = qMin(count, first + CodeBlockSize);
+    for(int i = first; i < last; ++i)
+    {
+      const float *p = points + (size_t)i * 3;
+      quint32 cell[3];
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        float value = (p[axis] - min[axis]) * scale;
+        cell[axis] = (quint32)qBound(0.0f, value, (float)(GridResolution - 1));
+      }
+
+      entries[i].code = Morton::code(cell[0], cell[1], cell[2]);
+      entries[i].index = i;
+    }
+  });
+}
+
+void Octree::sortCodes()
+{
+  // Scatter into buckets by the first two levels, then sort buckets in
+  // parallel
+  const int bucketBits = 6;
+  const int bucketCount = 1 << bucketBits;
+  QVector<size_t> offsets(bucketCount + 1, 0);
+
+  for(size_t i = 0; i < m_entries.size(); ++i)
+    offsets[(m_entries[i].code >> (63 - bucketBits)) + 1]++;
+  for(int b = 0; b < bucketCount; ++b)
+    offsets[b + 1] += offsets[b];
+
+  std::vector<Entry> sorted(m_entries.size());
+  QVector<size_t> next = offsets;
+  for(size_t i = 0; i < m_entries.size(); ++i)
+    sorted[next[m_entries[i].code >> (63 - bucketBits)]++] = m_entries[i];
+  m_entries.swap(sorted);
+  std::vector<Entry>().swap(sorted);
+
+  Entry *entries = m_entries.data();
+  Parallel::forEach(bucketCount, [&](int b)
+  {
+    std::sort(entries + offsets.at(b), entries + offsets.at(b + 1));
+  });
+}
+
+void Octree::splitNode(Node &node, const Range &range,
+                       QVector<Range> &children)
+{
+  Entry *entries = m_entries.data();
+  size_t count = range.last - range.first;
+
+  QVector<quint32> indices;
+
+  // Small or deepest nodes keep all their points
+  if(count <= (size_t)NodeCapacity
+     || (node.level >= m_maxDepth && !m_collectOverflow))
+  {
+    indices.reserve(count);
+    for(size_t i = range.first; i < range.last; ++i)
+      indices.append(entries[i].index);
+
+    fillNode(node, indices);
+    return;
+  }
+
+  // Keep the points that come first in the source cloud; as it's shuffled
+  // they are a random subsample
+  std::priority_queue<quint32> lowest;
+  for(size_t i = range.first; i < range.last; ++i)
+  {
+    if(lowest.size() < (size_t)NodeCapacity)
+    {
+      lowest.push(entries[i].index);
+    } else if(entries[i].index < lowest.top()) {
+      lowest.pop();
+      lowest.push(entries[i].index);
+    }
+  }
+  quint32 threshold = lowest.top();
+
+  // Take those out, compacting the rest in place; order by code is kept
+  indices.reserve(NodeCapacity);
+  size_t remaining = range.first;
+  for(size_t i = range.first; i < range.last; ++i)
+  {
+    if(entries[i].index <= threshold)
+      indices.append(entries[i].index);
+    else
+      entries[remaining++] = entries[i];
+  }
+
+  fillNode(node, indices);
+
+  // Set aside what doesn't fit at the maximum depth
+  if(node.level >= m_maxDepth)
+  {
+    QMutexLocker lock(&m_overflowMutex);
+    for(size_t i = range.first; i < remaining; ++i)
+      m_overflowIndices.append(entries[i].index);
+    return;
+  }
+
+  // Remaining points are sorted, so each octant is a contiguous run.  Child
+  // ranges carry their octant in place of a node index until created.
+  size_t first = range.first;
+  for(int o = 0; o < 8 && first < remaining; ++o)
+  {
+    size_t last = first;
+    while(last < remaining && octant(entries[last].code, node.level) == o)
+      ++last;
+
+    if(last > first)
+    {
+      Range child = { o, first, last };
+      children.append(child);
+    }
+
+    first = last;
+  }
+}
+
+void Octree::fillNode(Node &node, QVector<quint32> &indices)
+{
+  node.points = gather(indices);
+  node.count = node.points.count();
+}
+
+PointCloud Octree::gather(QVector<quint32> &indices) const
+{
+  // Keep shuffled order
+  std::sort(indices.begin(), indices.end());
+
+  const bool hasColor = m_cloud.hasColor();
+  PointCloud points(indices.count(), hasColor);
+
+  const float *pointSource = m_cloud.pointData();
+  const unsigned char *colorSource = m_cloud.colorData();
+  float *pointOut = points.pointData();
+  unsigned char *colorOut = points.colorData();
+
+  for(int i = 0; i < indices.count(); ++i)
+  {
+    size_t from = (size_t)indices.at(i) * 3;
+    std::copy(pointSource + from, pointSource + from + 3, pointOut + i * 3);
+    if(hasColor)
+      std::copy(colorSource + from, colorSource + from + 3, colorOut + i * 3);
+  }
+
+  return points;
+}
+
+bool Octree::canRead(const QString &path)
+{
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly))
+    return false;
+
+  return file.read(sizeof(FileMagic)) == QByteArray(FileMagic, sizeof(FileMagic));
+}
+
+bool Octree::open(const QString &path)
+{
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly))
+    return false;
+
+  QDataStream stream(&file);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+  char magic[sizeof(FileMagic)];
+  quint32 version, nodeCount, depth, flags;
+  qint64 pointCount, tableOffset;
+  float bounds[6];
+
+  if(stream.readRawData(magic, sizeof(magic)) != sizeof(magic)
+     || memcmp(magic, FileMagic, sizeof(magic)) != 0)
+    return false;
+
+  stream >> version >> nodeCount >> depth >> flags >> pointCount;
+  for(int i = 0; i < 6; ++i)
+    stream >> bounds[i];
+  stream >> tableOffset;
+
+  if(stream.status() != QDataStream::Ok || version != FileVersion
+     || nodeCount == 0 || !file.seek(tableOffset))
+    return false;
+
+  m_nodes.resize(nodeCount);
+  for(quint32 i = 0; i < nodeCount; ++i)
+  {
+    Node& node = m_nodes[i];
+    float x, y, z;
+    stream >> x >> y >> z >> node.size;
+    node.minimum = QVector3D(x, y, z);
+    stream >> node.level >> node.parent;
+    for(int c = 0; c < 8; ++c)
+      stream >> node.children[c];
+    stream >> node.count >> node.offset;
+  }
+
+  if(stream.status() != QDataStream::Ok)
+  {
+    m_nodes.clear();
+    return false;
+  }
+
+  m_path = path;
+  m_depth = depth;
+  m_hasColor = flags & 1;
+  m_pointCount = pointCount;
+  m_min = QVector3D(bounds[0], bounds[1], bounds[2]);
+  m_max = QVector3D(bounds[3], bounds[4], bounds[5]);
+  m_built = true;
+
+  return true;
+}
+
+bool Octree::isOutOfCore() const
+{
+  return !m_path.isEmpty();
+}
+
+void Octree::writeHeader(QIODevice *device, qint64 tableOffset) const
+{
+  QDataStream stream(device);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+  stream.writeRawData(FileMagic, sizeof(FileMagic));
+  stream << FileVersion << (quint32)m_nodes.count() << (quint32)m_depth
+         << (quint32)(m_hasColor ? 1 : 0) << (qint64)m_pointCount;
+  stream << m_min.x() << m_min.y() << m_min.z()
+         << m_max.x() << m_max.y() << m_max.z();
+  stream << tableOffset;
+}
+
+void Octree::writeTable(QIODevice *device) const
+{
+  QDataStream stream(device);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+  foreach(const Node& node, m_nodes)
+  {
+    stream << node.minimum.x() << node.minimum.y() << node.minimum.z()
+           << node.size << node.level << node.parent;
+    for(int c = 0; c < 8; ++c)
+      stream << node.children[c];
+    stream << node.count << node.offset;
+  }
+}
+
+PointCloud Octree::nodePoints(int index, int priority)
+{
+  if(!isOutOfCore())
+    return m_nodes.at(index).points;
+
+  QHash<int, CachedNode>::iterator cached = m_cache.find(index);
+  if(cached != m_cache.end())
+  {
+    cached->lastUsed = m_frame;
+    return cached->points;
+  }
+
+  // Queue a read unless one is already pending
+  QMutexLocker lock(&m_readMutex);
+  if(!m_queued.contains(index) && !m_reading.contains(index))
+  {
+    m_queued.insert(index);
+    m_readers.start(new NodeReader(this, index), priority);
+  }
+
+  return PointCloud();
+}
+
+void Octree::beginFrame()
+{
+  ++m_frame;
+
+  // Nodes still wanted are asked for again during the frame
+  QMutexLocker lock(&m_readMutex);
+  m_readers.clear();
+  m_queued.clear();
+}
+
+void Octree::setHostMemoryBudget(qint64 bytes)
+{
+  m_hostMemoryBudget = bytes > 0 ? bytes : DefaultHostMemoryBudget;
+  evictNodes();
+}
+
+qint64 Octree::hostMemoryUsage() const
+{
+  return m_cacheMemory;
+}
+
+bool Octree::startRead(int index)
+{
+  QMutexLocker lock(&m_readMutex);
+  if(!m_queued.remove(index))
+    return false;
+
+  m_reading.insert(index);
+  return true;
+}
+
+void Octree::nodeRead(int index, PointCloud points)
+{
+  {
+    QMutexLocker lock(&m_readMutex);
+    m_reading.remove(index);
+  }
+
+  if(points.isEmpty())
+    return;
+
+  CachedNode node;
+  node.points = points;
+  node.lastUsed = m_frame;
+  m_cache.insert(index, node);
+  m_cacheMemory += points.memoryUsage();
+
+  evictNodes();
+
+  emit nodeLoaded(index);
+}
+
+void Octree::evictNodes()
+{
+  // Drop least recently used nodes, sparing those of the current frame
+  while(m_cacheMemory > m_hostMemoryBudget)
+  {
+    int oldest = -1;
+    int oldestFrame = m_frame;
+
+    QHash<int, CachedNode>::const_iterator i;
+    for(i = m_cache.constBegin(); i != m_cache.constEnd(); ++i)
+    {
+      if(i.value().lastUsed < oldestFrame)
+      {
+        oldest = i.key();
+        oldestFrame = i.value().lastUsed;
+      }
+    }
+
+    if(oldest < 0)
+      return;
+
+    m_cacheMemory -= m_cache.take(oldest).points.memoryUsage();
+  }
+}
@@ -0,0 +1,196 @@
+#ifndef OCTREE_H
+#define OCTREE_H
+
+#include <QObject>
+#include <QVector>
+#include <QVector3D>
+#include <QAtomicInt>
+#include <QHash>
+#include <QSet>
+#include <QMutex>
+#include <QThreadPool>
+#include <QIODevice>
+#include <vector>
+#include "PointCloud.h"
+
+// Level of detail hierarchy over a point cloud.  Nodes are nested: every node
+// holds a random subsample of the points within its cube and its children
+// hold the remainder, so drawing any set of nodes that is closed under
+// parents gives an evenly thinned cloud.  Build is run in a worker thread
+// like PLYLoader; results are read only once finished() is emitted.
+//
+// An octree can also be opened from a hierarchy file written by
+// OctreeWriter, in which case node points stay on disk and are read in the
+// background as they are asked for.
+class Octree : public QObject
+{
+  Q_OBJECT
+public:
+  // Points kept in a node before the rest are pushed down to its children
+  static const int NodeCapacity = 32768;
+  // Levels below the root; limited by the 21 bits per axis of Morton codes
+  static const int MaxDepth = 20;
+
+  struct Node
+  {
+    Node();
+
+    // Cube covered by this node
+    QVector3D minimum;
+    float size;
+    int level;
+    int parent;
+    // Index of child for each octant, or -1
+    int children[8];
+
+    // Number of points in this node and, out of core, their file offset
+    int count;
+    qint64 offset;
+
+    // Points of this node in the same shuffled order as the source cloud;
+    // empty out of core
+    PointCloud points;
+
+    QVector3D center() const;
+    // Radius of bounding sphere
+    float radius() const;
+    bool isLeaf() const;
+  };
+
+  explicit Octree(const PointCloud& cloud, QObject *parent = 0);
+  explicit Octree(QObject *parent = 0);
+  ~Octree();
+
+  bool isBuilt() const;
+
+  // Node 0 is the root
+  int nodeCount() const;
+  const Node& node(int index) const;
+
+  int depth() const;
+  int pointCount() const;
+  bool hasColor() const;
+
+  const QVector3D& boundingBoxMinimum() const;
+  const QVector3D& boundingBoxMaximum() const;
+
+  // Root cube; by default the bounding cube of the cloud
+  void setBounds(const QVector3D& minimum, float size);
+  // Nodes at the maximum depth keep at most NodeCapacity points when
+  // collecting overflow; the rest are left for overflow()
+  void setMaximumDepth(int depth, bool collectOverflow = false);
+  PointCloud overflow() const;
+
+  // Build on the calling thread; returns false if canceled
+  bool build();
+
+  // Hierarchy files written by OctreeWriter
+  static bool canRead(const QString& path);
+  bool open(const QString& path);
+  bool isOutOfCore() const;
+
+  // Points of a node.  Out of core, an empty cloud is returned while the
+  // node is read in the background; nodeLoaded() follows.  Reads with
+  // higher priority go first.
+  PointCloud nodePoints(int index, int priority = 0);
+  // Marks the start of a frame: reads requested before and not yet started
+  // are dropped, and nodes asked for from here on count as recently used
+  void beginFrame();
+
+  // Bytes of nodes read from disk kept in memory; 0 restores the default
+  void setHostMemoryBudget(qint64 bytes);
+  qint64 hostMemoryUsage() const;
+
+  static const char FileMagic[8];
+  static const quint32 FileVersion = 1;
+
+signals:
+  void progress(int percent);
+  void finished();
+  void nodeLoaded(int index);
+
+public slots:
+  // Worker thread entry point
+  void run();
+  void cancel();
+
+private slots:
+  void nodeRead(int index, PointCloud points);
+
+private:
+  struct Entry
+  {
+    quint64 code;
+    quint32 index;
+
+    bool operator<(const Entry& other) const { return code < other.code; }
+  };
+
+  struct Range
+  {
+    int node;
+    size_t first;
+    size_t last;
+  };
+
+  struct CachedNode
+  {
+    PointCloud points;
+    int lastUsed;
+  };
+
+  friend class NodeReader;
+  friend class OctreeWriter;
+
+  static int octant(quint64 code, int level);
+
+  void computeCodes(QVector3D min, float size);
+  void sortCodes();
+  void splitNode(Node& node, const Range& range, QVector<Range>& children);
+  void fillNode(Node& node, QVector<quint32>& indices);
+  PointCloud gather(QVector<quint32>& indices) const;
+
+  void evictNodes();
+  // Called by readers when starting; false if the read was dropped
+  bool startRead(int index);
+
+  // Hierarchy file layout; the header has a fixed size and is rewritten
+  // once the table offset is known
+  void writeHeader(QIODevice *device, qint64 tableOffset) const;
+  void writeTable(QIODevice *device) const;
+
+  PointCloud m_cloud;
+  QVector<Node> m_nodes;
+  std::vector<Entry> m_entries;
+  int m_depth;
+  bool m_built;
+  bool m_hasColor;
+  int m_pointCount;
+  QVector3D m_min;
+  QVector3D m_max;
+
+  bool m_hasBounds;
+  QVector3D m_boundsMinimum;
+  float m_boundsSize;
+  int m_maxDepth;
+  bool m_collectOverflow;
+  QMutex m_overflowMutex;
+  QVector<quint32> m_overflowIndices;
+  PointCloud m_overflow;
+
+  // Out of core state; only touched by the thread owning the octree, except
+  // for the sets of pending reads which readers update under the mutex
+  QString m_path;
+  QHash<int, CachedNode> m_cache;
+  qint64 m_cacheMemory;
+  qint64 m_hostMemoryBudget;
+  int m_frame;
+  QMutex m_readMutex;
+  QSet<int> m_queued;
+  QSet<int> m_reading;
+  QThreadPool m_readers;
+
+  QAtomicInt m_cancel;
+};
+
+#endif // OCTREE_H
@@ -0,0 +1,467 @@
+#include "OctreeWriter.h"
+#include "PLYLoader.h"
+#include "Random.h"
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTemporaryDir>
+#include <cstring>
+
+// Points a chunk is aimed at; chunks are built in memory one at a time
+static const qint64 ChunkTargetPoints = 8 << 20;
+// Deepest chunk level; 8^4 cells at most
+static const int MaxChunkLevel = 4;
+// Bytes buffered per chunk before appending to its spill file
+static const int SpillBufferSize = 1 << 20;
+
+// Uniform value in [0, 1) from a point index
+static double sampleValue(quint64 index)
+{
+  return (Random::mix(index) >> 11) * (1.0/(Q_UINT64_C(1) << 53));
+}
+
+OctreeWriter::OctreeWriter(const QString &source, const QString &destination,
+                           QObject *parent) :
+  QObject(parent),
+  m_source(source),
+  m_destination(destination),
+  m_pointCount(0),
+  m_hasColor(false),
+  m_size(1.0f),
+  m_chunkLevel(0),
+  m_sampleRate(0.0),
+  m_cancel(0)
+{
+}
+
+QString OctreeWriter::hierarchyPath(const QString &source)
+{
+  return source + ".octree";
+}
+
+void OctreeWriter::run()
+{
+  emit finished(write());
+}
+
+bool OctreeWriter::write()
+{
+  if(!readBounds() || m_cancel.loadAcquire())
+    return false;
+
+  // Spill files go next to the output; system temp may be too small
+  QTemporaryDir directory(QFileInfo(m_destination).absolutePath()
+                          + "/.nimbus-octree-XXXXXX");
+  if(!directory.isValid())
+  {
+    qWarning() << "Unable to create temporary directory for" << m_destination;
+    return false;
+  }
+
+  if(!distribute(directory.path()) || m_cancel.loadAcquire())
+    return false;
+
+  if(!writeHierarchy(directory.path()))
+  {
+    QFile::remove(m_destination);
+    return false;
+  }
+
+  return true;
+}
+
+bool OctreeWriter::readBounds()
+{
+  PLYLoader loader;
+  if(!loader.open(m_source))
+    return false;
+
+  loader.setStreaming(true);
+  m_pointCount = 0;
+  m_hasColor = loader.hasColor();
+
+  connect(&loader, &PLYLoader::chunkLoaded, [&](int, PointCloud chunk)
+  {
+    const float *points = chunk.pointData();
+    for(int i = 0; i < chunk.count(); ++i)
+    {
+      QVector3D p(points[i * 3], points[i * 3 + 1], points[i * 3 + 2]);
+      if(m_pointCount == 0 && i == 0)
+        m_min = m_max = p;
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+        m_min[axis] = qMin(m_min[axis], p[axis]);
+        m_max[axis] = qMax(m_max[axis], p[axis]);
+      }
+    }
+
+    m_pointCount += chunk.count();
+    m_hasColor = chunk.hasColor();
+
+    if(m_cancel.loadAcquire())
+      loader.cancel();
+  });
+  connect(&loader, &PLYLoader::progress, [&](int percent)
+  {
+    emit progress(percent * 0.3);
+  });
+
+  loader.load();
+
+  if(m_pointCount == 0)
+    return false;
+
+  QVector3D extent = m_max - m_min;
+  m_size = qMax(extent.x(), qMax(extent.y(), extent.z()));
+  if(m_size <= 0.0f)
+    m_size = 1.0f;
+
+  // Assume points lie on surfaces, so occupied chunks grow about four fold
+  // per level
+  m_chunkLevel = 0;
+  while(m_chunkLevel < MaxChunkLevel
+        && m_pointCount > ChunkTargetPoints << (2 * m_chunkLevel))
+    ++m_chunkLevel;
+
+  // Sample enough to fill the levels above the chunks
+  qint64 sampleTarget = (qint64)Octree::NodeCapacity
+      * (((qint64)1 << (2 * m_chunkLevel)) - 1)/3;
+  m_sampleRate = qMin(1.0, (double)sampleTarget/m_pointCount);
+
+  return true;
+}
+
+bool OctreeWriter::distribute(const QString &directory)
+{
+  PLYLoader loader;
+  if(!loader.open(m_source))
+    return false;
+
+  loader.setStreaming(true);
+  m_spillBuffers.clear();
+  m_samplePoints.clear();
+  m_sampleColors.clear();
+
+  bool result = true;
+
+  connect(&loader, &PLYLoader::chunkLoaded, [&](int first, PointCloud chunk)
+  {
+    const float *points = chunk.pointData();
+    const unsigned char *colors = m_hasColor ? chunk.colorData() : NULL;
+
+    for(int i = 0; i < chunk.count() && result; ++i)
+    {
+      const float *point = points + (size_t)i * 3;
+      const unsigned char *color = colors ? colors + (size_t)i * 3 : NULL;
+
+      if(sampleValue(first + i) < m_sampleRate)
+      {
+        m_samplePoints.insert(m_samplePoints.end(), point, point + 3);
+        if(color)
+          m_sampleColors.insert(m_sampleColors.end(), color, color + 3);
+      } else {
+        int cell = cellIndex(point);
+        spill(cell, point, color);
+        if(m_spillBuffers.value(cell).size() >= SpillBufferSize)
+          result = flush(directory, cell);
+      }
+    }
+
+    if(!result || m_cancel.loadAcquire())
+      loader.cancel();
+  });
+  connect(&loader, &PLYLoader::progress, [&](int percent)
+  {
+    emit progress(30 + percent * 0.3);
+  });
+
+  loader.load();
+
+  foreach(int cell, m_spillBuffers.keys())
+    result = result && flush(directory, cell);
+
+  return result && !m_cancel.loadAcquire();
+}
+
+bool OctreeWriter::writeHierarchy(const QString &directory)
+{
+  QFile file(m_destination);
+  if(!file.open(QIODevice::WriteOnly))
+  {
+    qWarning() << "Unable to write" << m_destination;
+    return false;
+  }
+
+  Octree hierarchy;
+  hierarchy.m_hasColor = m_hasColor;
+  hierarchy.m_pointCount = m_pointCount;
+  hierarchy.m_min = m_min;
+  hierarchy.m_max = m_max;
+
+  // Placeholder until the table offset is known
+  hierarchy.writeHeader(&file, 0);
+
+  // Levels above the chunks from the sample; what doesn't fit there goes to
+  // the chunks
+  int sampleCount = m_samplePoints.size()/3;
+  if(m_chunkLevel > 0 && sampleCount > 0)
+  {
+    PointCloud sample(sampleCount, m_hasColor);
+    std::copy(m_samplePoints.begin(), m_samplePoints.end(), sample.pointData());
+    if(m_hasColor)
+      std::copy(m_sampleColors.begin(), m_sampleColors.end(), sample.colorData());
+    std::vector<float>().swap(m_samplePoints);
+    std::vector<unsigned char>().swap(m_sampleColors);
+
+    sample.shuffle();
+
+    Octree upper(sample);
+    upper.setBounds(m_min, m_size);
+    upper.setMaximumDepth(m_chunkLevel - 1, true);
+    sample = PointCloud();
+    if(!upper.build())
+      return false;
+
+    for(int i = 0; i < upper.nodeCount(); ++i)
+    {
+      Octree::Node node = upper.node(i);
+      if(!writeNode(&file, node))
+        return false;
+      hierarchy.m_nodes.append(node);
+    }
+    hierarchy.m_depth = upper.depth();
+
+    const PointCloud overflow = upper.overflow();
+    for(int i = 0; i < overflow.count(); ++i)
+    {
+      const float *point = overflow.pointData() + (size_t)i * 3;
+      const unsigned char *color = m_hasColor
+          ? overflow.colorData() + (size_t)i * 3 : NULL;
+      spill(cellIndex(point), point, color);
+    }
+
+    foreach(int cell, m_spillBuffers.keys())
+    {
+      if(!flush(directory, cell))
+        return false;
+    }
+  }
+
+  // Build each chunk in memory and hang it below its path from the root
+  QStringList cells = QDir(directory).entryList(QStringList("*.bin"),
+                                                 QDir::Files, QDir::Name);
+  const int resolution = 1 << m_chunkLevel;
+  const float cellSize = m_size/resolution;
+
+  for(int c = 0; c < cells.count(); ++c)
+  {
+    if(m_cancel.loadAcquire())
+      return false;
+
+    int cell = QFileInfo(cells.at(c)).baseName().toInt();
+    PointCloud points = readCell(directory, cell);
+    if(points.isEmpty())
+      continue;
+
+    points.shuffle();
+
+    int x = (cell >> (2 * m_chunkLevel)) & (resolution - 1);
+    int y = (cell >> m_chunkLevel) & (resolution - 1);
+    int z = cell & (resolution - 1);
+
+    Octree chunk(points);
+    chunk.setBounds(m_min + QVector3D(x, y, z) * cellSize, cellSize);
+    chunk.setMaximumDepth(Octree::MaxDepth - m_chunkLevel);
+    points = PointCloud();
+    if(!chunk.build())
+      return false;
+
+    int parent = m_chunkLevel > 0 ? pathNode(hierarchy, cell) : -1;
+    int base = hierarchy.m_nodes.count();
+
+    if(parent >= 0)
+    {
+      int octant = ((x & 1) << 2) | ((y & 1) << 1) | (z & 1);
+      hierarchy.m_nodes[parent].children[octant] = base;
+    }
+
+    for(int i = 0; i < chunk.nodeCount(); ++i)
+    {
+      Octree::Node node = chunk.node(i);
+      node.level += m_chunkLevel;
+      node.parent = (i == 0) ? parent : node.parent + base;
+      for(int k = 0; k < 8; ++k)
+      {
+        if(node.children[k] >= 0)
+          node.children[k] += base;
+      }
+
+      if(!writeNode(&file, node))
+        return false;
+      hierarchy.m_nodes.append(node);
+      hierarchy.m_depth = qMax(hierarchy.m_depth, node.level);
+    }
+
+    QFile::remove(directory + "/" + cells.at(c));
+    emit progress(60 + 40.0 * (c + 1)/cells.count());
+  }
+
+  if(hierarchy.m_nodes.isEmpty())
+    return false;
+
+  // Table at the end, then the final header
+  qint64 tableOffset = file.pos();
+  hierarchy.writeTable(&file);
+  if(!file.seek(0))
+    return false;
+  hierarchy.writeHeader(&file, tableOffset);
+
+  return file.error() == QFile::NoError;
+}
+
+int OctreeWriter::cellIndex(const float *point) const
+{
+  const int resolution = 1 << m_chunkLevel;
+  int cell[3];
+  for(int axis = 0; axis < 3; ++axis)
+  {
+    int c = (point[axis] - m_min[axis])/m_size * resolution;
+    cell[axis] = qBound(0, c, resolution - 1);
+  }
+
+  return (cell[0] << (2 * m_chunkLevel)) | (cell[1] << m_chunkLevel) | cell[2];
+}
+
+void OctreeWriter::spill(int cell, const float *point,
+                         const unsigned char *color)
+{
+  // Records are packed x,y,z floats followed by r,g,b bytes if present
+  QByteArray& buffer = m_spillBuffers[cell];
+  buffer.append(reinterpret_cast<const char *>(point), 3 * sizeof(float));
+  if(color)
+    buffer.append(reinterpret_cast<const char *>(color), 3);
+}
+
+bool OctreeWriter::flush(const QString &directory, int cell)
+{
+  QByteArray& buffer = m_spillBuffers[cell];
+  if(buffer.isEmpty())
+    return true;
+
+  // Opened per flush so the number of chunks isn't bound by open files
+  QFile file(directory + "/" + QString::number(cell) + ".bin");
+  if(!file.open(QIODevice::WriteOnly | QIODevice::Append)
+     || file.write(buffer) != buffer.size())
+  {
+    qWarning() << "Unable to write" << file.fileName();
+    return false;
+  }
+
+  buffer.clear();
+  return true;
+}
+
+PointCloud OctreeWriter::readCell(const QString &directory, int cell)
+{
+  QFile file(directory + "/" + QString::number(cell) + ".bin");
+  if(!file.open(QIODevice::ReadOnly))
+    return PointCloud();
+
+  const int recordSize = 3 * sizeof(float) + (m_hasColor ? 3 : 0);
+  int count = file.size()/recordSize;
+
+  PointCloud points(count, m_hasColor);
+  float *pointOut = points.pointData();
+  unsigned char *colorOut = points.colorData();
+
+  // Read in blocks of records and split them into the cloud's arrays
+  const int blockCount = qMax(1, SpillBufferSize/recordSize);
+  for(int first = 0; first < count; first += blockCount)
+  {
+    int n = qMin(blockCount, count - first);
+    QByteArray block = file.read((qint64)n * recordSize);
+    if(block.size() != n * recordSize)
+      return PointCloud();
+
+    const char *record = block.constData();
+    for(int i = 0; i < n; ++i, record += recordSize)
+    {
+      size_t index = (size_t)(first + i) * 3;
+      memcpy(pointOut + index, record, 3 * sizeof(float));
+      if(m_hasColor)
+        memcpy(colorOut + index, record + 3 * sizeof(float), 3);
+    }
+  }
+
+  return points;
+}
+
+int OctreeWriter::pathNode(Octree &hierarchy, int cell)
+{
+  QVector<Octree::Node>& nodes = hierarchy.m_nodes;
+
+  // Root may be missing if nothing was sampled
+  if(nodes.isEmpty())
+  {
+    Octree::Node root;
+    root.minimum = m_min;
+    root.size = m_size;
+    nodes.append(root);
+  }
+
+  const int mask = (1 << m_chunkLevel) - 1;
+  int x = (cell >> (2 * m_chunkLevel)) & mask;
+  int y = (cell >> m_chunkLevel) & mask;
+  int z = cell & mask;
+
+  // Walk down to the level above the chunk, adding empty nodes as needed
+  int index = 0;
+  for(int level = 0; level < m_chunkLevel - 1; ++level)
+  {
+    int bit = m_chunkLevel - 1 - level;
+    int ox = (x >> bit) & 1;
+    int oy = (y >> bit) & 1;
+    int oz = (z >> bit) & 1;
+    int octant = (ox << 2) | (oy << 1) | oz;
+
+    int child = nodes.at(index).children[octant];
+    if(child < 0)
+    {
+      Octree::Node node;
+      node.size = nodes.at(index).size * 0.5f;
+      node.level = level + 1;
+      node.parent = index;
+      node.minimum = nodes.at(index).minimum + QVector3D(ox, oy, oz) * node.size;
+
+      child = nodes.count();
+      nodes[index].children[octant] = child;
+      nodes.append(node);
+    }
+
+    index = child;
+  }
+
+  return index;
+}
+
+bool OctreeWriter::writeNode(QIODevice *device, Octree::Node &node)
+{
+  const PointCloud points = node.points;
+  node.offset = device->pos();
+  node.count = points.count();
+  node.points = PointCloud();
+
+  qint64 pointBytes = (qint64)points.count() * 3 * sizeof(float);
+  qint64 colorBytes = (qint64)points.count() * 3;
+
+  if(device->write((const char *)points.pointData(), pointBytes) != pointBytes)
+    return false;
+
+  if(m_hasColor && points.count() > 0
+     && device->write((const char *)points.colorData(), colorBytes) != colorBytes)
+    return false;
+
+  return true;
+}
@@ -0,0 +1,77 @@
+#ifndef OCTREEWRITER_H
+#define OCTREEWRITER_H
+
+#include <QObject>
+#include <QString>
+#include <QVector3D>
+#include <QHash>
+#include <QByteArray>
+#include <QAtomicInt>
+#include <vector>
+#include "Octree.h"
+
+// Converts a PLY file into an out of core hierarchy file that Octree can
+// open without reading all points.  Points are streamed from the source
+// twice: once for the bounds and once to spill them into temporary files per
+// chunk of space.  Chunks are then built one at a time in memory, so memory
+// use is bound by the largest chunk rather than the whole cloud.  Levels
+// above the chunks hold a random sample taken while spilling.
+class OctreeWriter : public QObject
+{
+  Q_OBJECT
+public:
+  OctreeWriter(const QString& source, const QString& destination,
+               QObject *parent = 0);
+
+  // Default location of the hierarchy for a point cloud file
+  static QString hierarchyPath(const QString& source);
+
+  const QString& destination() const { return m_destination; }
+
+  // Blocking conversion in the calling thread
+  bool write();
+
+signals:
+  void progress(int percent);
+  void finished(bool success);
+
+public slots:
+  // Converts; meant to be invoked in a worker thread
+  void run();
+  // Safe to call from any thread
+  void cancel() { m_cancel.storeRelease(1); }
+
+private:
+  bool readBounds();
+  bool distribute(const QString& directory);
+  bool writeHierarchy(const QString& directory);
+
+  int cellIndex(const float *point) const;
+  void spill(int cell, const float *point, const unsigned char *color);
+  bool flush(const QString& directory, int cell);
+  PointCloud readCell(const QString& directory, int cell);
+  int pathNode(Octree& hierarchy, int cell);
+  bool writeNode(QIODevice *device, Octree::Node& node);
+
+  QString m_source;
+  QString m_destination;
+
+  // Bounds, gathered in the first pass
+  int m_pointCount;
+  bool m_hasColor;
+  QVector3D m_min;
+  QVector3D m_max;
+  float m_size;
+
+  // Level of spilled chunks and share of points sampled for levels above
+  int m_chunkLevel;
+  double m_sampleRate;
+
+  QHash<int, QByteArray> m_spillBuffers;
+  std::vector<float> m_samplePoints;
+  std::vector<unsigned char> m_sampleColors;
+
+  QAtomicInt m_cancel;
+};
+
+#endif // OCTREEWRITER_H
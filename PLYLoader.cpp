@@ -1,11 +1,225 @@
 #include "PLYLoader.h"
 #include <QVector3D>
 #include <QColor>
+#include <QFile>
+#include <QScopedArrayPointer>
+#include <QtEndian>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include "Parallel.h"
+#include "NimbusFile.h"
 
 #include <QDebug>
 
+// Minimum number of points passed on per chunkLoaded() signal
+static const int ChunkPoints = 1 << 20;
+
+// Number of bytes decoded per block by the binary reader
+static const int BinaryBlockSize = 4 << 20;
+
+// Size in bytes of a scalar PLY type
+static int typeSize(e_ply_type type)
+{
+  switch(type)
+  {
+  case PLY_INT8: case PLY_UINT8: case PLY_CHAR: case PLY_UCHAR:
+    return 1;
+  case PLY_INT16: case PLY_UINT16: case PLY_SHORT: case PLY_USHORT:
+    return 2;
+  case PLY_INT32: case PLY_UIN32: case PLY_INT: case PLY_UINT:
+  case PLY_FLOAT32: case PLY_FLOAT:
+    return 4;
+  case PLY_FLOAT64: case PLY_DOUBLE:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+// Read unaligned scalar, reversing bytes when file and host endianness differ
+template <typename T>
+static inline T readScalar(const uchar *src, bool swap)
+{
+  T value;
+  if(swap)
+  {
+    uchar bytes[sizeof(T)];
+    for(size_t i = 0; i < sizeof(T); ++i)
+      bytes[i] = src[sizeof(T) - 1 - i];
+    memcpy(&value, bytes, sizeof(T));
+  } else {
+    memcpy(&value, src, sizeof(T));
+  }
+  return value;
+}
+
+template <typename Out, typename T>
+static inline void storeValue(Out *dst, T value)
+{
+  *dst = value;
+}
+
+template <typename T>
+static inline void storeValue(uchar *dst, T value)
+{
+  *dst = qBound(0.0, (double)value, 255.0);
+}
+
+static inline void storeValue(uchar *dst, quint8 value)
+{
+  *dst = value;
+}
+
+// Decode one property of count records into every dstStride'th output value
+template <typename T, typename Out>
+static void decodeColumn(const uchar *src, int stride, int count, bool swap,
+                         Out *dst, int dstStride)
+{
+  for(int i = 0; i < count; ++i, src += stride, dst += dstStride)
+    storeValue(dst, readScalar<T>(src, swap));
+}
+
+template <typename Out>
+static void decodeColumn(e_ply_type type, const uchar *src, int stride,
+                         int count, bool swap, Out *dst, int dstStride)
+{
+  switch(type)
+  {
+  case PLY_INT8: case PLY_CHAR:
+    decodeColumn<qint8>(src, stride, count, swap, dst, dstStride); break;
+  case PLY_UINT8: case PLY_UCHAR:
+    decodeColumn<quint8>(src, stride, count, swap, dst, dstStride); break;
+  case PLY_INT16: case PLY_SHORT:
+    decodeColumn<qint16>(src, stride, count, swap, dst, dstStride); break;
+  case PLY_UINT16: case PLY_USHORT:
+    decodeColumn<quint16>(src, stride, count, swap, dst, dstStride); break;
+  case PLY_INT32: case PLY_INT:
+    decodeColumn<qint32>(src, stride, count, swap, dst, dstStride); break;
+  case PLY_UIN32: case PLY_UINT:
+    decodeColumn<quint32>(src, stride, count, swap, dst, dstStride); break;
+  case PLY_FLOAT32: case PLY_FLOAT:
+    decodeColumn<float>(src, stride, count, swap, dst, dstStride); break;
+  case PLY_FLOAT64: case PLY_DOUBLE:
+    decodeColumn<double>(src, stride, count, swap, dst, dstStride); break;
+  default:
+    break;
+  }
+}
+
+static double readValue(e_ply_type type, const uchar *src, bool swap)
+{
+  double value = 0.0;
+  decodeColumn(type, src, 0, 1, swap, &value, 1);
+  return value;
+}
+
+// Approximate number of bytes parsed per task by the ASCII reader
+static const int AsciiChunkSize = 4 << 20;
+
+static inline bool isBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Parse a decimal number without strtod's locale and error handling.  Handles
+// up to 19 significant digits exactly, which is plenty for float output; other
+// spellings (nan, inf, hex) are handed to strtod.  Returns position after the
+// number, or NULL if there is none.
+static const char *parseNumber(const char *p, const char *end, double *value)
+{
+  static const double powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+  while(p < end && isBlank(*p)) ++p;
+  if(p == end) return NULL;
+
+  const char *start = p;
+
+  bool negative = false;
+  if(*p == '-' || *p == '+')
+    negative = *p++ == '-';
+
+  quint64 mantissa = 0;
+  int exponent = 0;
+  int digits = 0;
+  bool any = false;
+
+  for(; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+  {
+    if(digits < 19)
+    {
+      mantissa = mantissa * 10 + (*p - '0');
+      if(mantissa) ++digits;
+    } else {
+      ++exponent;
+    }
+  }
+
+  if(p < end && *p == '.')
+  {
+    for(++p; p < end && *p >= '0' && *p <= '9'; ++p, any = true)
+    {
+      if(digits < 19)
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        if(mantissa) ++digits;
+        --exponent;
+      }
+    }
+  }
+
+  if(any && p < end && (*p == 'e' || *p == 'E'))
+  {
+    const char *q = p + 1;
+    bool negativeExponent = false;
+    if(q < end && (*q == '-' || *q == '+'))
+      negativeExponent = *q++ == '-';
+
+    if(q < end && *q >= '0' && *q <= '9')
+    {
+      int e = 0;
+      for(; q < end && *q >= '0' && *q <= '9'; ++q)
+        e = qMin(e * 10 + (*q - '0'), 10000);
+      exponent += negativeExponent ? -e : e;
+      p = q;
+    }
+  }
+
+  if(!any || (p < end && !isBlank(*p) && *p != '\n'))
+  {
+    // Unusual spelling; let strtod deal with it
+    char token[64];
+    int length = 0;
+    for(p = start; p < end && !isBlank(*p) && *p != '\n'
+        && length < (int)sizeof(token) - 1; ++p)
+      token[length++] = *p;
+    token[length] = '\0';
+
+    char *last;
+    *value = strtod(token, &last);
+    return last == token ? NULL : p;
+  }
+
+  double result = mantissa;
+  if(exponent < 0)
+    result = (exponent >= -22) ? result/powers[-exponent]
+                               : result * std::pow(10.0, exponent);
+  else if(exponent > 0)
+    result = (exponent <= 22) ? result * powers[exponent]
+                              : result * std::pow(10.0, exponent);
+
+  *value = negative ? -result : result;
+  return p;
+}
+
 PLYLoader::PLYLoader(QObject *parent) :
-  QObject(parent), m_ply(NULL), m_pointCount(0), m_cancelLoad(false)
+  QObject(parent), m_ply(NULL), m_native(NULL), m_storageMode(PLY_DEFAULT),
+  m_dataOffset(0),
+  m_pointCount(0), m_hasColor(false), m_pointOut(NULL), m_colorOut(NULL),
+  m_emittedPoints(0), m_streaming(false), m_decoder(AutomaticDecoder),
+  m_cancelLoad(0)
 {
 }
 
@@ -17,6 +231,8 @@ PLYLoader::~PLYLoader()
     ply_close(m_ply);
     m_ply = NULL;
   }
+
+  delete m_native;
 }
 
 bool PLYLoader::canRead(const QString &path)
@@ -24,6 +240,9 @@ bool PLYLoader::canRead(const QString &path)
   // Early exit for invalid path
   if(path.isEmpty()) return false;
 
+  if(NimbusFile::canRead(path))
+    return true;
+
   // Attempt open
   p_ply ply = ply_open(path.toLocal8Bit().constData(), nullErrorCallback, 0,
                        NULL);
@@ -40,6 +259,27 @@ bool PLYLoader::canRead(const QString &path)
 
 bool PLYLoader::open(const QString &path)
 {
+  // Native caches describe everything in their header
+  if(NimbusFile::canRead(path))
+  {
+    m_native = new NimbusFile;
+    if(!m_native->open(path))
+    {
+      delete m_native;
+      m_native = NULL;
+      return false;
+    }
+
+    m_pointCount = m_native->pointCount();
+    m_hasColor = m_native->hasColor();
+    m_cameraPositions = m_native->cameraPositions();
+    m_cameraUps = m_native->cameraUpVectors();
+    m_cameraAims = m_native->cameraAimVectors();
+    m_cameraAspects = m_native->cameraAspectRatios();
+
+    return true;
+  }
+
   // Try to open; pass this as user data
   m_ply = ply_open(path.toLocal8Bit().constData(), nullErrorCallback, 0, NULL);
   if(!m_ply) return false;
@@ -49,17 +289,29 @@ bool PLYLoader::open(const QString &path)
   {
     ply_close(m_ply);
     m_ply = NULL;
+    return false;
   }
 
-  // Register vertex callbacks
+  // Record element layout for the binary reader
+  if(!readLayout(path))
+    m_elements.clear();
+
+  // Register vertex callbacks; user data index is the component
   m_pointCount = ply_set_read_cb(m_ply, "vertex", "x", vertexCallback, this, 0);
-  ply_set_read_cb(m_ply, "vertex", "y", vertexCallback, this, 0);
-  ply_set_read_cb(m_ply, "vertex", "z", vertexCallback, this, 0);
+  ply_set_read_cb(m_ply, "vertex", "y", vertexCallback, this, 1);
+  ply_set_read_cb(m_ply, "vertex", "z", vertexCallback, this, 2);
 
-  // Register color callbacks
-  ply_set_read_cb(m_ply, "vertex", "red", colorCallback, this, 0);
-  ply_set_read_cb(m_ply, "vertex", "green", colorCallback, this, 0);
-  ply_set_read_cb(m_ply, "vertex", "blue", colorCallback, this, 0);
+  // Register color callbacks only if all components are present; with some
+  // missing no color storage is allocated for them to write into
+  m_hasColor = ply_set_read_cb(m_ply, "vertex", "red", NULL, NULL, 0)
+      && ply_set_read_cb(m_ply, "vertex", "green", NULL, NULL, 0)
+      && ply_set_read_cb(m_ply, "vertex", "blue", NULL, NULL, 0);
+  if(m_hasColor)
+  {
+    ply_set_read_cb(m_ply, "vertex", "red", colorCallback, this, 0);
+    ply_set_read_cb(m_ply, "vertex", "green", colorCallback, this, 1);
+    ply_set_read_cb(m_ply, "vertex", "blue", colorCallback, this, 2);
+  }
 
   // Ignore alpha for now
   int alphaCount = ply_set_read_cb(m_ply, "vertex", "alpha", NULL, NULL, 0);
@@ -87,8 +339,62 @@ bool PLYLoader::open(const QString &path)
   return m_pointCount > 0;
 }
 
+void PLYLoader::run()
+{
+  PointCloud cloud = load();
+
+  // Shuffle here as well so the GUI thread only has to upload; caches are
+  // stored shuffled
+  if(m_cancelLoad.loadAcquire())
+    cloud = PointCloud();
+  else if(!m_native || !m_native->isShuffled())
+    cloud.shuffle();
+
+  // Cache before passing the cloud on; the GUI thread may still change it
+  if(!m_native && !m_cachePath.isEmpty() && !cloud.isEmpty())
+    NimbusFile::write(m_cachePath, cloud, m_cameraPositions, m_cameraUps,
+                      m_cameraAims, m_cameraAspects, true);
+
+  emit loaded(cloud);
+}
+
 PointCloud PLYLoader::load()
 {
+  PointCloud cloud;
+
+  bool automatic = m_decoder == AutomaticDecoder;
+  bool binary = (automatic || m_decoder == BinaryDecoder) && canLoadBinary();
+  bool ascii = (automatic || m_decoder == AsciiDecoder) && canLoadAscii();
+  bool callbacks = automatic || m_decoder == CallbackDecoder;
+
+  if(m_native)
+  {
+    cloud = loadNative();
+  } else if(binary)
+  {
+    // Binary reader works on the file directly; done with library handle
+    ply_close(m_ply);
+    m_ply = NULL;
+
+    cloud = loadBinary();
+  } else if(!ascii || !loadAscii(cloud)) {
+    cloud = callbacks ? loadCallbacks() : PointCloud();
+  }
+
+  // Everything has been passed on in chunks
+  if(m_streaming)
+    return PointCloud();
+
+  return cloud;
+}
+
+PointCloud PLYLoader::loadCallbacks()
+{
+  // Callbacks write straight into the cloud's storage
+  m_cloud = PointCloud(m_pointCount, m_hasColor);
+  m_pointOut = m_cloud.pointData();
+  m_colorOut = m_cloud.colorData();
+
   // Try reading all vertex data
   if(!ply_read(m_ply)) return PointCloud();
 
@@ -97,38 +403,560 @@ PointCloud PLYLoader::load()
   m_ply = NULL;
 
   // If load was canceled
-  if(m_cancelLoad)
+  if(m_cancelLoad.loadAcquire())
     return PointCloud();
 
-  // Make sure correct number of components
-  if(m_pointCount != m_points.count()/3)
+  emitChunk(m_cloud, m_cloud.count(), true);
+
+  PointCloud cloud = m_cloud;
+  m_cloud = PointCloud();
+
+  return cloud;
+}
+
+bool PLYLoader::readLayout(const QString &path)
+{
+  m_path = path;
+  m_elements.clear();
+
+  // Collect element and property descriptions parsed by ply_read_header()
+  p_ply_element element = NULL;
+  while((element = ply_get_next_element(m_ply, element)))
   {
-    // Handle error here
+    const char *name;
+    long ninstances;
+    if(!ply_get_element_info(element, &name, &ninstances))
+      return false;
+
+    Element e;
+    e.name = name;
+    e.count = ninstances;
+    e.stride = 0;
+
+    p_ply_property property = NULL;
+    while((property = ply_get_next_property(element, property)))
+    {
+      const char *propertyName;
+      e_ply_type type;
+      if(!ply_get_property_info(property, &propertyName, &type, NULL, NULL))
+        return false;
+
+      Property p;
+      p.name = propertyName;
+      p.type = type;
+      p.offset = e.stride;
+      e.properties.push_back(p);
+
+      // Records with list properties have no fixed stride
+      if(e.stride >= 0)
+        e.stride = (type == PLY_LIST) ? -1 : e.stride + typeSize(type);
+    }
+
+    m_elements.push_back(e);
   }
 
-  // Convert interleaved vertex components to vector
-  QVector<QVector3D> vertices;
-  for(int i = 0; i < m_points.count(); i += 3)
+  // rply doesn't expose storage mode or where data begins; scan header text
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly))
+    return false;
+
+  while(!file.atEnd())
   {
-    QVector3D vertex(m_points.at(i + 0),
-              m_points.at(i + 1),
-              m_points.at(i + 2));
+    QByteArray line = file.readLine().trimmed();
+
+    if(line.startsWith("format "))
+    {
+      if(line.contains("binary_little_endian"))
+        m_storageMode = PLY_LITTLE_ENDIAN;
+      else if(line.contains("binary_big_endian"))
+        m_storageMode = PLY_BIG_ENDIAN;
+      else
+        m_storageMode = PLY_ASCII;
+    }
+    else if(line == "end_header")
+    {
+      m_dataOffset = file.pos();
+      return true;
+    }
+  }
 
-    vertices.push_back(vertex);
+  return false;
+}
+
+int PLYLoader::elementIndex(const QByteArray &name) const
+{
+  for(int i = 0; i < m_elements.count(); ++i)
+  {
+    if(m_elements.at(i).name == name)
+      return i;
   }
 
-  // Convert colors
-  QVector<QColor> colors;
-  for(int i = 0; i < m_colors.count(); i += 3)
+  return -1;
+}
+
+qint64 PLYLoader::elementOffset(int index) const
+{
+  // Offset of element data from start of body; only known if all preceding
+  // elements have fixed size records
+  qint64 offset = 0;
+  for(int i = 0; i < index; ++i)
   {
-    QColor c;
-    c.setRgb(m_colors.at(i + 0),
-             m_colors.at(i + 1),
-             m_colors.at(i + 2));
-    colors.push_back(c);
+    if(m_elements.at(i).stride < 0)
+      return -1;
+    offset += m_elements.at(i).count * m_elements.at(i).stride;
   }
 
-  return PointCloud(vertices, colors);
+  return offset;
+}
+
+bool PLYLoader::canLoadBinary() const
+{
+  if(m_storageMode != PLY_LITTLE_ENDIAN && m_storageMode != PLY_BIG_ENDIAN)
+    return false;
+
+  int vertex = elementIndex("vertex");
+  if(vertex < 0 || m_elements.at(vertex).stride <= 0 || elementOffset(vertex) < 0)
+    return false;
+
+  // Cameras must be reachable without parsing list properties
+  int camera = elementIndex("camera");
+  if(camera >= 0 && (m_elements.at(camera).stride <= 0 || elementOffset(camera) < 0))
+    return false;
+
+  return true;
+}
+
+PointCloud PLYLoader::loadBinary()
+{
+  QFile file(m_path);
+  if(!file.open(QIODevice::ReadOnly))
+    return PointCloud();
+
+  const bool swap = (m_storageMode == PLY_BIG_ENDIAN)
+      != (Q_BYTE_ORDER == Q_BIG_ENDIAN);
+
+  const int vertexIndex = elementIndex("vertex");
+  const Element& vertex = m_elements.at(vertexIndex);
+  const int count = vertex.count;
+  const int stride = vertex.stride;
+
+  // Locate position and color properties
+  const char *names[] = { "x", "y", "z", "red", "green", "blue" };
+  const Property *properties[6] = { NULL, NULL, NULL, NULL, NULL, NULL };
+  for(int i = 0; i < vertex.properties.count(); ++i)
+  {
+    for(int j = 0; j < 6; ++j)
+    {
+      if(vertex.properties.at(i).name == names[j])
+        properties[j] = &vertex.properties.at(i);
+    }
+  }
+
+  if(!properties[0] || !properties[1] || !properties[2])
+    return PointCloud();
+
+  bool hasColor = properties[3] && properties[4] && properties[5];
+
+  // Decode straight into the cloud's storage.  Streaming decodes each block
+  // into a cloud of its own that is passed on and not kept.
+  PointCloud cloud(m_streaming ? 0 : count, hasColor);
+  float *points = cloud.pointData();
+  unsigned char *colors = cloud.colorData();
+
+  // Map vertex payload and decode from it directly; fall back to buffered
+  // reads if the file can't be mapped (e.g. address space on 32-bit builds)
+  const qint64 vertexOffset = m_dataOffset + elementOffset(vertexIndex);
+  const qint64 vertexSize = (qint64)count * stride;
+  uchar *mapped = file.map(vertexOffset, vertexSize);
+
+  if(!mapped && !file.seek(vertexOffset))
+    return PointCloud();
+
+  const int blockCount = qMax(1, BinaryBlockSize/stride);
+  QByteArray block;
+  if(!mapped)
+    block.resize(blockCount * stride);
+
+  for(int first = 0; first < count; first += blockCount)
+  {
+    if(m_cancelLoad.loadAcquire())
+      return PointCloud();
+
+    int n = qMin(blockCount, count - first);
+    const uchar *src;
+
+    if(mapped)
+    {
+      src = mapped + (qint64)first * stride;
+    } else {
+      if(file.read(block.data(), (qint64)n * stride) != (qint64)n * stride)
+      {
+        qWarning() << "Unexpected end of file" << m_path;
+        return PointCloud();
+      }
+      src = reinterpret_cast<const uchar *>(block.constData());
+    }
+
+    PointCloud chunk;
+    float *pointOut;
+    unsigned char *colorOut;
+    if(m_streaming)
+    {
+      chunk = PointCloud(n, hasColor);
+      pointOut = chunk.pointData();
+      colorOut = chunk.colorData();
+    } else {
+      pointOut = points + (size_t)first * 3;
+      colorOut = hasColor ? colors + (size_t)first * 3 : NULL;
+    }
+
+    for(int axis = 0; axis < 3; ++axis)
+    {
+      decodeColumn(properties[axis]->type, src + properties[axis]->offset,
+                   stride, n, swap, pointOut + axis, 3);
+    }
+
+    if(hasColor)
+    {
+      for(int channel = 0; channel < 3; ++channel)
+      {
+        const Property *p = properties[3 + channel];
+        decodeColumn(p->type, src + p->offset, stride, n, swap,
+                     colorOut + channel, 3);
+      }
+    }
+
+    if(m_streaming)
+      emit chunkLoaded(first, chunk);
+    else
+      emitChunk(cloud, first + n, first + n == count);
+    emit progress(100.0 * (first + n)/count);
+  }
+
+  if(mapped)
+    file.unmap(mapped);
+
+  // Cameras are few; read them in one go
+  int cameraIndex = elementIndex("camera");
+  if(cameraIndex >= 0)
+  {
+    const Element& camera = m_elements.at(cameraIndex);
+    QByteArray data = file.seek(m_dataOffset + elementOffset(cameraIndex))
+        ? file.read(camera.count * camera.stride) : QByteArray();
+
+    if(data.size() == camera.count * camera.stride)
+    {
+      readBinaryCameras(reinterpret_cast<const uchar *>(data.constData()),
+                        cameraIndex, camera.count);
+    }
+  }
+
+  return cloud;
+}
+
+PointCloud PLYLoader::loadNative()
+{
+  const int count = m_native->pointCount();
+  const QStringList attributes = m_native->attributeNames();
+
+  // Copy straight into the cloud's storage, or per block when streaming
+  PointCloud cloud(m_streaming ? 0 : count, m_hasColor);
+  foreach(const QString& name, attributes)
+    cloud.addAttribute(name);
+
+  for(int first = 0; first < count; first += ChunkPoints)
+  {
+    if(m_cancelLoad.loadAcquire())
+      return PointCloud();
+
+    int n = qMin(ChunkPoints, count - first);
+
+    if(m_streaming)
+    {
+      PointCloud block(n, m_hasColor);
+      foreach(const QString& name, attributes)
+        block.addAttribute(name);
+
+      if(!m_native->read(first, n, block))
+        return PointCloud();
+
+      emit chunkLoaded(first, block);
+    } else {
+      if(!m_native->read(first, n, cloud, first))
+        return PointCloud();
+
+      emitChunk(cloud, first + n, first + n == count);
+    }
+
+    emit progress(100.0 * (first + n)/count);
+  }
+
+  return cloud;
+}
+
+void PLYLoader::readBinaryCameras(const uchar *data, int index, int count)
+{
+  const Element& camera = m_elements.at(index);
+
+  const bool swap = (m_storageMode == PLY_BIG_ENDIAN)
+      != (Q_BYTE_ORDER == Q_BIG_ENDIAN);
+
+  for(int i = 0; i < count; ++i)
+  {
+    const uchar *record = data + i * camera.stride;
+
+    foreach(const Property& p, camera.properties)
+      addCameraValue(p.name, readValue(p.type, record + p.offset, swap));
+  }
+}
+
+void PLYLoader::addCameraValue(const QByteArray &property, double value)
+{
+  // Same property names as registered with rply in open()
+  static const char *names[4][3] = { { "x", "y", "z" }, { "ux", "uy", "uz" },
+                                     { "dx", "dy", "dz" },
+                                     { "arx", "ary", "arz" } };
+  QVector<double> *targets[4] = { &m_cameraPositions, &m_cameraUps,
+                                  &m_cameraAims, &m_cameraAspects };
+
+  for(int j = 0; j < 4; ++j)
+  {
+    for(int k = 0; k < 3; ++k)
+    {
+      if(property == names[j][k])
+        targets[j]->push_back(value);
+    }
+  }
+}
+
+bool PLYLoader::canLoadAscii() const
+{
+  if(m_storageMode != PLY_ASCII || m_dataOffset <= 0)
+    return false;
+
+  // Vertex and camera records must be plain scalars
+  int vertex = elementIndex("vertex");
+  if(vertex < 0 || m_elements.at(vertex).stride < 0)
+    return false;
+
+  int camera = elementIndex("camera");
+  if(camera >= 0 && m_elements.at(camera).stride < 0)
+    return false;
+
+  return true;
+}
+
+const char *PLYLoader::readAsciiElement(int index, const char *pos,
+                                        const char *end)
+{
+  // Each instance occupies one line
+  const Element& element = m_elements.at(index);
+  const bool isCamera = (element.name == "camera");
+
+  for(qint64 i = 0; i < element.count && pos < end; ++i)
+  {
+    const char *lineEnd = (const char *)memchr(pos, '\n', end - pos);
+    if(!lineEnd) lineEnd = end;
+
+    if(isCamera)
+    {
+      const char *p = pos;
+      foreach(const Property& property, element.properties)
+      {
+        double value;
+        if(!p || !(p = parseNumber(p, lineEnd, &value)))
+          break;
+        addCameraValue(property.name, value);
+      }
+    }
+
+    pos = lineEnd + (lineEnd < end ? 1 : 0);
+  }
+
+  return pos;
+}
+
+bool PLYLoader::loadAscii(PointCloud &cloud)
+{
+  QFile file(m_path);
+  if(!file.open(QIODevice::ReadOnly))
+    return false;
+
+  const qint64 size = file.size() - m_dataOffset;
+  uchar *mapped = (size > 0) ? file.map(m_dataOffset, size) : NULL;
+  if(!mapped)
+    return false;
+
+  const char *pos = reinterpret_cast<const char *>(mapped);
+  const char *end = pos + size;
+
+  const int vertexIndex = elementIndex("vertex");
+  const Element& vertex = m_elements.at(vertexIndex);
+  const int count = vertex.count;
+
+  // Elements ahead of the vertices
+  for(int i = 0; i < vertexIndex; ++i)
+    pos = readAsciiElement(i, pos, end);
+
+  // Map each property to its output: 0-2 position, 3-5 color, -1 unused
+  const char *names[] = { "x", "y", "z", "red", "green", "blue" };
+  QVector<int> targets(vertex.properties.count(), -1);
+  int found[6] = { 0, 0, 0, 0, 0, 0 };
+  for(int i = 0; i < vertex.properties.count(); ++i)
+  {
+    for(int j = 0; j < 6; ++j)
+    {
+      if(vertex.properties.at(i).name == names[j])
+      {
+        targets[i] = j;
+        found[j] = 1;
+      }
+    }
+  }
+
+  if(!found[0] || !found[1] || !found[2])
+  {
+    cloud = PointCloud();
+    return true;
+  }
+
+  const bool hasColor = found[3] && found[4] && found[5];
+  if(!hasColor)
+  {
+    for(int i = 0; i < targets.count(); ++i)
+    {
+      if(targets[i] >= 3)
+        targets[i] = -1;
+    }
+  }
+
+  PointCloud result(count, hasColor);
+  float *pointOut = result.pointData();
+  unsigned char *colorOut = result.colorData();
+
+  // Split body into line aligned chunks
+  const qint64 bodySize = end - pos;
+  const int chunkCount = qMax((qint64)Parallel::threadCount(),
+                              bodySize/AsciiChunkSize + 1);
+
+  QVector<const char *> bounds(chunkCount + 1);
+  bounds[0] = pos;
+  bounds[chunkCount] = end;
+  for(int i = 1; i < chunkCount; ++i)
+  {
+    const char *p = qMax(bounds[i - 1], pos + bodySize * i/chunkCount);
+    const char *newline = (const char *)memchr(p, '\n', end - p);
+    bounds[i] = newline ? newline + 1 : end;
+  }
+
+  // First pass counts lines so each chunk knows the index of its first point
+  QVector<qint64> lines(chunkCount + 1, 0);
+  const char * const *chunkBounds = bounds.constData();
+  qint64 *chunkLines = lines.data();
+  Parallel::forEach(chunkCount, [&](int i)
+  {
+    qint64 n = 0;
+    const char *p = chunkBounds[i];
+    const char *chunkEnd = chunkBounds[i + 1];
+    while(p < chunkEnd)
+    {
+      const char *newline = (const char *)memchr(p, '\n', chunkEnd - p);
+      ++n;
+      p = newline ? newline + 1 : chunkEnd;
+    }
+    chunkLines[i + 1] = n;
+  });
+
+  for(int i = 0; i < chunkCount; ++i)
+    lines[i + 1] += lines[i];
+
+  if(lines[chunkCount] < count)
+  {
+    qWarning() << "Unexpected end of file" << m_path;
+    cloud = PointCloud();
+    return true;
+  }
+
+  // Second pass parses vertex lines in parallel; chunks finishing out of order
+  // are passed on once all chunks before them are done
+  QAtomicInt parsedChunks(0);
+  QAtomicInt failed(0);
+  QScopedArrayPointer<QAtomicInt> chunkDone(new QAtomicInt[chunkCount]);
+  int nextChunk = 0;
+  const int *propertyTargets = targets.constData();
+  const int propertyCount = targets.count();
+  Parallel::forEach(chunkCount, [&](int i)
+  {
+    const char *p = chunkBounds[i];
+    const char *chunkEnd = chunkBounds[i + 1];
+
+    for(qint64 line = chunkLines[i];
+        line < count && p < chunkEnd && !m_cancelLoad.loadAcquire();
+        ++line)
+    {
+      const char *lineEnd = (const char *)memchr(p, '\n', chunkEnd - p);
+      if(!lineEnd) lineEnd = chunkEnd;
+
+      const char *q = p;
+      for(int k = 0; k < propertyCount; ++k)
+      {
+        double value;
+        if(!(q = parseNumber(q, lineEnd, &value)))
+        {
+          failed.storeRelease(1);
+          break;
+        }
+
+        int target = propertyTargets[k];
+        if(target >= 3)
+          colorOut[line * 3 + target - 3] = qBound(0.0, value, 255.0);
+        else if(target >= 0)
+          pointOut[line * 3 + target] = value;
+      }
+
+      p = lineEnd + 1;
+    }
+
+    chunkDone[i].storeRelease(1);
+    parsedChunks.fetchAndAddRelaxed(1);
+  },
+  [&]()
+  {
+    while(nextChunk < chunkCount && chunkDone[nextChunk].loadAcquire())
+      ++nextChunk;
+    emitChunk(result, qMin(lines[nextChunk], (qint64)count), false);
+
+    emit progress(100.0 * parsedChunks.loadAcquire()/chunkCount);
+  });
+
+  if(m_cancelLoad.loadAcquire())
+  {
+    cloud = PointCloud();
+    return true;
+  }
+
+  if(failed.loadAcquire())
+    qWarning() << "Malformed vertex data in" << m_path;
+
+  // Find end of vertex lines to continue with remaining elements
+  int last = 0;
+  while(last < chunkCount && lines[last + 1] <= count)
+    ++last;
+  pos = bounds[last];
+  for(qint64 line = lines[last]; line < count && pos < end; ++line)
+  {
+    const char *newline = (const char *)memchr(pos, '\n', end - pos);
+    pos = newline ? newline + 1 : end;
+  }
+
+  for(int i = vertexIndex + 1; i < m_elements.count(); ++i)
+    pos = readAsciiElement(i, pos, end);
+
+  emitChunk(result, count, true);
+  emit progress(100);
+
+  cloud = result;
+  return true;
 }
 
 void PLYLoader::nullErrorCallback(p_ply, const char *)
@@ -143,12 +971,21 @@ int PLYLoader::vertexCallback(p_ply_argument arg)
   ply_get_argument_user_data(arg, (void **)&loader, NULL);
 
   // See if load has been canceled
-  if(loader->m_cancelLoad) return 0;
+  if(loader->m_cancelLoad.loadAcquire()) return 0;
 
   // save vertex coordinate
-  loader->m_points.push_back(ply_get_argument_value(arg));
+  long index, component;
+  ply_get_argument_element(arg, NULL, &index);
+  ply_get_argument_user_data(arg, NULL, &component);
+  loader->m_pointOut[(size_t)index * 3 + component] =
+      ply_get_argument_value(arg);
 
-  loader->emitProgress();
+  // Points before this one are complete once a new x coordinate arrives
+  if(component == 0)
+  {
+    loader->emitProgress(index);
+    loader->emitChunk(loader->m_cloud, index, false);
+  }
 
   // A return of 1 indicates keep loading
   return 1;
@@ -161,10 +998,14 @@ int PLYLoader::colorCallback(p_ply_argument arg)
   ply_get_argument_user_data(arg, (void **)&loader, NULL);
 
   // See if load has been canceled
-  if(loader->m_cancelLoad) return 0;
+  if(loader->m_cancelLoad.loadAcquire()) return 0;
 
-  // Push vertex value onto list of coordinates
-  loader->m_colors.push_back(ply_get_argument_value(arg));
+  // Store color component of vertex
+  long index, component;
+  ply_get_argument_element(arg, NULL, &index);
+  ply_get_argument_user_data(arg, NULL, &component);
+  loader->m_colorOut[(size_t)index * 3 + component] =
+      qBound(0.0, ply_get_argument_value(arg), 255.0);
 
 //  qDebug() << "Got color" << ply_get_argument_value(arg);
 
@@ -182,7 +1023,7 @@ int PLYLoader::cameraPositionCallback(p_ply_argument arg)
   loader->m_cameraPositions.push_back(ply_get_argument_value(arg));
 
   // See if load has been canceled
-  if(loader->m_cancelLoad) return 0;
+  if(loader->m_cancelLoad.loadAcquire()) return 0;
 
   return 1;
 }
@@ -196,7 +1037,7 @@ int PLYLoader::cameraUpCallback(p_ply_argument arg)
   loader->m_cameraUps.push_back(ply_get_argument_value(arg));
 
   // See if load has been canceled
-  if(loader->m_cancelLoad) return 0;
+  if(loader->m_cancelLoad.loadAcquire()) return 0;
 
   return 1;
 }
@@ -210,7 +1051,7 @@ int PLYLoader::cameraAimCallback(p_ply_argument arg)
   loader->m_cameraAims.push_back(ply_get_argument_value(arg));
 
   // See if load has been canceled
-  if(loader->m_cancelLoad) return 0;
+  if(loader->m_cancelLoad.loadAcquire()) return 0;
 
   return 1;
 }
@@ -224,19 +1065,31 @@ int PLYLoader::cameraAspectCallback(p_ply_argument arg)
   loader->m_cameraAspects.push_back(ply_get_argument_value(arg));
 
   // See if load has been canceled
-  if(loader->m_cancelLoad) return 0;
+  if(loader->m_cancelLoad.loadAcquire()) return 0;
 
   return 1;
 }
 
 
-void PLYLoader::emitProgress()
+void PLYLoader::emitChunk(const PointCloud &cloud, int loaded, bool final)
+{
+  // Only pass on reasonably sized pieces, except for the last one
+  int count = loaded - m_emittedPoints;
+  if(count <= 0 || (count < ChunkPoints && !final))
+    return;
+
+  emit chunkLoaded(m_emittedPoints, cloud.mid(m_emittedPoints, count));
+
+  m_emittedPoints = loaded;
+}
+
+void PLYLoader::emitProgress(int loaded)
 {
-  int step = qMax(1.0, (m_pointCount * 3.0)/100.0);
+  int step = qMax(1, m_pointCount/100);
 
-  if(m_points.count() % step == 0)
+  if(loaded % step == 0)
   {
-    int percent = 100.0 * m_points.count()/(m_pointCount * 3.0);
+    int percent = 100.0 * loaded/m_pointCount;
     emit progress(percent);
   }
 }
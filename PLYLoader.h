@@ -3,9 +3,14 @@
 
 #include <QObject>
 #include <QVector>
+#include <QByteArray>
+#include <QAtomicInt>
 #include "rply.h"
 #include "PointCloud.h"
 
+class NimbusFile;
+
+// Loads PLY files, and the native caches written for them by NimbusFile
 class PLYLoader : public QObject
 {
   Q_OBJECT
@@ -17,9 +22,33 @@ public:
 
   bool open(const QString& path);
   int pointCount() const { return m_pointCount; }
+  bool hasColor() const { return m_hasColor; }
 
+  // Blocking load in the calling thread; points are in file order
   PointCloud load();
 
+  // When streaming, load() passes points on through chunkLoaded() only and
+  // returns an empty cloud.  Binary files are then never held in memory as a
+  // whole; other encodings still are while loading.
+  void setStreaming(bool streaming) { m_streaming = streaming; }
+
+  // Decoder used by load().  Automatic takes the fastest one the file
+  // allows; forcing one the file can't use makes load() return an empty
+  // cloud.  Native caches are always read as such.
+  enum Decoder
+  {
+    AutomaticDecoder,
+    CallbackDecoder,
+    BinaryDecoder,
+    AsciiDecoder
+  };
+
+  void setDecoder(Decoder decoder) { m_decoder = decoder; }
+
+  // When set, run() writes the shuffled cloud to a native cache at path
+  // before passing it on
+  void setCachePath(const QString& path) { m_cachePath = path; }
+
   const QVector<double>& cameraPositions() const { return m_cameraPositions; }
   const QVector<double>& cameraUpVectors() const { return m_cameraUps; }
   const QVector<double>& cameraAimVectors() const { return m_cameraAims; }
@@ -27,9 +56,17 @@ public:
 
 signals:
   void progress(int percent);
+  // Points [first, first + chunk.count()) in file order, emitted in order
+  // while loading
+  void chunkLoaded(int first, PointCloud chunk);
+  // Emitted by run() with the shuffled cloud; empty if canceled or failed
+  void loaded(PointCloud cloud);
 
 public slots:
-  void cancel() { m_cancelLoad = true; }
+  // Loads and shuffles; meant to be invoked in a worker thread
+  void run();
+  // Safe to call from any thread
+  void cancel() { m_cancelLoad.storeRelease(1); }
 
 private:
   static void nullErrorCallback(p_ply, const char *);
@@ -40,21 +77,76 @@ private:
   static int cameraAimCallback(p_ply_argument arg);
   static int cameraAspectCallback(p_ply_argument arg);
 
-  void emitProgress();
+  void emitProgress(int loaded);
+  void emitChunk(const PointCloud& cloud, int loaded, bool final);
+
+  PointCloud loadCallbacks();
+
+  // Binary fast path; decodes vertex records in bulk without rply callbacks
+  bool readLayout(const QString& path);
+  bool canLoadBinary() const;
+  PointCloud loadBinary();
+  void readBinaryCameras(const uchar *data, int index, int count);
+
+  // Native cache reader
+  PointCloud loadNative();
+
+  // Parallel ASCII reader; returns false if it could not be used
+  bool canLoadAscii() const;
+  bool loadAscii(PointCloud& cloud);
+  const char *readAsciiElement(int index, const char *pos, const char *end);
+
+  void addCameraValue(const QByteArray& property, double value);
+
+  // Property of a PLY element; offset is in bytes from start of record
+  struct Property
+  {
+    QByteArray name;
+    e_ply_type type;
+    int offset;
+  };
+
+  // Element as described by the header; stride is -1 for elements containing
+  // list properties
+  struct Element
+  {
+    QByteArray name;
+    qint64 count;
+    int stride;
+    QVector<Property> properties;
+  };
+
+  int elementIndex(const QByteArray& name) const;
+  qint64 elementOffset(int index) const;
 
   p_ply m_ply;
+  NimbusFile *m_native;
+  QString m_cachePath;
+
+  QString m_path;
+  QVector<Element> m_elements;
+  e_ply_storage_mode m_storageMode;
+  qint64 m_dataOffset;
 
   int m_pointCount;
+  bool m_hasColor;
 
-  QVector<double> m_points;
-  QVector<double> m_colors;
+  // Cloud filled by the rply callbacks
+  PointCloud m_cloud;
+  float *m_pointOut;
+  unsigned char *m_colorOut;
 
   QVector<double> m_cameraPositions;
   QVector<double> m_cameraUps;
   QVector<double> m_cameraAims;
   QVector<double> m_cameraAspects;
 
-  bool m_cancelLoad;
+  // Points already passed on through chunkLoaded()
+  int m_emittedPoints;
+  bool m_streaming;
+  Decoder m_decoder;
+
+  QAtomicInt m_cancelLoad;
 };
 
 #endif // PLYLOADER_H
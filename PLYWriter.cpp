@@ -0,0 +1,134 @@
+#include "PLYWriter.h"
+#include <QSaveFile>
+#include <QByteArray>
+#include <QDebug>
+#include <cstdio>
+#include <cstring>
+
+// Points encoded per write
+static const int WriteBlockSize = 1 << 20;
+
+PLYWriter::PLYWriter() : m_file(NULL), m_count(0), m_written(0),
+  m_hasColor(false), m_ascii(false)
+{
+}
+
+PLYWriter::~PLYWriter()
+{
+  // Never closed; discard
+  delete m_file;
+}
+
+void PLYWriter::addComment(const QString &comment)
+{
+  m_comments << comment;
+}
+
+bool PLYWriter::open(const QString &path, qint64 count, bool hasColor)
+{
+  if(m_file || count < 0)
+    return false;
+
+  m_file = new QSaveFile(path);
+  if(!m_file->open(QIODevice::WriteOnly))
+  {
+    delete m_file;
+    m_file = NULL;
+    return false;
+  }
+
+  m_count = count;
+  m_written = 0;
+  m_hasColor = hasColor;
+
+  QByteArray header = "ply\n";
+  if(m_ascii)
+    header += "format ascii 1.0\n";
+  else if(Q_BYTE_ORDER == Q_LITTLE_ENDIAN)
+    header += "format binary_little_endian 1.0\n";
+  else
+    header += "format binary_big_endian 1.0\n";
+  foreach(const QString& comment, m_comments)
+    header += "comment " + comment.toUtf8() + "\n";
+  header += "element vertex " + QByteArray::number(count) + "\n";
+  header += "property float x\nproperty float y\nproperty float z\n";
+  if(hasColor)
+  {
+    header += "property uchar red\nproperty uchar green\n"
+        "property uchar blue\n";
+  }
+  header += "end_header\n";
+
+  return m_file->write(header) == header.size();
+}
+
+bool PLYWriter::write(const PointCloud &points)
+{
+  if(!m_file || m_written + points.count() > m_count
+     || (m_hasColor && !points.hasColor()))
+    return false;
+
+  const float *p = points.pointData();
+  const unsigned char *c = points.colorData();
+  const int stride = 3 * sizeof(float) + (m_hasColor ? 3 : 0);
+
+  // Encoded a block at a time; the buffer stays far below QByteArray limits
+  QByteArray data;
+  for(int first = 0; first < points.count(); first += WriteBlockSize)
+  {
+    const int last = qMin(points.count(), first + WriteBlockSize);
+
+    if(m_ascii)
+    {
+      // One line per vertex; 9 digits round-trip a float
+      data.resize(0);
+      char line[128];
+      for(int i = first; i < last; ++i)
+      {
+        const float *v = p + (size_t)i * 3;
+        const unsigned char *rgb = m_hasColor ? c + (size_t)i * 3 : NULL;
+        int length = rgb
+            ? snprintf(line, sizeof(line), "%.9g %.9g %.9g %d %d %d\n",
+                       v[0], v[1], v[2], rgb[0], rgb[1], rgb[2])
+            : snprintf(line, sizeof(line), "%.9g %.9g %.9g\n",
+                       v[0], v[1], v[2]);
+        data.append(line, length);
+      }
+    } else {
+      // Interleave into records
+      data.resize((last - first) * stride);
+      char *out = data.data();
+      for(int i = first; i < last; ++i, out += stride)
+      {
+        memcpy(out, p + (size_t)i * 3, 3 * sizeof(float));
+        if(m_hasColor)
+          memcpy(out + 3 * sizeof(float), c + (size_t)i * 3, 3);
+      }
+    }
+
+    if(m_file->write(data) != data.size())
+    {
+      qWarning() << "Unable to write" << m_file->fileName();
+      return false;
+    }
+
+    m_written += last - first;
+  }
+
+  return true;
+}
+
+bool PLYWriter::close()
+{
+  if(!m_file)
+    return false;
+
+  bool result = m_written == m_count && m_file->commit();
+  if(!result)
+    m_file->cancelWriting();
+
+  delete m_file;
+  m_file = NULL;
+
+  return result;
+}
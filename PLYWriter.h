@@ -0,0 +1,40 @@
+#ifndef PLYWRITER_H
+#define PLYWRITER_H
+
+#include <QString>
+#include <QStringList>
+#include "PointCloud.h"
+
+class QSaveFile;
+
+// Writes PLY files in pieces, so clouds larger than memory can be written.
+// Vertices have x,y,z floats and, optionally, red, green, blue bytes; binary
+// files are in host byte order.
+class PLYWriter
+{
+public:
+  PLYWriter();
+  ~PLYWriter();
+
+  // Added to the header; call before open()
+  void addComment(const QString& comment);
+  // Writes text records instead of binary ones; call before open()
+  void setAscii(bool ascii) { m_ascii = ascii; }
+
+  // Exactly count points are to be written.  Nothing is left at path unless
+  // close() succeeds.
+  bool open(const QString& path, qint64 count, bool hasColor);
+  // Appends points in order; any number at once
+  bool write(const PointCloud& points);
+  bool close();
+
+private:
+  QSaveFile *m_file;
+  QStringList m_comments;
+  qint64 m_count;
+  qint64 m_written;
+  bool m_hasColor;
+  bool m_ascii;
+};
+
+#endif // PLYWRITER_H
@@ -0,0 +1,72 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <QThreadPool>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QAtomicInt>
+
+namespace Parallel
+{
+  // Worker that pulls indices from a shared counter until none remain
+  template <typename Function>
+  class ForTask : public QRunnable
+  {
+  public:
+    ForTask(int count, QAtomicInt *next, QSemaphore *done, Function *body) :
+      m_count(count), m_next(next), m_done(done), m_body(body) { }
+
+    void run()
+    {
+      int i;
+      while((i = m_next->fetchAndAddRelaxed(1)) < m_count)
+        (*m_body)(i);
+
+      m_done->release();
+    }
+
+  private:
+    int m_count;
+    QAtomicInt *m_next;
+    QSemaphore *m_done;
+    Function *m_body;
+  };
+
+  inline int threadCount()
+  {
+    return qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+  }
+
+  // Calls body(i) for every i in [0, count) on the global thread pool and
+  // returns once all calls have finished.  Indices are handed out one at a
+  // time, so each call should do a sizeable piece of work.  While waiting, the
+  // calling thread invokes wait() roughly every 50 ms; use it to report
+  // progress.
+  template <typename Function, typename Wait>
+  void forEach(int count, Function body, Wait wait)
+  {
+    if(count <= 0)
+      return;
+
+    QAtomicInt next(0);
+    QSemaphore done;
+    int workers = qMin(count, threadCount());
+
+    for(int i = 0; i < workers; ++i)
+    {
+      QThreadPool::globalInstance()->start(
+            new ForTask<Function>(count, &next, &done, &body));
+    }
+
+    while(!done.tryAcquire(workers, 50))
+      wait();
+  }
+
+  template <typename Function>
+  void forEach(int count, Function body)
+  {
+    forEach(count, body, [](){});
+  }
+}
+
+#endif // PARALLEL_H
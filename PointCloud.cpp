@@ -1,40 +1,127 @@
 #include "PointCloud.h"
+#include <QMap>
 #include <QDebug>
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+#include "Parallel.h"
+#include "Random.h"
+#include "KdTree.h"
+#include "RadixSort.h"
+#include "Morton.h"
 
-PointCloud::PointCloud() : m_needsExtents(false)
+// Points per block of the parallel extents and statistics passes
+static const int ReductionBlockSize = 1 << 20;
+
+// Bits of a voxel grid coordinate, so that a cell fits a 64-bit key
+static const int VoxelAxisBits = 21;
+
+// Each stratum of a Morton layout after the first holds this fraction of the
+// points before it
+static const int StratumGrowth = 8;
+
+// Leading points that size the cells of partition(), and the deepest level
+// of those cells
+static const int ChunkSampleSize = 1 << 20;
+static const int ChunkLevels = 10;
+
+// Points per block of the parallel shuffle.  Fixed rather than derived from
+// the thread count so that a seed always gives the same order.
+static const int ShuffleBlockSize = 1 << 20;
+
+class PointCloudData : public QSharedData
+{
+public:
+  PointCloudData() : count(0) { }
+
+  int count;
+  std::vector<float> points;
+  std::vector<unsigned char> colors;
+  QMap<QString, std::vector<float> > attributes;
+};
+
+PointCloud::PointCloud() : d(new PointCloudData), m_needsExtents(false),
+  m_needsStatistics(true)
 {
 }
 
-PointCloud::PointCloud(const QVector<QVector3D> &points,
-                       const QVector<QColor> &colors) : m_points(points),
-  m_colors(colors),
-  m_needsExtents(true)
+PointCloud::PointCloud(int count, bool hasColor) : d(new PointCloudData),
+  m_needsExtents(true), m_needsStatistics(true)
 {
+  d->count = qMax(0, count);
+  d->points.resize((size_t)d->count * 3);
+  if(hasColor)
+    d->colors.resize((size_t)d->count * 3);
+}
+
+PointCloud::PointCloud(const PointCloud &other) : d(other.d),
+  m_needsExtents(other.m_needsExtents),
+  m_min(other.m_min),
+  m_max(other.m_max),
+  m_center(other.m_center),
+  m_needsStatistics(other.m_needsStatistics),
+  m_statistics(other.m_statistics),
+  m_kdTree(other.m_kdTree)
+{
+}
+
+PointCloud &PointCloud::operator=(const PointCloud &other)
+{
+  d = other.d;
+  m_needsExtents = other.m_needsExtents;
+  m_min = other.m_min;
+  m_max = other.m_max;
+  m_center = other.m_center;
+  m_needsStatistics = other.m_needsStatistics;
+  m_statistics = other.m_statistics;
+  m_kdTree = other.m_kdTree;
+
+  return *this;
 }
 
 PointCloud::~PointCloud()
 {
 }
 
-const QVector3D & PointCloud::point(int index) const
+QVector3D PointCloud::point(int index) const
 {
-  return m_points.at(index);
+  const float *p = &d->points[(size_t)index * 3];
+  return QVector3D(p[0], p[1], p[2]);
 }
 
 void PointCloud::setPoint(int index, const QVector3D &point)
 {
-  m_points.replace(index, point);
+  float *p = &d->points[(size_t)index * 3];
+  p[0] = point.x();
+  p[1] = point.y();
+  p[2] = point.z();
   m_needsExtents = true;
+  m_needsStatistics = true;
+  m_kdTree.clear();
+}
+
+QColor PointCloud::color(int index) const
+{
+  if(!hasColor())
+    return QColor(Qt::white);
+
+  const unsigned char *c = &d->colors[(size_t)index * 3];
+  return QColor(c[0], c[1], c[2]);
 }
 
 int PointCloud::count() const
 {
-  return m_points.count();
+  return d->count;
+}
+
+bool PointCloud::isEmpty() const
+{
+  return d->count == 0;
 }
 
 bool PointCloud::hasColor() const
 {
-  return !m_colors.isEmpty();
+  return !d->colors.empty();
 }
 
 const QVector3D & PointCloud::boundingBoxMinimum() const
@@ -58,99 +145,880 @@ const QVector3D & PointCloud::boundingBoxCenter() const
   return m_center;
 }
 
-QVector<float> PointCloud::pointData() const
+const PointCloud::Statistics &PointCloud::statistics() const
+{
+  if(m_needsStatistics) calculateStatistics();
+
+  return m_statistics;
+}
+
+const KdTree &PointCloud::kdTree() const
 {
-  QVector<float> interleaved;
-  foreach(QVector3D point, m_points)
+  if(!m_kdTree)
+    m_kdTree = QSharedPointer<const KdTree>(new KdTree(*this));
+
+  return *m_kdTree;
+}
+
+const float *PointCloud::pointData() const
+{
+  return d->points.empty() ? NULL : &d->points[0];
+}
+
+float *PointCloud::pointData()
+{
+  // Caller may change positions
+  m_needsExtents = true;
+  m_needsStatistics = true;
+  m_kdTree.clear();
+
+  return d->points.empty() ? NULL : &d->points[0];
+}
+
+const unsigned char *PointCloud::colorData() const
+{
+  return d->colors.empty() ? NULL : &d->colors[0];
+}
+
+unsigned char *PointCloud::colorData()
+{
+  m_needsStatistics = true;
+
+  return d->colors.empty() ? NULL : &d->colors[0];
+}
+
+void PointCloud::addAttribute(const QString &name)
+{
+  m_needsStatistics = true;
+
+  if(!hasAttribute(name))
+    d->attributes.insert(name, std::vector<float>(d->count, 0.0f));
+}
+
+bool PointCloud::hasAttribute(const QString &name) const
+{
+  return d->attributes.contains(name);
+}
+
+QStringList PointCloud::attributeNames() const
+{
+  return d->attributes.keys();
+}
+
+const float *PointCloud::attributeData(const QString &name) const
+{
+  QMap<QString, std::vector<float> >::const_iterator i =
+      d->attributes.constFind(name);
+
+  if(i == d->attributes.constEnd() || i->empty())
+    return NULL;
+
+  return &(*i)[0];
+}
+
+float *PointCloud::attributeData(const QString &name)
+{
+  m_needsStatistics = true;
+
+  QMap<QString, std::vector<float> >::iterator i = d->attributes.find(name);
+
+  if(i == d->attributes.end() || i->empty())
+    return NULL;
+
+  return &(*i)[0];
+}
+
+PointCloud PointCloud::mid(int first, int count) const
+{
+  first = qBound(0, first, d->count);
+  count = qBound(0, count, d->count - first);
+
+  PointCloud result(count, hasColor());
+
+  std::copy(d->points.begin() + (size_t)first * 3,
+            d->points.begin() + (size_t)(first + count) * 3,
+            result.d->points.begin());
+
+  if(hasColor())
+  {
+    std::copy(d->colors.begin() + (size_t)first * 3,
+              d->colors.begin() + (size_t)(first + count) * 3,
+              result.d->colors.begin());
+  }
+
+  QMap<QString, std::vector<float> >::const_iterator i;
+  for(i = d->attributes.constBegin(); i != d->attributes.constEnd(); ++i)
   {
-    interleaved.push_back(point.x());
-    interleaved.push_back(point.y());
-    interleaved.push_back(point.z());
+    result.d->attributes.insert(i.key(),
+                                std::vector<float>(i->begin() + first,
+                                                   i->begin() + first + count));
   }
 
-  return interleaved;
+  return result;
 }
 
-QVector<unsigned char> PointCloud::colorData() const
+qint64 PointCloud::memoryUsage() const
 {
-  QVector<unsigned char> result;
+  qint64 bytes = d->points.capacity() * sizeof(float)
+      + d->colors.capacity();
+
+  foreach(const std::vector<float>& attribute, d->attributes)
+    bytes += attribute.capacity() * sizeof(float);
+
+  return bytes;
+}
 
-  foreach(QColor c, m_colors)
+// Uniform random permutation of [0, count).  Every point is sent to a random
+// bucket, in parallel over blocks of points, and each bucket is then shuffled
+// on its own; as bucket sizes follow the random assignment, the result is as
+// uniform as a serial Fisher-Yates shuffle.
+static std::vector<quint32> randomPermutation(int count, quint64 seed)
+{
+  std::vector<quint32> permutation(count);
+
+  const int blocks = (count + ShuffleBlockSize - 1)/ShuffleBlockSize;
+  const int buckets = blocks;
+
+  // Each bucket gets a block's worth of points on average
+  std::vector<int> offsets((size_t)blocks * buckets, 0);
+
+  if(buckets > 1)
   {
-    result.push_back(c.red());
-    result.push_back(c.green());
-    result.push_back(c.blue());
+    // Count points per bucket for every block
+    Parallel::forEach(blocks, [&](int block) {
+      Random random(seed, block);
+      int *counts = &offsets[(size_t)block * buckets];
+      int last = qMin(count, (block + 1) * ShuffleBlockSize);
+      for(int i = block * ShuffleBlockSize; i < last; ++i)
+        ++counts[random.bounded(buckets)];
+    });
+
+    // Buckets are laid out one after another; within a bucket, blocks are in
+    // order
+    int offset = 0;
+    for(int bucket = 0; bucket < buckets; ++bucket)
+    {
+      for(int block = 0; block < blocks; ++block)
+      {
+        int& entry = offsets[(size_t)block * buckets + bucket];
+        int n = entry;
+        entry = offset;
+        offset += n;
+      }
+    }
+
+    // Same streams again, now placing points
+    Parallel::forEach(blocks, [&](int block) {
+      Random random(seed, block);
+      int *next = &offsets[(size_t)block * buckets];
+      int last = qMin(count, (block + 1) * ShuffleBlockSize);
+      for(int i = block * ShuffleBlockSize; i < last; ++i)
+        permutation[next[random.bounded(buckets)]++] = i;
+    });
+  } else {
+    for(int i = 0; i < count; ++i)
+      permutation[i] = i;
   }
 
+  // Bucket b now ends where bucket b + 1 starts in the last block
+  Parallel::forEach(buckets, [&](int bucket) {
+    size_t first = (bucket == 0) ? 0
+        : offsets[(size_t)(blocks - 1) * buckets + bucket - 1];
+    size_t last = offsets[(size_t)(blocks - 1) * buckets + bucket];
+    if(buckets == 1)
+      last = count;
+
+    Random random(seed, blocks + bucket);
+    for(size_t i = last - first; i > 1; --i)
+    {
+      size_t j = random.bounded(i);
+      qSwap(permutation[first + i - 1], permutation[first + j]);
+    }
+  });
+
+  return permutation;
+}
+
+// Values of data at the indices of permutation, in its order; stride values
+// per point
+template <typename T>
+static std::vector<T> gather(const std::vector<T>& data,
+                             const std::vector<quint32>& permutation,
+                             int stride)
+{
+  std::vector<T> result(permutation.size() * stride);
+  const int count = permutation.size();
+  const int blocks = (count + ShuffleBlockSize - 1)/ShuffleBlockSize;
+
+  Parallel::forEach(blocks, [&](int block) {
+    int last = qMin(count, (block + 1) * ShuffleBlockSize);
+    for(int i = block * ShuffleBlockSize; i < last; ++i)
+    {
+      const T *src = &data[(size_t)permutation[i] * stride];
+      T *dst = &result[(size_t)i * stride];
+      for(int k = 0; k < stride; ++k)
+        dst[k] = src[k];
+    }
+  });
+
   return result;
 }
 
-QVector<float> PointCloud::colorDataF() const
+void PointCloud::shuffle(quint64 seed)
+{
+  if(count() < 2)
+    return;
+
+  reorder(randomPermutation(count(), seed));
+}
+
+void PointCloud::reorder(const std::vector<quint32> &permutation)
 {
-  QVector<float> result;
+  // Gather into new storage rather than swapping in place; reads shared data
+  // directly instead of detaching a copy first
+  const PointCloudData *source = d.constData();
+  PointCloudData *result = new PointCloudData;
+
+  result->count = source->count;
+  result->points = gather(source->points, permutation, 3);
+  if(!source->colors.empty())
+    result->colors = gather(source->colors, permutation, 3);
 
-  foreach(QColor c, m_colors)
+  QMap<QString, std::vector<float> >::const_iterator i;
+  for(i = source->attributes.constBegin(); i != source->attributes.constEnd();
+      ++i)
   {
-    result.push_back(c.redF());
-    result.push_back(c.greenF());
-    result.push_back(c.blueF());
+    result->attributes.insert(i.key(), gather(*i, permutation, 1));
   }
 
+  // Extents are unchanged; tree entries refer to the old order
+  d = result;
+  m_kdTree.clear();
+}
+
+PointCloud PointCloud::crop(const QVector3D &minimum,
+                            const QVector3D &maximum) const
+{
+  QVector<int> inside = kdTree().withinBox(minimum, maximum);
+
+  // Keep the order of this cloud, so a shuffled cloud stays shuffled
+  std::vector<quint32> indices(inside.begin(), inside.end());
+  std::sort(indices.begin(), indices.end());
+
+  PointCloud result;
+  PointCloudData *data = result.d.data();
+  data->count = indices.size();
+  data->points = gather(d->points, indices, 3);
+  if(hasColor())
+    data->colors = gather(d->colors, indices, 3);
+
+  QMap<QString, std::vector<float> >::const_iterator i;
+  for(i = d->attributes.constBegin(); i != d->attributes.constEnd(); ++i)
+    data->attributes.insert(i.key(), gather(*i, indices, 1));
+
+  result.m_needsExtents = true;
+
   return result;
 }
 
+PointCloud PointCloud::shuffled(quint64 seed) const
+{
+  PointCloud result(*this);
+
+  result.shuffle(seed);
+
+  return result;
+}
 
-void PointCloud::shuffle()
+// Runs body(first, last) over blocks of the points; on the global thread pool
+// for large clouds only
+template <typename Function>
+static void forEachBlock(int count, Function body)
 {
-  for(int i = m_points.count() - 1; i > 0; i--)
+  const int blocks = (count + ReductionBlockSize - 1)/ReductionBlockSize;
+  if(blocks <= 1)
   {
-    // Get random index between 0 and i
-    int j = (double)qrand()/RAND_MAX * i;
+    body(0, count);
+    return;
+  }
 
-    QVector3D tmp = m_points.at(i);
-    m_points.replace(i, m_points.at(j));
-    m_points.replace(j, tmp);
+  Parallel::forEach(blocks, [&](int block) {
+    body(block * ReductionBlockSize,
+         qMin(count, (block + 1) * ReductionBlockSize));
+  });
+}
 
-    if(hasColor())
+void PointCloud::calculateExtents() const
+{
+  if(isEmpty())
+  {
+    m_min = m_max = m_center = QVector3D();
+    m_needsExtents = false;
+    return;
+  }
+
+  // Minimum and maximum per block.  Points are reduced four at a time as
+  // twelve independent lanes, which keeps the x,y,z interleaving out of the
+  // inner loop and lets the compiler vectorize it.
+  const int blocks = (count() + ReductionBlockSize - 1)/ReductionBlockSize;
+  std::vector<float> minima((size_t)blocks * 3);
+  std::vector<float> maxima((size_t)blocks * 3);
+  const float *points = pointData();
+
+  forEachBlock(count(), [&](int first, int last) {
+    float low[12], high[12];
+    const float *p = points + (size_t)first * 3;
+    for(int k = 0; k < 12; ++k)
+      low[k] = high[k] = p[k % 3];
+
+    int i = first;
+    for(; i + 4 <= last; i += 4, p += 12)
+    {
+      for(int k = 0; k < 12; ++k)
+      {
+        low[k] = std::min(low[k], p[k]);
+        high[k] = std::max(high[k], p[k]);
+      }
+    }
+
+    for(; i < last; ++i, p += 3)
+    {
+      for(int k = 0; k < 3; ++k)
+      {
+        low[k] = std::min(low[k], p[k]);
+        high[k] = std::max(high[k], p[k]);
+      }
+    }
+
+    int block = first/ReductionBlockSize;
+    for(int k = 0; k < 3; ++k)
+    {
+      minima[block * 3 + k] = std::min(std::min(low[k], low[k + 3]),
+                                       std::min(low[k + 6], low[k + 9]));
+      maxima[block * 3 + k] = std::max(std::max(high[k], high[k + 3]),
+                                       std::max(high[k + 6], high[k + 9]));
+    }
+  });
+
+  float low[3] = { minima[0], minima[1], minima[2] };
+  float high[3] = { maxima[0], maxima[1], maxima[2] };
+  for(int block = 1; block < blocks; ++block)
+  {
+    for(int k = 0; k < 3; ++k)
     {
-      QColor tmpColor = m_colors.at(i);
-      m_colors.replace(i, m_colors.at(j));
-      m_colors.replace(j, tmpColor);
+      low[k] = std::min(low[k], minima[block * 3 + k]);
+      high[k] = std::max(high[k], maxima[block * 3 + k]);
     }
   }
+
+  m_min = QVector3D(low[0], low[1], low[2]);
+  m_max = QVector3D(high[0], high[1], high[2]);
+  m_center = (m_min + m_max)/2.0;
+
+  // Mark extents as calculated
+  m_needsExtents = false;
 }
 
-PointCloud PointCloud::shuffled() const
+void PointCloud::calculateStatistics() const
 {
-  PointCloud result(*this);
+  Statistics result;
+  result.zHistogram.fill(0, Statistics::HistogramBins);
+  if(hasColor())
+  {
+    for(int c = 0; c < 3; ++c)
+      result.colorHistograms[c].fill(0, Statistics::HistogramBins);
+  }
+
+  const int n = count();
+  if(n == 0)
+  {
+    m_statistics = result;
+    m_needsStatistics = false;
+    return;
+  }
+
+  // Histogram bins are spread over the bounding box
+  const float zMin = boundingBoxMinimum().z();
+  const float zRange = boundingBoxMaximum().z() - zMin;
+  const float zScale = zRange > 0.0f ? Statistics::HistogramBins/zRange : 0.0f;
+
+  const QStringList names = attributeNames();
+  QVector<const float *> attributes;
+  foreach(const QString& name, names)
+    attributes.push_back(attributeData(name));
+
+  // Sums and counts per block, merged once all are done
+  struct Partial
+  {
+    double position[3];
+    double color[3];
+    QVector<double> attributes;
+    QVector<qint64> z;
+    QVector<qint64> colors[3];
+  };
+
+  const int blocks = (n + ReductionBlockSize - 1)/ReductionBlockSize;
+  QVector<Partial> partials(blocks);
+  Partial *partialData = partials.data();
+
+  const float *points = pointData();
+  const unsigned char *colors = colorData();
+
+  forEachBlock(n, [&](int first, int last) {
+    Partial& partial = partialData[first/ReductionBlockSize];
+    partial.z.fill(0, Statistics::HistogramBins);
+
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    for(int i = first; i < last; ++i)
+    {
+      const float *p = points + (size_t)i * 3;
+      sum[0] += p[0];
+      sum[1] += p[1];
+      sum[2] += p[2];
+
+      int bin = (p[2] - zMin) * zScale;
+      ++partial.z[qBound(0, bin, Statistics::HistogramBins - 1)];
+    }
+
+    double colorSum[3] = { 0.0, 0.0, 0.0 };
+    if(colors)
+    {
+      for(int c = 0; c < 3; ++c)
+        partial.colors[c].fill(0, Statistics::HistogramBins);
+
+      for(int i = first; i < last; ++i)
+      {
+        const unsigned char *rgb = colors + (size_t)i * 3;
+        for(int c = 0; c < 3; ++c)
+        {
+          colorSum[c] += rgb[c];
+          ++partial.colors[c][rgb[c]];
+        }
+      }
+    }
+
+    for(int c = 0; c < 3; ++c)
+    {
+      partial.position[c] = sum[c];
+      partial.color[c] = colorSum[c];
+    }
+
+    foreach(const float *attribute, attributes)
+    {
+      double total = 0.0;
+      for(int i = first; i < last; ++i)
+        total += attribute[i];
+      partial.attributes.push_back(total);
+    }
+  });
+
+  double position[3] = { 0.0, 0.0, 0.0 };
+  double color[3] = { 0.0, 0.0, 0.0 };
+  QVector<double> attributeSums(names.count(), 0.0);
+
+  foreach(const Partial& partial, partials)
+  {
+    for(int c = 0; c < 3; ++c)
+    {
+      position[c] += partial.position[c];
+      color[c] += partial.color[c];
+    }
+
+    for(int b = 0; b < Statistics::HistogramBins; ++b)
+    {
+      result.zHistogram[b] += partial.z.at(b);
+      for(int c = 0; c < 3 && hasColor(); ++c)
+        result.colorHistograms[c][b] += partial.colors[c].at(b);
+    }
+
+    for(int a = 0; a < names.count(); ++a)
+      attributeSums[a] += partial.attributes.at(a);
+  }
+
+  result.mean = QVector3D(position[0]/n, position[1]/n, position[2]/n);
+  if(hasColor())
+    result.meanColor = QVector3D(color[0]/n, color[1]/n, color[2]/n);
+
+  for(int a = 0; a < names.count(); ++a)
+    result.attributeMeans.insert(names.at(a), attributeSums.at(a)/n);
+
+  m_statistics = result;
+  m_needsStatistics = false;
+}
+
+// Bits needed for values in [0, count)
+static int bitsFor(quint32 count)
+{
+  int bits = 0;
+  while(bits < 32 && ((quint64)1 << bits) < count)
+    ++bits;
+  return bits;
+}
+
+PointCloud PointCloud::voxelDownsample(float voxelSize, VoxelPoint point) const
+{
+  const int n = count();
+  if(n == 0 || !(voxelSize > 0.0f))
+    return *this;
+
+  const QVector3D minimum = boundingBoxMinimum();
+  const QVector3D extent = boundingBoxMaximum() - minimum;
+
+  float largest = qMax(extent.x(), qMax(extent.y(), extent.z()));
+  voxelSize = qMax(voxelSize, largest/((1 << VoxelAxisBits) - 1));
+
+  // Cells along each axis and the bits of the key holding them
+  int bits[3];
+  for(int k = 0; k < 3; ++k)
+    bits[k] = bitsFor((quint32)(extent[k]/voxelSize) + 1);
+
+  // Key of each point's cell with the point's index, sorted to make the
+  // points of a cell adjacent
+  std::vector<quint64> keys(n);
+  std::vector<quint32> indices(n);
+  const float *points = pointData();
+
+  forEachBlock(n, [&](int first, int last) {
+    for(int i = first; i < last; ++i)
+    {
+      const float *p = points + (size_t)i * 3;
+      quint64 key = 0;
+      for(int k = 0; k < 3; ++k)
+      {
+        quint64 cell = (quint64)((p[k] - minimum[k])/voxelSize);
+        key = (key << bits[k]) | qMin(cell, ((quint64)1 << bits[k]) - 1);
+      }
+      keys[i] = key;
+      indices[i] = i;
+    }
+  });
+
+  RadixSort::sort(keys, indices, bits[0] + bits[1] + bits[2]);
+
+  // Cells start where the key changes; counted per block, then listed
+  const int blocks = (n + ReductionBlockSize - 1)/ReductionBlockSize;
+  std::vector<int> blockCells(blocks + 1, 0);
+  Parallel::forEach(blocks, [&](int block) {
+    int last = qMin(n, (block + 1) * ReductionBlockSize);
+    for(int i = block * ReductionBlockSize; i < last; ++i)
+      blockCells[block + 1] += (i == 0 || keys[i] != keys[i - 1]);
+  });
+
+  for(int block = 0; block < blocks; ++block)
+    blockCells[block + 1] += blockCells[block];
+
+  const int cells = blockCells[blocks];
+  std::vector<int> starts(cells + 1);
+  starts[cells] = n;
+  Parallel::forEach(blocks, [&](int block) {
+    int cell = blockCells[block];
+    int last = qMin(n, (block + 1) * ReductionBlockSize);
+    for(int i = block * ReductionBlockSize; i < last; ++i)
+    {
+      if(i == 0 || keys[i] != keys[i - 1])
+        starts[cell++] = i;
+    }
+  });
+
+  // Keys aren't needed past this point
+  std::vector<quint64>().swap(keys);
+
+  PointCloud result(cells, hasColor());
+  float *resultPoints = result.pointData();
+  unsigned char *resultColors = result.colorData();
+  const unsigned char *colors = colorData();
+
+  const QStringList names = attributeNames();
+  QVector<const float *> attributes;
+  QVector<float *> resultAttributes;
+  foreach(const QString& name, names)
+  {
+    result.addAttribute(name);
+    attributes << attributeData(name);
+    resultAttributes << result.attributeData(name);
+  }
+
+  forEachBlock(cells, [&](int firstCell, int lastCell) {
+    for(int cell = firstCell; cell < lastCell; ++cell)
+    {
+      const int first = starts[cell];
+      const int last = starts[cell + 1];
+      const double size = last - first;
+
+      // Sums relative to the bounding box keep precision far from the
+      // origin
+      double position[3] = { 0.0, 0.0, 0.0 };
+      double color[3] = { 0.0, 0.0, 0.0 };
+      for(int i = first; i < last; ++i)
+      {
+        const size_t index = indices[i];
+        for(int k = 0; k < 3; ++k)
+        {
+          position[k] += points[index * 3 + k] - minimum[k];
+          if(colors)
+            color[k] += colors[index * 3 + k];
+        }
+      }
 
-  result.shuffle();
+      float *p = resultPoints + (size_t)cell * 3;
+      for(int k = 0; k < 3; ++k)
+      {
+        p[k] = minimum[k] + position[k]/size;
+        if(colors)
+          resultColors[(size_t)cell * 3 + k] = qRound(color[k]/size);
+      }
+
+      if(point == VoxelNearestCentroid)
+      {
+        size_t nearest = indices[first];
+        float nearestDistance = FLT_MAX;
+        for(int i = first; i < last; ++i)
+        {
+          const float *q = points + (size_t)indices[i] * 3;
+          float x = q[0] - p[0], y = q[1] - p[1], z = q[2] - p[2];
+          float distance = x * x + y * y + z * z;
+          if(distance < nearestDistance)
+          {
+            nearest = indices[i];
+            nearestDistance = distance;
+          }
+        }
+
+        for(int k = 0; k < 3; ++k)
+          p[k] = points[nearest * 3 + k];
+        for(int a = 0; a < attributes.count(); ++a)
+          resultAttributes[a][cell] = attributes[a][nearest];
+        continue;
+      }
+
+      for(int a = 0; a < attributes.count(); ++a)
+      {
+        double sum = 0.0;
+        for(int i = first; i < last; ++i)
+          sum += attributes[a][indices[i]];
+        resultAttributes[a][cell] = sum/size;
+      }
+    }
+  });
 
   return result;
 }
 
-void PointCloud::calculateExtents() const
+// Morton codes of positions on a grid over the longest side of a box
+class MortonGrid
 {
-  // Initialize min and max
-  m_min = m_points.first();
-  m_max = m_points.first();
+public:
+  MortonGrid(const QVector3D& minimum, const QVector3D& maximum)
+    : m_minimum(minimum), m_cells((1 << Morton::AxisBits) - 1)
+  {
+    QVector3D extent = maximum - minimum;
+    float largest = qMax(extent.x(), qMax(extent.y(), extent.z()));
+    m_scale = largest > 0.0f ? m_cells/largest : 0.0f;
+  }
 
-  // Find min and max of all points
-  foreach(QVector3D point, m_points)
+  quint64 code(const float *p) const
   {
-    if(point.x() < m_min.x()) m_min.setX(point.x());
-    else if(point.x() > m_max.x()) m_max.setX(point.x());
+    quint32 cell[3];
+    for(int k = 0; k < 3; ++k)
+      cell[k] = (quint32)qBound(0.0f, (p[k] - m_minimum[k]) * m_scale, m_cells);
+    return Morton::code(cell[0], cell[1], cell[2]);
+  }
 
-    if(point.y() < m_min.y()) m_min.setY(point.y());
-    else if(point.y() > m_max.y()) m_max.setY(point.y());
+private:
+  QVector3D m_minimum;
+  float m_cells;
+  float m_scale;
+};
 
-    if(point.z() < m_min.z()) m_min.setZ(point.z());
-    else if(point.z() > m_max.z()) m_max.setZ(point.z());
+// End of the stratum starting at first in a cloud of count points
+static int stratumEnd(int first, int count)
+{
+  if(first == 0)
+    return qMin(count, PointCloud::FirstStratumSize);
+  return (int)qMin<qint64>(count, (qint64)first + first/StratumGrowth);
+}
+
+int PointCloud::strataPrefix(int points, int count)
+{
+  if(points <= FirstStratumSize || points >= count)
+    return qBound(0, points, count);
+
+  int end = FirstStratumSize;
+  for(int next = stratumEnd(end, count); next <= points;
+      next = stratumEnd(end, count))
+    end = next;
+
+  return end;
+}
+
+QVector<int> PointCloud::strata(int count)
+{
+  QVector<int> ends;
+  for(int end = 0; end < count; )
+  {
+    end = stratumEnd(end, count);
+    ends.append(end);
   }
+  return ends;
+}
+
+void PointCloud::sortStrata()
+{
+  const int n = count();
+  if(n <= FirstStratumSize)
+    return;
 
-  // Calculate Center
-  m_center = (m_max - m_min)/2.0;
+  const MortonGrid grid(boundingBoxMinimum(), boundingBoxMaximum());
 
-  // Mark extents as calculated
-  m_needsExtents = false;
+  std::vector<quint32> permutation(n);
+  for(int i = 0; i < FirstStratumSize; ++i)
+    permutation[i] = i;
+
+  // Read through the const overload, which doesn't detach
+  const PointCloud& source = *this;
+  const float *points = source.pointData();
+  for(int first = FirstStratumSize; first < n; )
+  {
+    const int last = stratumEnd(first, n);
+
+    std::vector<quint64> codes(last - first);
+    std::vector<quint32> indices(last - first);
+    forEachBlock(last - first, [&](int begin, int end) {
+      for(int i = begin; i < end; ++i)
+      {
+        codes[i] = grid.code(points + (size_t)(first + i) * 3);
+        indices[i] = first + i;
+      }
+    });
+
+    RadixSort::sort(codes, indices, 3 * Morton::AxisBits);
+    std::copy(indices.begin(), indices.end(), permutation.begin() + first);
+
+    first = last;
+  }
+
+  reorder(permutation);
+}
+
+QVector<PointCloud::Chunk> PointCloud::partition(int chunkSize)
+{
+  QVector<Chunk> chunks;
+  const int n = count();
+  if(n == 0)
+    return chunks;
+
+  const MortonGrid grid(boundingBoxMinimum(), boundingBoxMaximum());
+  const PointCloud& source = *this;
+  const float *points = source.pointData();
+
+  // Codes of the sample in curve order
+  const int samples = qMin(n, ChunkSampleSize);
+  std::vector<quint64> codes(samples);
+  for(int i = 0; i < samples; ++i)
+    codes[i] = grid.code(points + (size_t)i * 3);
+  std::sort(codes.begin(), codes.end());
+
+  // First code of each leaf cell in curve order.  Octants the sample missed
+  // are leaves too, so the cells tile the grid and a point belongs to the
+  // last cell starting at or before its code; the few points of missed
+  // octants get chunks of their own rather than widening a neighbor's bounds
+  struct Cell
+  {
+    int first;
+    int last;
+    int level;
+    quint64 start;
+  };
+
+  const qint64 limit = qMax((qint64)1, (qint64)chunkSize * samples/n);
+  std::vector<quint64> starts;
+  QVector<Cell> cells;
+  Cell root = { 0, samples, 0, 0 };
+  cells.append(root);
+
+  while(!cells.isEmpty())
+  {
+    Cell cell = cells.takeLast();
+    if(cell.last - cell.first <= limit || cell.level == ChunkLevels)
+    {
+      starts.push_back(cell.start);
+      continue;
+    }
+
+    // Octants last to first, so they are taken in curve order
+    const int shift = 60 - 3 * cell.level;
+    int last = cell.last;
+    for(int o = 7; o >= 0; --o)
+    {
+      quint64 start = cell.start | ((quint64)o << shift);
+      int first = std::lower_bound(codes.begin() + cell.first,
+                                   codes.begin() + last, start) - codes.begin();
+      Cell child = { first, last, cell.level + 1, start };
+      cells.append(child);
+      last = first;
+    }
+  }
+  std::vector<quint64>().swap(codes);
+
+  // Stable sort by cell keeps the order of points within each
+  std::vector<quint64> keys(n);
+  std::vector<quint32> indices(n);
+  forEachBlock(n, [&](int first, int last) {
+    for(int i = first; i < last; ++i)
+    {
+      quint64 code = grid.code(points + (size_t)i * 3);
+      // The first cell starts at code 0
+      keys[i] = std::upper_bound(starts.begin(), starts.end(), code)
+          - starts.begin() - 1;
+      indices[i] = i;
+    }
+  });
+
+  RadixSort::sort(keys, indices, bitsFor(starts.size()));
+
+  // Cells of missed octants may have no points at all; dropped below
+  const QVector<int> ends = strata(n);
+  chunks.resize(starts.size());
+  Chunk *chunkData = chunks.data();
+  Parallel::forEach(chunks.count(), [&](int c) {
+    Chunk& chunk = chunkData[c];
+    chunk.first = std::lower_bound(keys.begin(), keys.end(), (quint64)c)
+        - keys.begin();
+    chunk.count = std::lower_bound(keys.begin() + chunk.first, keys.end(),
+                                   (quint64)c + 1) - keys.begin() - chunk.first;
+    if(chunk.count == 0)
+      return;
+
+    const quint32 *first = &indices[chunk.first];
+    const quint32 *last = first + chunk.count;
+
+    const float *p = points + (size_t)*first * 3;
+    chunk.minimum = chunk.maximum = QVector3D(p[0], p[1], p[2]);
+    for(const quint32 *i = first; i != last; ++i)
+    {
+      p = points + (size_t)*i * 3;
+      for(int k = 0; k < 3; ++k)
+      {
+        chunk.minimum[k] = qMin(chunk.minimum[k], p[k]);
+        chunk.maximum[k] = qMax(chunk.maximum[k], p[k]);
+      }
+    }
+
+    // Indices of a chunk are ascending
+    chunk.strata.resize(ends.count());
+    for(int s = 0; s < ends.count(); ++s)
+      chunk.strata[s] = std::lower_bound(first, last, (quint32)ends[s]) - first;
+  });
+
+  int kept = 0;
+  for(int c = 0; c < chunks.count(); ++c)
+  {
+    if(chunks.at(c).count > 0)
+      chunks[kept++] = chunks.at(c);
+  }
+  chunks.resize(kept);
+
+  reorder(indices);
+
+  return chunks;
 }
@@ -4,19 +4,51 @@
 #include <QVector>
 #include <QVector3D>
 #include <QColor>
+#include <QStringList>
+#include <QSharedDataPointer>
+#include <QSharedPointer>
+#include <QMetaType>
+#include <QMap>
+#include <vector>
 
+class PointCloudData;
+class KdTree;
+
+// Point cloud with packed, implicitly shared storage: x,y,z floats and r,g,b
+// bytes per point, plus optional named float attributes.  Storage is not
+// bound by the 2 GB limit of Qt containers.
 class PointCloud
 {
 public:
+    // Summary of the values of a cloud; see statistics()
+    struct Statistics
+    {
+      static const int HistogramBins = 256;
+
+      QVector3D mean;
+      // Mean r,g,b in [0, 255]; zero without color
+      QVector3D meanColor;
+      // Point counts over the z range of the bounding box
+      QVector<qint64> zHistogram;
+      // Point counts per value of red, green and blue; empty without color
+      QVector<qint64> colorHistograms[3];
+      QMap<QString, double> attributeMeans;
+    };
+
     PointCloud();
-    PointCloud(const QVector<QVector3D> &points,
-               const QVector<QColor> &colors = QVector<QColor>());
+    // Allocate storage for count points, to be filled in place through
+    // pointData() and colorData()
+    explicit PointCloud(int count, bool hasColor = false);
+    PointCloud(const PointCloud &other);
+    PointCloud &operator=(const PointCloud &other);
 
     ~PointCloud();
 
-    const QVector3D& point(int index) const;
+    QVector3D point(int index) const;
     void setPoint(int index, const QVector3D& point);
+    QColor color(int index) const;
     int count() const;
+    bool isEmpty() const;
 
     bool hasColor() const;
 
@@ -24,28 +56,115 @@ public:
     const QVector3D& boundingBoxMaximum() const;
     const QVector3D& boundingBoxCenter() const;
 
-    // Return x,y,z interleaved vector of floats
-    QVector<float> pointData() const;
-    // Return rgb interleaved values for color as unsigned bytes
-    QVector<unsigned char> colorData() const;
-    QVector<float> colorDataF() const;
+    // Computed on first use in one parallel pass over the points
+    const Statistics& statistics() const;
+
+    // x,y,z interleaved floats, three per point
+    const float *pointData() const;
+    float *pointData();
+    // r,g,b interleaved bytes, three per point; NULL without color
+    const unsigned char *colorData() const;
+    unsigned char *colorData();
+
+    // Optional per point scalar attributes such as intensity
+    void addAttribute(const QString &name);
+    bool hasAttribute(const QString &name) const;
+    QStringList attributeNames() const;
+    const float *attributeData(const QString &name) const;
+    float *attributeData(const QString &name);
+
+    // Copy of points [first, first + count)
+    PointCloud mid(int first, int count) const;
+    // Copy of the points inside the box, in their order in this cloud
+    PointCloud crop(const QVector3D& minimum, const QVector3D& maximum) const;
+
+    // Point kept for each cell by voxelDownsample()
+    enum VoxelPoint
+    {
+      VoxelCentroid,
+      VoxelNearestCentroid
+    };
+
+    // Reduces the cloud to one point per cell of a grid of cubes of the
+    // given size, aligned to the bounding box: the centroid of the cell's
+    // points or the point nearest to it.  Colors are averaged, attributes
+    // too for centroids.  Cells are coarsened if there would be more than
+    // 2^21 along an axis.  Points are in grid order; shuffle before drawing.
+    PointCloud voxelDownsample(float voxelSize,
+                               VoxelPoint point = VoxelCentroid) const;
 
-    // Shuffle point order in-place
-    void shuffle();
+    // Spatial index over positions for nearest neighbor, radius and box
+    // queries.  Built in parallel on first use and shared by copies until
+    // positions change.
+    const KdTree& kdTree() const;
+
+    // Bytes of host memory held by point data
+    qint64 memoryUsage() const;
+
+    // Seed used unless one is given, so shuffles are repeatable
+    static const quint64 DefaultShuffleSeed = Q_UINT64_C(0x4e696d627573);
+
+    // Shuffle point order uniformly at random, in parallel.  The order only
+    // depends on the seed and the number of points.
+    void shuffle(quint64 seed = DefaultShuffleSeed);
     // Return shuffled version of this point cloud
-    PointCloud shuffled() const;
+    PointCloud shuffled(quint64 seed = DefaultShuffleSeed) const;
+
+    // Points of the first stratum, which sortStrata() leaves in place
+    static const int FirstStratumSize = 1 << 16;
+
+    // Sorts points by 63 bit Morton code over the bounding box within strata
+    // that each grow by an eighth, in parallel.  On a shuffled cloud every
+    // prefix ending at a stratum boundary is still a uniform random subset,
+    // while the points inside a stratum are spatially coherent, which suits
+    // vertex caches, rasterization and queries that gather points.
+    void sortStrata();
+    // Longest prefix of at most points that stays uniform after
+    // sortStrata() on a cloud of count points: any prefix within the first
+    // stratum, or whole strata otherwise
+    static int strataPrefix(int points, int count);
+    // Ends of the strata of a cloud of count points; the last one is count
+    static QVector<int> strata(int count);
+
+    // Points of a chunk, contiguous after partition(), and their bounds
+    struct Chunk
+    {
+      int first;
+      int count;
+      QVector3D minimum;
+      QVector3D maximum;
+      // Points of the chunk among the first strata(count())[i] points of the
+      // order before partitioning
+      QVector<int> strata;
+    };
+
+    // Groups points into chunks of nearby points: octree cells over the
+    // bounding box split until they hold about chunkSize points at most.
+    // Cells are sized from the leading points, a uniform sample of a
+    // shuffled cloud; points in cells the sample missed are chunked by
+    // those cells.  Points of a chunk keep their order, so each chunk of
+    // a shuffled cloud is shuffled too.
+    QVector<Chunk> partition(int chunkSize);
 
 private:
     void calculateExtents() const;
+    void calculateStatistics() const;
+    // Moves point permutation[i] to i
+    void reorder(const std::vector<quint32>& permutation);
 
-    QVector<QVector3D> m_points;
-    QVector<QColor> m_colors;
+    QSharedDataPointer<PointCloudData> d;
 
     // Following are mutable to allow logical constness
     mutable bool m_needsExtents;
     mutable QVector3D m_min;
     mutable QVector3D m_max;
     mutable QVector3D m_center;
+    mutable bool m_needsStatistics;
+    mutable Statistics m_statistics;
+    mutable QSharedPointer<const KdTree> m_kdTree;
 };
 
+// Allow passing point clouds through queued signals
+Q_DECLARE_METATYPE(PointCloud)
+
 #endif // POINTCLOUD_H
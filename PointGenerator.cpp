@@ -2,198 +2,427 @@
 #include <QVector>
 #include <QVector3D>
 #include <QColor>
+#include <QtCore/qmath.h>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include "Parallel.h"
+#include "PLYWriter.h"
+#include "NimbusFile.h"
+
+// Points generated per task; each block has its own random stream
+static const int GeneratorBlockSize = 1 << 18;
+
+// Samplers write one point on the surface or in the volume of their shape.
+// All are sampled directly, with no rejection except for the torus, where
+// at least 60% of candidates are accepted.
 
 class Sphere
 {
 public:
-  Sphere(double radius = 0.5) : m_radiusSquared(radius*radius) { }
-  double operator()(double x, double y, double z)
+  Sphere(bool surface, double radius = 0.5) :
+    m_surface(surface), m_radius(radius) { }
+  void operator()(Random& random, float *p) const
   {
-    return x*x + y*y + z*z - m_radiusSquared;
+    // Uniform direction
+    double z = random.uniform(-1.0, 1.0);
+    double angle = random.uniform(0.0, 2.0 * M_PI);
+    double r = qSqrt(1.0 - z*z);
+
+    // Volume grows with the cube of the radius
+    double radius = m_surface ? m_radius
+                              : m_radius * std::cbrt(random.uniform());
+
+    p[0] = radius * r * qCos(angle);
+    p[1] = radius * r * qSin(angle);
+    p[2] = radius * z;
   }
 private:
-  double m_radiusSquared;
+  bool m_surface;
+  double m_radius;
 };
 
+// Side of an upright cylinder as tall as the unit cube
 class Cylinder
 {
 public:
-  Cylinder(double radius = 0.5) : m_radiusSquared(radius*radius) { }
-  double operator()(double x, double y, double z)
+  Cylinder(bool surface, double radius = 0.5) :
+    m_surface(surface), m_radius(radius) { }
+  void operator()(Random& random, float *p) const
   {
-    Q_UNUSED(z)
-    return x*x + y*y - m_radiusSquared;
+    double angle = random.uniform(0.0, 2.0 * M_PI);
+    double radius = m_surface ? m_radius
+                              : m_radius * qSqrt(random.uniform());
+
+    p[0] = radius * qCos(angle);
+    p[1] = radius * qSin(angle);
+    p[2] = random.uniform(-0.5, 0.5);
   }
 private:
-  double m_radiusSquared;
+  bool m_surface;
+  double m_radius;
 };
 
 class Cube
 {
 public:
-  Cube(double width = 1.0) : m_halfWidth(width/2.0) { }
-  double operator()(double x, double y, double z)
+  Cube(bool surface, double width = 1.0) :
+    m_surface(surface), m_halfWidth(width/2.0) { }
+  void operator()(Random& random, float *p) const
   {
-    return qMax(qMax(qAbs(x), qAbs(y)), qAbs(z)) - m_halfWidth;
+    for(int k = 0; k < 3; ++k)
+      p[k] = random.uniform(-m_halfWidth, m_halfWidth);
+
+    if(m_surface)
+    {
+      // Faces have equal area; push the point out onto a random one
+      int face = random.bounded(6);
+      p[face/2] = (face % 2) ? m_halfWidth : -m_halfWidth;
+    }
   }
 private:
+  bool m_surface;
   double m_halfWidth;
 };
 
+// Ring around the z axis
 class Torus
 {
 public:
-  Torus(double radius = 0.3, double height = 0.2) :
-    m_majorRadius(radius),
-    m_majorRadiusSquared(m_majorRadius*m_majorRadius),
-    m_minorRadiusSquared(height*height) { }
-  double operator()(double x, double y, double z)
+  Torus(bool surface, double radius = 0.3, double height = 0.2) :
+    m_surface(surface), m_majorRadius(radius), m_minorRadius(height) { }
+  void operator()(Random& random, float *p) const
   {
-    return (x*x + y*y + z*z + m_majorRadiusSquared - m_minorRadiusSquared)
-        * (x*x + y*y + z*z + m_majorRadiusSquared - m_minorRadiusSquared)
-        - 4 * m_majorRadiusSquared * (x*x + y*y);
-  }
+    double distance, angle;
 
+    // Area and volume grow with the distance from the axis; accept points
+    // in the tube's cross section in proportion to it
+    do {
+      distance = m_surface ? m_minorRadius
+                           : m_minorRadius * qSqrt(random.uniform());
+      angle = random.uniform(0.0, 2.0 * M_PI);
+    } while(random.uniform() * (m_majorRadius + m_minorRadius)
+            > m_majorRadius + distance * qCos(angle));
+
+    double ring = m_majorRadius + distance * qCos(angle);
+    double around = random.uniform(0.0, 2.0 * M_PI);
+
+    p[0] = ring * qCos(around);
+    p[1] = ring * qSin(around);
+    p[2] = distance * qSin(angle);
+  }
 private:
+  bool m_surface;
   double m_majorRadius;
-  double m_majorRadiusSquared;
-  double m_minorRadiusSquared;
+  double m_minorRadius;
 };
 
-PointGenerator::PointGenerator(QObject *parent) :
-  QObject(parent), m_cancel(false)
+// Kilometer wide square of rolling terrain with blocks of buildings and
+// clusters of trees.  The layout is drawn from the seed; points are then
+// drawn independently of each other, so any prefix of a scene is an even
+// subsample of it.
+class BenchmarkScene
 {
-}
+public:
+  BenchmarkScene(quint64 seed)
+  {
+    // Own stream, apart from those of the blocks of points
+    Random random(seed, LayoutStream);
 
-PointCloud PointGenerator::createPointCloud(QString shape, int count, bool asSurface)
-{
-  QVector<float> points;
+    for(int i = 0; i < WaveCount; ++i)
+    {
+      Wave& wave = m_waves[i];
+      double angle = random.uniform(0.0, 2.0 * M_PI);
+      int octave = i/2;
+      double frequency = 2.0 * M_PI * (1 << octave)/400.0;
+      wave.x = frequency * qCos(angle);
+      wave.y = frequency * qSin(angle);
+      wave.phase = random.uniform(0.0, 2.0 * M_PI);
+      wave.amplitude = 20.0/(1 << octave);
+    }
 
-  float delta = 0.001;
+    for(int i = 0; i < BuildingCount; ++i)
+    {
+      Building& building = m_buildings[i];
+      building.x = random.uniform(-0.4, 0.4) * Size;
+      building.y = random.uniform(-0.4, 0.4) * Size;
+      building.width = random.uniform(10.0, 40.0);
+      building.depth = random.uniform(10.0, 40.0);
+      building.height = random.uniform(8.0, 60.0);
+      building.base = height(building.x, building.y);
+      building.gray = random.uniform(90.0, 200.0);
+    }
 
-  if(shape == "Cube")
+    for(int i = 0; i < TreeCount; ++i)
+    {
+      Tree& tree = m_trees[i];
+      tree.x = random.uniform(-0.5, 0.5) * Size;
+      tree.y = random.uniform(-0.5, 0.5) * Size;
+      tree.radius = random.uniform(2.0, 6.0);
+      tree.z = height(tree.x, tree.y) + random.uniform(2.0, 8.0) + tree.radius;
+    }
+  }
+
+  void operator()(Random& random, float *p, unsigned char *c) const
   {
-    if(!asSurface)
-      points = createPointVolume(count, Cube());
+    double kind = random.uniform();
+    if(kind < 0.6)
+      terrain(random, p, c);
+    else if(kind < 0.85)
+      building(random, p, c);
     else
-      points = createPointSurface(count, Cube(1.0 - delta), delta);
+      tree(random, p, c);
   }
-  if(shape == "Sphere")
+
+private:
+  static const quint64 LayoutStream = Q_UINT64_C(1) << 40;
+  static const int WaveCount = 12;
+  static const int BuildingCount = 300;
+  static const int TreeCount = 1500;
+  static const double Size;
+
+  struct Wave { double x, y, phase, amplitude; };
+  struct Building { double x, y, width, depth, height, base, gray; };
+  struct Tree { double x, y, z, radius; };
+
+  double height(double x, double y) const
   {
-    if(!asSurface)
-      points = createPointVolume(count, Sphere());
-    else
-      points = createPointSurface(count, Sphere(0.5 - delta), delta);
+    double z = 0.0;
+    for(int i = 0; i < WaveCount; ++i)
+    {
+      const Wave& wave = m_waves[i];
+      z += wave.amplitude * qSin(wave.x * x + wave.y * y + wave.phase);
+    }
+    return z;
   }
-  if(shape == "Torus")
+
+  static unsigned char channel(double value)
   {
-    if(!asSurface)
-      points = createPointVolume(count, Torus());
-    else
-      points = createPointSurface(count, Torus(0.3 - delta, 0.2 - delta), delta);
+    return qBound(0.0, value, 255.0);
   }
-  if(shape == "Cylinder")
+
+  void terrain(Random& random, float *p, unsigned char *c) const
   {
-    if(!asSurface)
-      points = createPointVolume(count, Cylinder());
-    else
-      points = createPointSurface(count, Cylinder(0.5 - delta), delta);
+    double x = random.uniform(-0.5, 0.5) * Size;
+    double y = random.uniform(-0.5, 0.5) * Size;
+    double z = height(x, y);
+
+    p[0] = x;
+    p[1] = y;
+    p[2] = z;
+
+    // Grass in the valleys to soil on the hills
+    double t = qBound(0.0, (z + 40.0)/80.0, 1.0);
+    double noise = random.uniform(-12.0, 12.0);
+    c[0] = channel(70 + 80 * t + noise);
+    c[1] = channel(120 - 20 * t + noise);
+    c[2] = channel(50 + 20 * t + noise);
   }
 
-  // Return resulting cloud
-  QVector<QVector3D> position;
+  void building(Random& random, float *p, unsigned char *c) const
+  {
+    const Building& b = m_buildings[random.bounded(BuildingCount)];
+
+    // Roof or walls in proportion to their area
+    double roof = b.width * b.depth;
+    double walls = 2.0 * (b.width + b.depth) * b.height;
+    double shade;
 
-  position.reserve(points.count()/3);
+    if(random.uniform() * (roof + walls) < roof)
+    {
+      p[0] = b.x + random.uniform(-0.5, 0.5) * b.width;
+      p[1] = b.y + random.uniform(-0.5, 0.5) * b.depth;
+      p[2] = b.base + b.height;
+      shade = 0.6;
+    } else {
+      // Walk around the walls; each side has its own shade
+      double t = random.uniform(0.0, 2.0 * (b.width + b.depth));
+      double x, y;
+      if(t < b.width)
+      {
+        x = t - b.width/2;
+        y = -b.depth/2;
+        shade = 1.0;
+      } else if(t < b.width + b.depth) {
+        x = b.width/2;
+        y = t - b.width - b.depth/2;
+        shade = 0.85;
+      } else if(t < 2.0 * b.width + b.depth) {
+        x = t - b.width - b.depth - b.width/2;
+        y = b.depth/2;
+        shade = 0.75;
+      } else {
+        x = -b.width/2;
+        y = t - 2.0 * b.width - b.depth - b.depth/2;
+        shade = 0.9;
+      }
+
+      p[0] = b.x + x;
+      p[1] = b.y + y;
+      p[2] = b.base + random.uniform(0.0, b.height);
+    }
 
-  for(int i = 0; i < points.count(); i += 3)
+    double noise = random.uniform(-6.0, 6.0);
+    c[0] = channel(b.gray * shade + noise);
+    c[1] = channel(b.gray * shade + noise);
+    c[2] = channel(b.gray * shade * 1.05 + noise);
+  }
+
+  void tree(Random& random, float *p, unsigned char *c) const
   {
-    position.push_back(QVector3D(points[i + 0],
-                                 points[i + 1],
-                                 points[i + 2]));
+    const Tree& t = m_trees[random.bounded(TreeCount)];
+
+    // Crown filling a slightly tall ellipsoid
+    double z = random.uniform(-1.0, 1.0);
+    double angle = random.uniform(0.0, 2.0 * M_PI);
+    double r = qSqrt(1.0 - z*z);
+    double radius = t.radius * std::cbrt(random.uniform());
+
+    p[0] = t.x + radius * r * qCos(angle);
+    p[1] = t.y + radius * r * qSin(angle);
+    p[2] = t.z + 1.3 * radius * z;
+
+    double light = random.uniform(0.6, 1.0);
+    c[0] = channel(40 * light);
+    c[1] = channel(110 * light + 30);
+    c[2] = channel(35 * light);
   }
 
-  return PointCloud(position);
+  Wave m_waves[WaveCount];
+  Building m_buildings[BuildingCount];
+  Tree m_trees[TreeCount];
+};
+
+const double BenchmarkScene::Size = 1000.0;
+
+PointGenerator::PointGenerator(QObject *parent) :
+  QObject(parent), m_seed(PointCloud::DefaultShuffleSeed), m_cancel(0)
+{
 }
 
-template <typename Shape>
-QVector<float> PointGenerator::createPointVolume(int count, Shape shape)
+PointCloud PointGenerator::createPointCloud(QString shape, int count, bool asSurface)
 {
-  QVector<float> result;
-  double x, y, z;
+  if(shape == "Cube")
+    return createPoints(count, Cube(asSurface));
+  if(shape == "Sphere")
+    return createPoints(count, Sphere(asSurface));
+  if(shape == "Torus")
+    return createPoints(count, Torus(asSurface));
+  if(shape == "Cylinder")
+    return createPoints(count, Cylinder(asSurface));
+
+  return PointCloud();
+}
 
+template <typename Sampler>
+PointCloud PointGenerator::createPoints(int count, Sampler sampler)
+{
   // Reset cancel state
-  m_cancel = false;
+  m_cancel.storeRelease(0);
 
   emit setRange(0, count);
 
-  int step = qMax(1.0, count/100.0);
+  PointCloud cloud(count);
+  float *points = cloud.pointData();
 
-  for(int i = 0; i < count; ++i)
-  {
-    do {
-      x = (double)qrand()/RAND_MAX - 0.5;
-      y = (double)qrand()/RAND_MAX - 0.5;
-      z = (double)qrand()/RAND_MAX - 0.5;
-    } while (shape(x,y,z) > 0.0);
+  QAtomicInt generated(0);
+  const int blocks = (count + GeneratorBlockSize - 1)/GeneratorBlockSize;
 
-    result.push_back(x);
-    result.push_back(y);
-    result.push_back(z);
+  Parallel::forEach(blocks, [&](int block) {
+    if(m_cancel.loadAcquire())
+      return;
 
-    if(i % step == 0)
-    {
-      emit progress(i);
-    }
+    Random random(m_seed, block);
+    int first = block * GeneratorBlockSize;
+    int last = qMin(count, first + GeneratorBlockSize);
 
-    if(m_cancel)
-      break;
-  }
+    for(int i = first; i < last; ++i)
+      sampler(random, points + (size_t)i * 3);
+
+    generated.fetchAndAddRelaxed(last - first);
+  }, [&]() {
+    // Progress is reported from the calling thread, which lets a modal
+    // progress dialog process a cancel
+    emit progress(generated.loadAcquire());
+  });
 
   emit progress(count);
 
-  return result;
+  if(m_cancel.loadAcquire())
+    return PointCloud();
+
+  return cloud;
 }
 
-template <typename Shape>
-QVector<float> PointGenerator::createPointSurface(int count, Shape shape, double delta)
+bool PointGenerator::writeBenchmarkScene(const QString &path, qint64 count)
 {
-  QVector<float> result;
-  double x, y, z;
+  // Reset cancel state
+  m_cancel.storeRelease(0);
 
-  // reset cancel state
-  m_cancel = false;
+  emit setRange(0, 100);
 
-  emit setRange(0, count);
+  const BenchmarkScene scene(m_seed);
 
-  int step = qMax(1.0, count/100.0);
+  bool native = path.endsWith(".nimbus", Qt::CaseInsensitive);
+  PLYWriter ply;
+  NimbusFile nimbus;
+  bool result;
 
-  for(int i = 0; i < count; ++i)
+  // Native files are read into a single PointCloud
+  if(native)
   {
-    do {
-      x = (double)qrand()/RAND_MAX - 0.5;
-      y = (double)qrand()/RAND_MAX - 0.5;
-      z = (double)qrand()/RAND_MAX - 0.5;
-    } while (qAbs(shape(x,y,z)) > delta);
+    result = count <= INT_MAX && nimbus.create(path, count, true);
+  } else {
+    ply.addComment(QString("Nimbus benchmark scene, seed %1").arg(m_seed));
+    result = ply.open(path, count, true);
+  }
 
-    result.push_back(x);
-    result.push_back(y);
-    result.push_back(z);
+  // Blocks are made in parallel a batch at a time and written in order
+  const qint64 blocks = (count + GeneratorBlockSize - 1)/GeneratorBlockSize;
+  const int batchSize = Parallel::threadCount() * 2;
+  QVector<PointCloud> batch(batchSize);
+  PointCloud *batchData = batch.data();
 
-    if(i % step == 0)
-    {
-      emit progress(i);
-    }
+  for(qint64 firstBlock = 0; result && firstBlock < blocks;
+      firstBlock += batchSize)
+  {
+    int n = qMin((qint64)batchSize, blocks - firstBlock);
+
+    Parallel::forEach(n, [&](int i) {
+      qint64 block = firstBlock + i;
+      qint64 first = block * GeneratorBlockSize;
+      int size = qMin((qint64)GeneratorBlockSize, count - first);
+
+      PointCloud points(size, true);
+      float *p = points.pointData();
+      unsigned char *c = points.colorData();
+
+      Random random(m_seed, block);
+      for(int j = 0; j < size; ++j)
+        scene(random, p + (size_t)j * 3, c + (size_t)j * 3);
 
-    if(m_cancel)
-      break;
+      batchData[i] = points;
+    });
+
+    for(int i = 0; result && i < n; ++i)
+      result = native ? nimbus.append(batch.at(i)) : ply.write(batch.at(i));
+
+    emit progress(100.0 * (firstBlock + n)/blocks);
+
+    if(m_cancel.loadAcquire())
+      result = false;
   }
 
-  emit progress(count);
+  // Unless committed, nothing is left behind
+  if(result)
+    result = native ? nimbus.commit() : ply.close();
+
+  emit progress(100);
 
   return result;
 }
 
 void PointGenerator::cancel()
 {
-  m_cancel = true;
+  m_cancel.storeRelease(1);
 }
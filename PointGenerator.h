@@ -3,8 +3,13 @@
 
 #include <QObject>
 #include <QVector>
+#include <QAtomicInt>
 #include "PointCloud.h"
+#include "Random.h"
 
+// Generates synthetic clouds of unit sized shapes.  Points are sampled
+// directly on or in the shape, in parallel over blocks with a random stream
+// each, so a seed always gives the same cloud.
 class PointGenerator : public QObject
 {
   Q_OBJECT
@@ -12,11 +17,18 @@ public:
   explicit PointGenerator(QObject *parent = 0);
   PointCloud createPointCloud(QString shape, int count, bool asSurface);
 
-  template <typename Shape>
-  QVector<float> createPointVolume(int count, Shape shape);
+  void setSeed(quint64 seed) { m_seed = seed; }
 
-  template <typename Shape>
-  QVector<float> createPointSurface(int count, Shape shape, double delta);
+  // Writes a benchmark scene of terrain, buildings and trees with colors
+  // straight to a file, native if path ends in .nimbus and PLY otherwise,
+  // without holding it in memory.  The same seed and count always give the
+  // same bytes.  Returns false if canceled or writing failed.
+  bool writeBenchmarkScene(const QString& path, qint64 count);
+
+  // Fills count points by calling sampler(random, xyz) for each, writing
+  // straight into the cloud.  Returns an empty cloud if canceled.
+  template <typename Sampler>
+  PointCloud createPoints(int count, Sampler sampler);
 
 signals:
   void progress(int);
@@ -26,7 +38,8 @@ public slots:
   void cancel();
 
 private:
-  bool m_cancel;
+  quint64 m_seed;
+  QAtomicInt m_cancel;
 };
 
 #endif // POINTGENERATOR_H
@@ -0,0 +1,377 @@
+#include "PointShader.h"
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLVertexArrayObject>
+#include <QMatrix4x4>
+#include <QDebug>
+
+// Compatibility profile enums missing from older headers
+#ifndef GL_VERTEX_PROGRAM_POINT_SIZE
+#define GL_VERTEX_PROGRAM_POINT_SIZE 0x8642
+#endif
+#ifndef GL_POINT_SPRITE
+#define GL_POINT_SPRITE 0x8861
+#endif
+
+#ifndef GL_CLIP_DISTANCE0
+#define GL_CLIP_DISTANCE0 0x3000
+#define GL_CLIP_DISTANCE1 0x3001
+#endif
+
+// Fixed so vertex arrays work with both programs
+static const int PositionLocation = 0;
+static const int ColorLocation = 1;
+
+// GLSL 1.20 runs on every context QGLViewer can use, including legacy
+// contexts on OS X.  Single pass stereo needs 1.30 for clip distances and
+// instancing; instance 1 is the second eye, moved into the other half of
+// the viewport.
+static const char *MonoHeader =
+    "#version 120\n";
+
+static const char *StereoHeader =
+    "#version 130\n"
+    "#extension GL_ARB_draw_instanced : enable\n"
+    "#define STEREO\n";
+
+// Picking writes one plus the point's id as four bytes of color; vertex ids
+// need GLSL 1.30
+static const char *PickHeader =
+    "#version 130\n"
+    "#define PICK\n";
+
+static const char *VertexShader =
+    "attribute vec3 position;\n"
+    "attribute vec3 color;\n"
+    "uniform mat4 modelView;\n"
+    "uniform mat4 projection;\n"
+    "uniform float pointSize;\n"
+    "uniform float referenceDepth;\n"
+    "uniform bool useColor;\n"
+    "varying vec3 pointColor;\n"
+    "#ifdef PICK\n"
+    "uniform int pickBase;\n"
+    "varying vec4 pickColor;\n"
+    "#endif\n"
+    "#ifdef STEREO\n"
+    "uniform mat4 secondModelView;\n"
+    "uniform mat4 secondProjection;\n"
+    "uniform bool vertical;\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "#ifdef STEREO\n"
+    "  bool second = gl_InstanceIDARB == 1;\n"
+    "  vec4 eye = (second ? secondModelView : modelView) * vec4(position, 1.0);\n"
+    "  vec4 clip = (second ? secondProjection : projection) * eye;\n"
+    "  float across = vertical ? clip.y : clip.x;\n"
+    "  gl_ClipDistance[0] = clip.w + across;\n"
+    "  gl_ClipDistance[1] = clip.w - across;\n"
+    "  across = 0.5 * across + (second ? 0.5 : -0.5) * clip.w;\n"
+    "  if(vertical)\n"
+    "    clip.y = across;\n"
+    "  else\n"
+    "    clip.x = across;\n"
+    "  gl_Position = clip;\n"
+    "#else\n"
+    "  vec4 eye = modelView * vec4(position, 1.0);\n"
+    "  gl_Position = projection * eye;\n"
+    "#endif\n"
+    "  float size = pointSize;\n"
+    "  if(referenceDepth > 0.0)\n"
+    "    size *= referenceDepth/max(-eye.z, 1e-6);\n"
+    "  gl_PointSize = clamp(size, 1.0, 4.0 * pointSize);\n"
+    "  pointColor = useColor ? clamp(color, 0.0, 1.0) : vec3(1.0);\n"
+    "#ifdef PICK\n"
+    "  int id = pickBase + gl_VertexID + 1;\n"
+    "  pickColor = vec4(id & 255, (id >> 8) & 255, (id >> 16) & 255,\n"
+    "                   (id >> 24) & 255)/255.0;\n"
+    "#endif\n"
+    "}\n";
+
+static const char *FragmentShader =
+    "uniform bool roundPoints;\n"
+    "varying vec3 pointColor;\n"
+    "#ifdef PICK\n"
+    "varying vec4 pickColor;\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "  vec2 offset = 2.0 * gl_PointCoord - 1.0;\n"
+    "  if(roundPoints && dot(offset, offset) > 1.0)\n"
+    "    discard;\n"
+    "#ifdef PICK\n"
+    "  gl_FragColor = pickColor;\n"
+    "#else\n"
+    "  gl_FragColor = vec4(pointColor, 1.0);\n"
+    "#endif\n"
+    "}\n";
+
+PointShader::VertexArray::VertexArray() : m_object(NULL), m_vertices(0),
+  m_colors(0), m_positionType(0)
+{
+}
+
+PointShader::VertexArray::~VertexArray()
+{
+  // Context is current wherever buffers are deleted
+  delete m_object;
+}
+
+PointShader::PointShader() : m_stereoProgram(NULL), m_pickProgram(NULL),
+  m_functions(NULL), m_drawArraysInstanced(NULL), m_multiDrawArrays(NULL),
+  m_stereo(false),
+  m_vertical(false), m_picking(false)
+{
+}
+
+PointShader::~PointShader()
+{
+  delete m_stereoProgram;
+  delete m_pickProgram;
+}
+
+bool PointShader::create()
+{
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  if(!context || !QGLShaderProgram::hasOpenGLShaderPrograms())
+    return false;
+
+  // Vertex arrays are core in 3.0 and extensions before
+  QOpenGLVertexArrayObject test;
+  if(!test.create())
+    return false;
+  test.destroy();
+
+  if(!link(m_program, MonoHeader))
+    return false;
+
+  m_functions = context->functions();
+
+  // Core since 1.4, but not exported by every OpenGL library
+  m_multiDrawArrays = (MultiDrawArrays)
+      context->getProcAddress("glMultiDrawArrays");
+
+  // Picking and single pass stereo are optional
+  if(!context->isOpenGLES() && context->format().version() >= qMakePair(3, 0))
+  {
+    m_pickProgram = new QGLShaderProgram;
+    if(!link(*m_pickProgram, PickHeader))
+    {
+      delete m_pickProgram;
+      m_pickProgram = NULL;
+    }
+  }
+
+  bool instancing = context->format().version() >= qMakePair(3, 1)
+      || context->hasExtension("GL_ARB_draw_instanced");
+  if(!context->isOpenGLES() && context->format().version() >= qMakePair(3, 0)
+     && instancing)
+  {
+    m_drawArraysInstanced = (DrawArraysInstanced)
+        context->getProcAddress("glDrawArraysInstanced");
+    if(!m_drawArraysInstanced)
+      m_drawArraysInstanced = (DrawArraysInstanced)
+          context->getProcAddress("glDrawArraysInstancedARB");
+
+    m_stereoProgram = new QGLShaderProgram;
+    if(!m_drawArraysInstanced || !link(*m_stereoProgram, StereoHeader))
+    {
+      delete m_stereoProgram;
+      m_stereoProgram = NULL;
+    }
+  }
+
+  return true;
+}
+
+bool PointShader::link(QGLShaderProgram &program, const char *header)
+{
+  QByteArray vertex = QByteArray(header) + VertexShader;
+  QByteArray fragment = QByteArray(header) + FragmentShader;
+
+  program.bindAttributeLocation("position", PositionLocation);
+  program.bindAttributeLocation("color", ColorLocation);
+
+  if(!program.addShaderFromSourceCode(QGLShader::Vertex, vertex)
+     || !program.addShaderFromSourceCode(QGLShader::Fragment, fragment)
+     || !program.link())
+  {
+    qDebug() << "Point shader failed:" << program.log();
+    return false;
+  }
+
+  return true;
+}
+
+void PointShader::setStereo(const QMatrix4x4 &secondView,
+                            const QMatrix4x4 &secondProjection, bool vertical)
+{
+  m_stereo = m_stereoProgram != NULL;
+  m_secondView = secondView;
+  m_secondProjection = secondProjection;
+  m_vertical = vertical;
+}
+
+void PointShader::clearStereo()
+{
+  m_stereo = false;
+}
+
+void PointShader::setPicking(bool picking)
+{
+  m_picking = picking && m_pickProgram;
+}
+
+void PointShader::setPickBase(int base)
+{
+  if(m_picking)
+    m_pickProgram->setUniformValue("pickBase", base);
+}
+
+QGLShaderProgram &PointShader::program()
+{
+  if(m_picking)
+    return *m_pickProgram;
+
+  return m_stereo ? *m_stereoProgram : m_program;
+}
+
+void PointShader::bind(float pointSize, float referenceDepth, bool round,
+                       bool color)
+{
+  GLfloat modelView[16];
+  GLfloat projection[16];
+  glGetFloatv(GL_MODELVIEW_MATRIX, modelView);
+  glGetFloatv(GL_PROJECTION_MATRIX, projection);
+
+  // Column major from OpenGL
+  QMatrix4x4 modelViewMatrix = QMatrix4x4(modelView).transposed();
+
+  QGLShaderProgram& program = this->program();
+  program.bind();
+  program.setUniformValue("modelView", modelViewMatrix);
+  program.setUniformValue("projection", QMatrix4x4(projection).transposed());
+  program.setUniformValue("pointSize", pointSize);
+  program.setUniformValue("referenceDepth", referenceDepth);
+  program.setUniformValue("roundPoints", round);
+  program.setUniformValue("useColor", color);
+
+  if(m_picking)
+  {
+    program.setUniformValue("pickBase", 0);
+  }
+  else if(m_stereo)
+  {
+    program.setUniformValue("secondModelView", m_secondView * modelViewMatrix);
+    program.setUniformValue("secondProjection", m_secondProjection);
+    program.setUniformValue("vertical", m_vertical);
+
+    glEnable(GL_CLIP_DISTANCE0);
+    glEnable(GL_CLIP_DISTANCE1);
+  }
+
+  // Sizes come from the shader; sprites give gl_PointCoord
+  glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+  glEnable(GL_POINT_SPRITE);
+}
+
+void PointShader::release()
+{
+  glDisable(GL_POINT_SPRITE);
+  glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+
+  if(m_stereo && !m_picking)
+  {
+    glDisable(GL_CLIP_DISTANCE0);
+    glDisable(GL_CLIP_DISTANCE1);
+  }
+
+  program().release();
+}
+
+void PointShader::draw(VertexArray &array, QGLBuffer &vertices,
+                       QGLBuffer &colors, GLenum positionType, int first,
+                       int count)
+{
+  if(count <= 0)
+    return;
+
+  GLint firsts[1] = { first };
+  GLsizei counts[1] = { count };
+  draw(array, vertices, colors, positionType, firsts, counts, 1);
+}
+
+void PointShader::draw(VertexArray &array, QGLBuffer &vertices,
+                       QGLBuffer &colors, GLenum positionType,
+                       const GLint *first, const GLsizei *count, int ranges)
+{
+  if(!vertices.isCreated() || ranges <= 0)
+    return;
+
+  if(!setUp(array, vertices, colors, positionType))
+    return;
+
+  array.m_object->bind();
+  if(m_stereo && !m_picking)
+  {
+    // Multiple instanced draws need indirect drawing
+    for(int i = 0; i < ranges; ++i)
+      m_drawArraysInstanced(GL_POINTS, first[i], count[i], 2);
+  } else if(m_multiDrawArrays && ranges > 1) {
+    m_multiDrawArrays(GL_POINTS, first, count, ranges);
+  } else {
+    for(int i = 0; i < ranges; ++i)
+      glDrawArrays(GL_POINTS, first[i], count[i]);
+  }
+  array.m_object->release();
+}
+
+bool PointShader::setUp(VertexArray &array, QGLBuffer &vertices,
+                        QGLBuffer &colors, GLenum positionType)
+{
+  GLuint colorId = colors.isCreated() ? colors.bufferId() : 0;
+  if(array.m_object && array.m_vertices == vertices.bufferId()
+     && array.m_colors == colorId && array.m_positionType == positionType)
+    return true;
+
+  if(!array.m_object)
+  {
+    array.m_object = new QOpenGLVertexArrayObject;
+    if(!array.m_object->create())
+    {
+      delete array.m_object;
+      array.m_object = NULL;
+      return false;
+    }
+  }
+
+  array.m_object->bind();
+
+  // Compact positions are dequantized by the model view matrix, so they
+  // are read as plain integers
+  vertices.bind();
+  m_functions->glEnableVertexAttribArray(PositionLocation);
+  m_functions->glVertexAttribPointer(PositionLocation, 3, positionType,
+                                     GL_FALSE, 0, 0);
+  vertices.release();
+
+  // Without color, positions double as colors like the fixed-function path
+  if(colorId)
+    colors.bind();
+  else
+    vertices.bind();
+  m_functions->glEnableVertexAttribArray(ColorLocation);
+  m_functions->glVertexAttribPointer(ColorLocation, 3,
+                                     colorId ? GL_UNSIGNED_BYTE : positionType,
+                                     GL_TRUE, 0, 0);
+  QGLBuffer::release(QGLBuffer::VertexBuffer);
+
+  array.m_object->release();
+
+  array.m_vertices = vertices.bufferId();
+  array.m_colors = colorId;
+  array.m_positionType = positionType;
+
+  return true;
+}
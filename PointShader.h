@@ -0,0 +1,107 @@
+#ifndef POINTSHADER_H
+#define POINTSHADER_H
+
+#include <QGLBuffer>
+#include <QGLShaderProgram>
+#include <QMatrix4x4>
+#include <QOpenGLFunctions>
+
+class QOpenGLVertexArrayObject;
+
+// Shader renderer for point buffers.  Positions and colors are read through
+// vertex array objects set up once per pair of buffers instead of client
+// state pointers each draw.  Points are drawn as sprites, round when smooth,
+// and shrink with distance in perspective views.  Matrices are taken from
+// the fixed-function stacks, so QGLViewer's camera, the turntable and other
+// transforms apply unchanged.
+class PointShader
+{
+public:
+  // Vertex array recording the buffers of a cloud or an octree node; rebuilt
+  // when the buffers are reallocated
+  class VertexArray
+  {
+  public:
+    VertexArray();
+    ~VertexArray();
+
+    // Buffer names are reused by the driver, so reallocating a buffer has
+    // to be signalled
+    void invalidate() { m_vertices = 0; }
+
+  private:
+    Q_DISABLE_COPY(VertexArray)
+    friend class PointShader;
+
+    QOpenGLVertexArrayObject *m_object;
+    GLuint m_vertices;
+    GLuint m_colors;
+    GLenum m_positionType;
+  };
+
+  PointShader();
+  ~PointShader();
+
+  // Compiles the program with the context current; false if shaders or
+  // vertex arrays aren't supported
+  bool create();
+
+  // Single pass stereo, if supported: each draw is instanced for a second
+  // eye whose view is secondView times that of the first.  The first eye
+  // goes to the left or bottom half of the viewport, the second to the
+  // other half.
+  bool supportsStereo() const { return m_stereoProgram != NULL; }
+  void setStereo(const QMatrix4x4& secondView,
+                 const QMatrix4x4& secondProjection, bool vertical);
+  void clearStereo();
+
+  // Picking, if supported, draws ids instead of colors: one plus the base
+  // plus the index of the point in its buffer, least significant byte in
+  // red.  Zero is left for the background.  Takes precedence over stereo.
+  bool supportsPicking() const { return m_pickProgram != NULL; }
+  void setPicking(bool picking);
+  // Ids of following draws start at base; only while bound
+  void setPickBase(int base);
+
+  // Size is in pixels at referenceDepth from the eye; a depth of zero draws
+  // every point at the same size
+  void bind(float pointSize, float referenceDepth, bool round, bool color);
+  void release();
+
+  // Draws count points from first; colors are taken from positions when
+  // the color buffer isn't created
+  void draw(VertexArray& array, QGLBuffer& vertices, QGLBuffer& colors,
+            GLenum positionType, int first, int count);
+  // Draws count[i] points from first[i] for each of ranges, in a single
+  // call where supported
+  void draw(VertexArray& array, QGLBuffer& vertices, QGLBuffer& colors,
+            GLenum positionType, const GLint *first, const GLsizei *count,
+            int ranges);
+
+private:
+  typedef void (QOPENGLF_APIENTRYP DrawArraysInstanced)(GLenum, GLint, GLsizei,
+                                                      GLsizei);
+  typedef void (QOPENGLF_APIENTRYP MultiDrawArrays)(GLenum, const GLint *,
+                                                  const GLsizei *, GLsizei);
+
+  static bool link(QGLShaderProgram& program, const char *header);
+  QGLShaderProgram& program();
+  bool setUp(VertexArray& array, QGLBuffer& vertices, QGLBuffer& colors,
+             GLenum positionType);
+
+  QGLShaderProgram m_program;
+  QGLShaderProgram *m_stereoProgram;
+  QGLShaderProgram *m_pickProgram;
+  QOpenGLFunctions *m_functions;
+  DrawArraysInstanced m_drawArraysInstanced;
+  MultiDrawArrays m_multiDrawArrays;
+
+  bool m_stereo;
+  QMatrix4x4 m_secondView;
+  QMatrix4x4 m_secondProjection;
+  bool m_vertical;
+
+  bool m_picking;
+};
+
+#endif // POINTSHADER_H
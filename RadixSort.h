@@ -0,0 +1,80 @@
+#ifndef RADIXSORT_H
+#define RADIXSORT_H
+
+#include <QtGlobal>
+#include <vector>
+#include <algorithm>
+#include "Parallel.h"
+
+namespace RadixSort
+{
+  // Bits sorted per pass and keys per block of a pass
+  const int DigitBits = 11;
+  const int BlockSize = 1 << 20;
+
+  // Sorts keys with the value at the same index carried along, in parallel
+  // least significant digit first.  The sort is stable, and only the low
+  // keyBits bits of keys are looked at, so narrow keys take fewer passes.
+  // Passes over a digit all keys share are skipped.
+  inline void sort(std::vector<quint64>& keys, std::vector<quint32>& values,
+                   int keyBits = 64)
+  {
+    const int count = keys.size();
+    const int buckets = 1 << DigitBits;
+    const int blocks = (count + BlockSize - 1)/BlockSize;
+    if(count < 2)
+      return;
+
+    std::vector<quint64> keyBuffer(count);
+    std::vector<quint32> valueBuffer(count);
+    std::vector<int> offsets((size_t)blocks * buckets);
+
+    for(int shift = 0; shift < keyBits; shift += DigitBits)
+    {
+      // Keys per digit in each block
+      Parallel::forEach(blocks, [&](int block) {
+        int *counts = &offsets[(size_t)block * buckets];
+        std::fill(counts, counts + buckets, 0);
+        int last = qMin(count, (block + 1) * BlockSize);
+        for(int i = block * BlockSize; i < last; ++i)
+          ++counts[(keys[i] >> shift) & (buckets - 1)];
+      });
+
+      // Digits are laid out one after another; within a digit, blocks are
+      // in order, which keeps the sort stable
+      int offset = 0;
+      bool shared = false;
+      for(int digit = 0; digit < buckets; ++digit)
+      {
+        int start = offset;
+        for(int block = 0; block < blocks; ++block)
+        {
+          int& entry = offsets[(size_t)block * buckets + digit];
+          int n = entry;
+          entry = offset;
+          offset += n;
+        }
+        shared = shared || offset - start == count;
+      }
+
+      if(shared)
+        continue;
+
+      Parallel::forEach(blocks, [&](int block) {
+        int *next = &offsets[(size_t)block * buckets];
+        int last = qMin(count, (block + 1) * BlockSize);
+        for(int i = block * BlockSize; i < last; ++i)
+        {
+          int j = next[(keys[i] >> shift) & (buckets - 1)]++;
+          keyBuffer[j] = keys[i];
+          valueBuffer[j] = values[i];
+        }
+      });
+
+      keys.swap(keyBuffer);
+      values.swap(valueBuffer);
+    }
+  }
+}
+
+#endif // RADIXSORT_H
@@ -0,0 +1,83 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <QtGlobal>
+
+// Fast 64-bit generator (xoshiro256**) seeded through splitmix64.  Unlike
+// qrand() it has the same full range on every platform, and a seed gives the
+// same sequence everywhere, so shuffles and generated clouds can be
+// reproduced.  Streams of one seed are independent; use one per parallel
+// task.
+class Random
+{
+public:
+  explicit Random(quint64 seed = 0, quint64 stream = 0)
+  {
+    quint64 s = mix(seed) ^ mix(stream + Q_UINT64_C(0x632be59bd9b4e019));
+    for(int i = 0; i < 4; ++i)
+      m_state[i] = mix(s + i);
+  }
+
+  quint64 next()
+  {
+    quint64 result = rotate(m_state[1] * 5, 7) * 9;
+    quint64 t = m_state[1] << 17;
+
+    m_state[2] ^= m_state[0];
+    m_state[3] ^= m_state[1];
+    m_state[1] ^= m_state[2];
+    m_state[0] ^= m_state[3];
+    m_state[2] ^= t;
+    m_state[3] = rotate(m_state[3], 45);
+
+    return result;
+  }
+
+  // Uniform in [0, n) without modulo bias
+  quint32 bounded(quint32 n)
+  {
+    quint64 m = (next() >> 32) * n;
+    quint32 low = (quint32)m;
+    if(low < n)
+    {
+      quint32 threshold = (0u - n) % n;
+      while(low < threshold)
+      {
+        m = (next() >> 32) * n;
+        low = (quint32)m;
+      }
+    }
+    return m >> 32;
+  }
+
+  // Uniform in [0, 1)
+  double uniform()
+  {
+    return (next() >> 11) * (1.0/(Q_UINT64_C(1) << 53));
+  }
+
+  // Uniform in [min, max)
+  double uniform(double min, double max)
+  {
+    return min + (max - min) * uniform();
+  }
+
+  // splitmix64 finalizer; hashes e.g. an index to a well mixed value
+  static quint64 mix(quint64 x)
+  {
+    quint64 z = x + Q_UINT64_C(0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * Q_UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * Q_UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+  }
+
+private:
+  static quint64 rotate(quint64 x, int k)
+  {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  quint64 m_state[4];
+};
+
+#endif // RANDOM_H
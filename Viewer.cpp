@@ -1,11 +1,22 @@
 #include "Viewer.h"
+#include "KdTree.h"
 #include <QDebug>
 #include <QVector3D>
+#include <QMatrix4x4>
 #include <QtCore/qmath.h>
 #include <QAction>
 #include <QGLShaderProgram>
 #include <QGLShader>
 #include <QKeyEvent>
+#include <QOpenGLContext>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QApplication>
+#include <queue>
+#include <algorithm>
+#include <cfloat>
+#include <climits>
 // For pi constant
 #include <cmath>
 
@@ -16,27 +27,92 @@ using namespace qglviewer;
 #define GL_MULTISAMPLE  0x809D
 #endif
 
+// Memory queries from GL_NVX_gpu_memory_info and GL_ATI_meminfo
+#ifndef GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX
+#define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+#ifndef GL_VBO_FREE_MEMORY_ATI
+#define GL_VBO_FREE_MEMORY_ATI 0x87FB
+#endif
+
+// Points converted per block when quantizing positions for upload
+static const int QuantizeBlockSize = 1 << 20;
+
+// Smallest slice drawn per frame by progressive refinement
+static const int MinRefinementSlice = 100000;
+
+// Interaction point count at start and its lower limit
+static const int DefaultInteractionBudget = 250000;
+static const int MinInteractionBudget = 10000;
+
+// Largest chunk of a flat cloud tested against the view
+static const int ChunkSize = 1 << 16;
+
+// Side in pixels of the window around the cursor searched when picking
+static const int PickWindow = 15;
+
+// Octree nodes uploaded per frame; more are picked up on following frames
+static const int MaxNodeUploadsPerFrame = 16;
+// GPU memory for octree nodes when the driver doesn't report any
+static const qint64 DefaultLevelOfDetailMemory = 512 * 1024 * 1024;
+
 Viewer::Viewer(QWidget *parent) :
   QGLViewer(parent),
+  m_pointShader(NULL),
+  m_eyeDomeLighting(NULL),
+  m_eyeDomeLightingEnabled(false),
+  m_eyeDomeStrength(1.0),
+  m_eyeDomeRadius(1.4),
   m_vertexCount(0),
+  m_vertexFormat(AutomaticFormat),
+  m_compactPositions(false),
+  m_spatialOrder(false),
+  m_frustumCulling(true),
+  m_dequantizeScale(1.0, 1.0, 1.0),
+  m_detectedGPUMemory(0),
+  m_gpuMemoryBudget(0),
+  m_hostMemoryBudget(0),
+  m_levelOfDetail(false),
+  m_pointBudget(3000000),
+  m_octree(NULL),
+  m_octreeReady(false),
+  m_nodeBufferMemory(0),
+  m_frameCount(0),
+  m_pointsDrawn(0),
+  m_refinementBuffer(NULL),
+  m_refinedPoints(0),
+  m_preview(false),
   m_density(1.0),
   m_pointSize(1.0),
   m_smoothPoints(true),
   m_fastInteraction(false),
-  m_fastInteractionMax(250000),
+  m_targetFrameRate(30),
+  m_interactionBudget(DefaultInteractionBudget),
+  m_interactionFrameMs(0.0),
+  m_performanceOverlay(false),
   m_swapLeftRight(false),
   m_stereo(false),
+  m_singlePassStereo(true),
+  m_stereoBuffer(NULL),
+  m_pickBuffer(NULL),
+  m_picking(false),
+  m_measureMode(NoMeasure),
   m_showLogo(true),
   m_turntableRPM(1.0),
   m_turntableStarted(false)
 {
   setAutoFillBackground(false);
   setKeyDescription(Qt::Key_P, "Toggle smooth points");
+  setKeyDescription(Qt::Key_E, "Toggle eye-dome lighting");
   setKeyDescription(Qt::Key_R, "Restore default view");
   setKeyDescription(Qt::Key_T, "Toggle turntable animation");
   setKeyDescription(Qt::Key_T + Qt::SHIFT, "Reset turntable");
   setKeyDescription(Qt::Key_Minus, "Decrease turntable speed");
   setKeyDescription(Qt::Key_Plus, "Increase turntable speed");
+  setKeyDescription(Qt::Key_F + Qt::SHIFT, "Toggle performance overlay");
+  setKeyDescription(Qt::Key_Escape, "Clear measurement");
+  setMouseBindingDescription(Qt::ShiftModifier, Qt::LeftButton,
+                             "Pick point for measurement", false);
   setShortcut(EXIT_VIEWER, 0);
 
   // Load logo pixmap at 150x172.  QIcon will return a retina quality version
@@ -51,27 +127,71 @@ Viewer::Viewer(QWidget *parent) :
     setStereoMode(Hardware);
   else
     setStereoMode(Red_Cyan);
+
+  // Stop octree builds before threads are waited on at exit
+  connect(qApp, SIGNAL(aboutToQuit()), SLOT(releaseOctree()));
+}
+
+Viewer::~Viewer()
+{
+  releaseOctree();
+
+  // Buffers and queries belong to the context
+  makeCurrent();
+  clearNodeBuffers();
+  m_frameStatistics.release();
+  delete m_refinementBuffer;
+  delete m_stereoBuffer;
+  delete m_pickBuffer;
+  delete m_pointShader;
+  delete m_eyeDomeLighting;
 }
 
 bool Viewer::setPointCloud(const PointCloud &cloud)
 {
   m_pointCloud = cloud;
 
-  if(!bindToVertexBuffer(cloud.pointData()))
-    return false;
+  releaseOctree();
+  clearNodeBuffers();
 
-  if(cloud.hasColor())
+  // Switch to level of detail when not even compact buffers would fit, in
+  // the budget or in the int sizes buffers are allocated with
+  qint64 compactSize = (qint64)cloud.count()
+      * (3 * sizeof(GLshort) + (cloud.hasColor() ? 3 : 0));
+  bool levelOfDetail = m_levelOfDetail
+      || (gpuMemoryBudget() > 0 && compactSize > gpuMemoryBudget())
+      || (qint64)cloud.count() * 3 * sizeof(GLshort) > INT_MAX;
+
+  m_chunks.clear();
+  if(!levelOfDetail)
+    arrangePointCloud();
+
+  if(!levelOfDetail && !uploadPointCloud(m_pointCloud))
+  {
+    qDebug() << "Failed uploading point cloud; using level of detail.";
+    levelOfDetail = true;
+
+    m_pointCloud = cloud;
+    m_chunks.clear();
+  }
+
+  if(levelOfDetail)
   {
-    if(!loadColorsToBuffer(cloud.colorDataF()))
+    // Keep showing the preview, if any, until the octree is ready
+    if(!m_preview)
     {
-      qDebug() << "Failed loading color data.";
-      return false;
+      m_vertexBuffer.destroy();
+      m_colorBuffer.destroy();
+      m_vertexCount = 0;
     }
-  } else {
-    if(m_colorBuffer.isCreated())
+
+    if(!m_levelOfDetail)
     {
-      m_colorBuffer.destroy();
+      m_levelOfDetail = true;
+      emit levelOfDetailChanged(true);
     }
+
+    buildOctree();
   }
 
   QVector3D min = cloud.boundingBoxMinimum();
@@ -80,7 +200,56 @@ bool Viewer::setPointCloud(const PointCloud &cloud)
   setSceneBoundingBox(qglviewer::Vec(min.x(), min.y(), min.z()),
                       qglviewer::Vec(max.x(), max.y(), max.z()));
 
+  // Keep the view the user may have navigated to during a preview
+  if(!m_preview)
+    showEntireScene();
+  m_preview = false;
+
+  setPointDensity(100);
+
+  notifyStereoParametersChanged();
+
+  return true;
+}
+
+bool Viewer::openOctree(const QString &path)
+{
+  Octree *octree = new Octree(this);
+  if(!octree->open(path))
+  {
+    delete octree;
+    return false;
+  }
+
+  releaseOctree();
+  clearNodeBuffers();
+
+  // Points stay on disk; nodes are drawn as they are read
+  m_pointCloud = PointCloud();
+  m_chunks.clear();
+  m_vertexBuffer.destroy();
+  m_colorBuffer.destroy();
+  m_vertexCount = 0;
+  m_preview = false;
+
+  m_octree = octree;
+  m_octree->setHostMemoryBudget(m_hostMemoryBudget);
+  m_octreeReady = true;
+  connect(m_octree, SIGNAL(nodeLoaded(int)), SLOT(update()));
+
+  if(!m_levelOfDetail)
+  {
+    m_levelOfDetail = true;
+    emit levelOfDetailChanged(true);
+  }
+
+  QVector3D min = octree->boundingBoxMinimum();
+  QVector3D max = octree->boundingBoxMaximum();
+
+  setSceneBoundingBox(qglviewer::Vec(min.x(), min.y(), min.z()),
+                      qglviewer::Vec(max.x(), max.y(), max.z()));
   showEntireScene();
+
   setPointDensity(100);
 
   notifyStereoParametersChanged();
@@ -88,6 +257,95 @@ bool Viewer::setPointCloud(const PointCloud &cloud)
   return true;
 }
 
+void Viewer::beginPointCloud(int count, bool hasColor)
+{
+  m_pointCloud = PointCloud();
+  m_chunks.clear();
+  releaseOctree();
+  clearNodeBuffers();
+  m_vertexCount = 0;
+  m_preview = true;
+
+  // Bounds aren't known yet, so the preview can't be quantized; only show as
+  // much as fits the budget at full precision
+  m_compactPositions = false;
+  int bytesPerPoint = 3 * sizeof(float) + (hasColor ? 3 : 0);
+  if(gpuMemoryBudget() > 0)
+    count = qMin((qint64)count, gpuMemoryBudget()/bytesPerPoint);
+
+  // Buffer sizes are ints; a larger preview is cut short rather than
+  // allocated with a wrapped size
+  count = qMin(count, INT_MAX/(3 * (int)sizeof(float)));
+
+  // Allocate full size buffers up front; chunks are written in place
+  if(!allocateBuffer(m_vertexBuffer, NULL, count * 3 * sizeof(float)))
+  {
+    m_preview = false;
+    return;
+  }
+
+  if(hasColor)
+  {
+    if(!allocateBuffer(m_colorBuffer, NULL, count * 3))
+      m_colorBuffer.destroy();
+  } else if(m_colorBuffer.isCreated()) {
+    m_colorBuffer.destroy();
+  }
+
+  update();
+}
+
+void Viewer::appendPoints(int first, const PointCloud &chunk)
+{
+  if(!m_preview || !m_vertexBuffer.isCreated() || chunk.count() == 0)
+    return;
+
+  // Ignore anything beyond the allocated size
+  if(((qint64)first + chunk.count()) * 3 * sizeof(float)
+     > (quint64)m_vertexBuffer.size())
+    return;
+
+  makeCurrent();
+
+  m_vertexBuffer.bind();
+  m_vertexBuffer.write(first * 3 * sizeof(float), chunk.pointData(),
+                       chunk.count() * 3 * sizeof(float));
+  m_vertexBuffer.release();
+
+  if(chunk.hasColor() && m_colorBuffer.isCreated())
+  {
+    m_colorBuffer.bind();
+    m_colorBuffer.write(first * 3, chunk.colorData(), chunk.count() * 3);
+    m_colorBuffer.release();
+  }
+
+  // Chunks arrive in order, so everything up to here is valid
+  m_vertexCount = qMax(m_vertexCount, first + chunk.count());
+
+  // Grow scene to include chunk; fit view to the first one
+  QVector3D min = chunk.boundingBoxMinimum();
+  QVector3D max = chunk.boundingBoxMaximum();
+  if(first == 0)
+  {
+    m_previewMin = min;
+    m_previewMax = max;
+  } else {
+    m_previewMin = QVector3D(qMin(min.x(), m_previewMin.x()),
+                             qMin(min.y(), m_previewMin.y()),
+                             qMin(min.z(), m_previewMin.z()));
+    m_previewMax = QVector3D(qMax(max.x(), m_previewMax.x()),
+                             qMax(max.y(), m_previewMax.y()),
+                             qMax(max.z(), m_previewMax.z()));
+  }
+
+  setSceneBoundingBox(Vec(m_previewMin.x(), m_previewMin.y(), m_previewMin.z()),
+                      Vec(m_previewMax.x(), m_previewMax.y(), m_previewMax.z()));
+  if(first == 0)
+    showEntireScene();
+
+  update();
+}
+
 bool Viewer::multisampleAvailable() const
 {
   return format().testOption(QGL::SampleBuffers);
@@ -116,6 +374,10 @@ QStringList Viewer::openGLInfo()
   result << ("Multisample Support;"
             + (multisampleAvailable() ? QString("true") : QString("false")));
 
+  result << ("Point Renderer;" + (m_pointShader ? QString("Shaders")
+                                                : QString("Fixed Function")));
+  bool ids = m_pointShader && m_pointShader->supportsPicking();
+  result << ("Point Picking;" + (ids ? QString("ID Buffer") : QString("Depth")));
   result << ("Swap Interval;" + QString::number(format().swapInterval()));
   result << ("Pointer size;" + QString::number(sizeof(void *) * 8) + " bits");
   return result;
@@ -125,22 +387,127 @@ QStringList Viewer::pointCloudInfo()
 {
   QStringList result;
 
-  result << ("Points;" + QString::number(m_vertexCount));
+  // Out of core clouds are only known through their hierarchy
+  bool outOfCore = m_octree && m_octree->isOutOfCore();
+
+  int points = m_pointCloud.isEmpty() ? m_vertexCount : m_pointCloud.count();
+  if(outOfCore)
+    points = m_octree->pointCount();
+
+  result << ("Points;" + QString::number(points));
+  bool hasColor = outOfCore ? m_octree->hasColor() : m_pointCloud.hasColor();
   result << ("Contains Color;"
-             + (m_pointCloud.hasColor() ? QString("true") : QString("false")));
+             + (hasColor ? QString("true") : QString("false")));
+  if(!m_pointCloud.attributeNames().isEmpty())
+    result << ("Attributes;" + m_pointCloud.attributeNames().join(", "));
+  result << ("Host Memory;" + QString("%L1 MB")
+             .arg(m_pointCloud.memoryUsage()/(1024.0 * 1024.0), 0, 'f', 1));
+
+  result << ("Vertex Format;" + (m_compactPositions
+                                 ? QString("Compact (16-bit positions)")
+                                 : QString("Full (32-bit positions)")));
+  qint64 gpuBytes = (m_vertexBuffer.isCreated() ? m_vertexBuffer.size() : 0)
+      + (m_colorBuffer.isCreated() ? m_colorBuffer.size() : 0);
+  result << ("GPU Memory;" + QString("%L1 MB")
+             .arg(gpuBytes/(1024.0 * 1024.0), 0, 'f', 1));
+  if(!m_chunks.isEmpty())
+    result << ("Chunks;" + QString::number(m_chunks.count()));
+  if(gpuMemoryBudget() > 0)
+  {
+    result << ("GPU Memory Budget;" + QString("%L1 MB")
+               .arg(gpuMemoryBudget()/(1024.0 * 1024.0), 0, 'f', 1));
+  }
+  if(levelOfDetailReady())
+  {
+    result << ("Octree;" + QString("%1 nodes, depth %2")
+               .arg(m_octree->nodeCount()).arg(m_octree->depth()));
+    result << ("Points Drawn;" + QString::number(m_pointsDrawn));
+    result << ("Octree GPU Memory;" + QString("%L1 MB")
+               .arg(m_nodeBufferMemory/(1024.0 * 1024.0), 0, 'f', 1));
+    if(outOfCore)
+    {
+      result << ("Octree Host Memory;" + QString("%L1 MB")
+                 .arg(m_octree->hostMemoryUsage()/(1024.0 * 1024.0), 0, 'f', 1));
+    }
+  }
   result << ("Cameras;" + QString::number(m_fov.count()));
 
-  float x = m_pointCloud.boundingBoxMinimum().x();
-  float y = m_pointCloud.boundingBoxMinimum().y();
-  float z = m_pointCloud.boundingBoxMinimum().z();
+  QVector3D min = outOfCore ? m_octree->boundingBoxMinimum()
+                            : m_pointCloud.boundingBoxMinimum();
+  QVector3D max = outOfCore ? m_octree->boundingBoxMaximum()
+                            : m_pointCloud.boundingBoxMaximum();
+
+  float x = min.x();
+  float y = min.y();
+  float z = min.z();
 
   result << ("Minimum;" + QString("(%1, %2, %3)").arg(x).arg(y).arg(z));
 
-  x = m_pointCloud.boundingBoxMaximum().x();
-  y = m_pointCloud.boundingBoxMaximum().y();
-  z = m_pointCloud.boundingBoxMaximum().z();
+  x = max.x();
+  y = max.y();
+  z = max.z();
 
   result << ("Maximum;" + QString("(%1, %2, %3)").arg(x).arg(y).arg(z));
+
+  // Out of core clouds are never in memory as a whole
+  if(outOfCore || m_pointCloud.isEmpty())
+    return result;
+
+  QVector3D center = m_pointCloud.boundingBoxCenter();
+  result << ("Center;" + QString("(%1, %2, %3)")
+             .arg(center.x()).arg(center.y()).arg(center.z()));
+
+  const PointCloud::Statistics& statistics = m_pointCloud.statistics();
+  result << ("Mean;" + QString("(%1, %2, %3)").arg(statistics.mean.x())
+             .arg(statistics.mean.y()).arg(statistics.mean.z()));
+  result << ("Z Distribution;" + histogramText(statistics.zHistogram));
+
+  if(m_pointCloud.hasColor())
+  {
+    result << ("Mean Color;" + QString("(%1, %2, %3)")
+               .arg(statistics.meanColor.x(), 0, 'f', 1)
+               .arg(statistics.meanColor.y(), 0, 'f', 1)
+               .arg(statistics.meanColor.z(), 0, 'f', 1));
+    const char *channels[] = { "Red", "Green", "Blue" };
+    for(int c = 0; c < 3; ++c)
+    {
+      result << (QString(channels[c]) + " Distribution;"
+                 + histogramText(statistics.colorHistograms[c]));
+    }
+  }
+
+  QMap<QString, double>::const_iterator i;
+  for(i = statistics.attributeMeans.constBegin();
+      i != statistics.attributeMeans.constEnd(); ++i)
+  {
+    result << ("Mean " + i.key() + ";" + QString::number(i.value()));
+  }
+
+  return result;
+}
+
+QString Viewer::histogramText(const QVector<qint64> &histogram)
+{
+  // Bar per group of bins, scaled to the fullest group
+  static const int Groups = 16;
+  // Lower block elements U+2581 to U+2588
+  static const int Levels = 8;
+
+  QVector<qint64> groups(Groups, 0);
+  for(int i = 0; i < histogram.count(); ++i)
+    groups[i * Groups/histogram.count()] += histogram.at(i);
+
+  qint64 peak = 1;
+  foreach(qint64 count, groups)
+    peak = qMax(peak, count);
+
+  QString result;
+  foreach(qint64 count, groups)
+  {
+    int level = (count * (Levels - 1) + peak - 1)/peak;
+    result += QChar((ushort)(0x2581 + level));
+  }
+
   return result;
 }
 
@@ -251,6 +618,199 @@ void Viewer::setFastInteraction(bool value)
   }
 }
 
+void Viewer::setTargetFrameRate(int framesPerSecond)
+{
+  framesPerSecond = qMax(1, framesPerSecond);
+  if(m_targetFrameRate != framesPerSecond)
+  {
+    m_targetFrameRate = framesPerSecond;
+    emit targetFrameRateChanged(framesPerSecond);
+  }
+}
+
+void Viewer::setEyeDomeLighting(bool value)
+{
+  if(m_eyeDomeLightingEnabled == value)
+    return;
+
+  m_eyeDomeLightingEnabled = value;
+  if(value)
+    displayMessage("Eye-Dome Lighting On");
+  else
+    displayMessage("Eye-Dome Lighting Off");
+
+  emit eyeDomeLightingChanged(value);
+  update();
+}
+
+void Viewer::setEyeDomeStrength(double strength)
+{
+  if(m_eyeDomeStrength == strength)
+    return;
+
+  m_eyeDomeStrength = strength;
+  emit eyeDomeStrengthChanged(strength);
+  update();
+}
+
+void Viewer::setEyeDomeRadius(double radius)
+{
+  if(m_eyeDomeRadius == radius)
+    return;
+
+  m_eyeDomeRadius = radius;
+  emit eyeDomeRadiusChanged(radius);
+  update();
+}
+
+void Viewer::setPerformanceOverlay(bool value)
+{
+  if(m_performanceOverlay == value)
+    return;
+
+  m_performanceOverlay = value;
+  emit performanceOverlayChanged(value);
+
+  update();
+}
+
+void Viewer::togglePerformanceOverlay()
+{
+  setPerformanceOverlay(!m_performanceOverlay);
+}
+
+bool Viewer::startFrameLog(const QString &path)
+{
+  if(!m_frameStatistics.startLog(path))
+    return false;
+
+  update();
+  return true;
+}
+
+void Viewer::stopFrameLog()
+{
+  m_frameStatistics.stopLog();
+}
+
+void Viewer::setVertexFormat(Viewer::VertexFormat format)
+{
+  if(m_vertexFormat != format)
+  {
+    m_vertexFormat = format;
+    emit vertexFormatChanged(format);
+
+    // Re-upload current cloud in new format
+    if(!m_preview && !m_levelOfDetail && !m_pointCloud.isEmpty())
+    {
+      uploadPointCloud(m_pointCloud);
+      update();
+    }
+  }
+}
+
+void Viewer::setSpatialOrder(bool value)
+{
+  if(m_spatialOrder != value)
+  {
+    m_spatialOrder = value;
+    emit spatialOrderChanged(value);
+
+    // Reorder and re-upload current cloud; level of detail keeps it shuffled
+    if(!m_preview && !m_levelOfDetail && !m_pointCloud.isEmpty())
+    {
+      m_pointCloud.shuffle();
+      arrangePointCloud();
+      uploadPointCloud(m_pointCloud);
+      update();
+    }
+  }
+}
+
+void Viewer::setFrustumCulling(bool value)
+{
+  if(m_frustumCulling != value)
+  {
+    m_frustumCulling = value;
+    update();
+  }
+}
+
+void Viewer::arrangePointCloud()
+{
+  if(m_spatialOrder)
+    m_pointCloud.sortStrata();
+
+  // Stable, so chunks keep the order of strata
+  m_chunks = m_pointCloud.partition(ChunkSize);
+  m_strata = PointCloud::strata(m_pointCloud.count());
+}
+
+void Viewer::setGPUMemoryBudget(int megabytes)
+{
+  m_gpuMemoryBudget = (qint64)qMax(0, megabytes) * 1024 * 1024;
+}
+
+void Viewer::setHostMemoryBudget(int megabytes)
+{
+  m_hostMemoryBudget = (qint64)qMax(0, megabytes) * 1024 * 1024;
+
+  // Only hierarchies read from disk cache nodes
+  if(m_octree && m_octree->isOutOfCore())
+    m_octree->setHostMemoryBudget(m_hostMemoryBudget);
+}
+
+void Viewer::setLevelOfDetail(bool value)
+{
+  // Out of core clouds can only be drawn by level of detail
+  if(!value && m_octree && m_octree->isOutOfCore())
+  {
+    emit levelOfDetailChanged(true);
+    return;
+  }
+
+  if(m_levelOfDetail != value)
+  {
+    m_levelOfDetail = value;
+    emit levelOfDetailChanged(value);
+
+    if(!m_pointCloud.isEmpty())
+    {
+      if(value)
+      {
+        // Flat buffers are not needed; free the memory for nodes
+        m_vertexBuffer.destroy();
+        m_colorBuffer.destroy();
+        m_vertexCount = 0;
+
+        // Nodes sample the lowest indices, so the octree needs the whole
+        // cloud in random order
+        if(!m_chunks.isEmpty())
+          m_pointCloud.shuffle();
+        m_chunks.clear();
+        buildOctree();
+      } else {
+        releaseOctree();
+        clearNodeBuffers();
+        arrangePointCloud();
+        uploadPointCloud(m_pointCloud);
+      }
+    }
+
+    update();
+  }
+}
+
+void Viewer::setPointBudget(int points)
+{
+  if(m_pointBudget != points)
+  {
+    m_pointBudget = qMax(1, points);
+    emit pointBudgetChanged(m_pointBudget);
+    update();
+  }
+}
+
 void Viewer::restoreView()
 {
   // Restore default view by creating new camera and fitting scene
@@ -346,6 +906,26 @@ void Viewer::init()
 
   glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
 
+  m_detectedGPUMemory = detectGPUMemory();
+
+  // Prefer shaders; old or software drivers keep the fixed-function path
+  m_pointShader = new PointShader;
+  if(!m_pointShader->create())
+  {
+    qDebug() << "Shader rendering unavailable; using fixed-function points.";
+    delete m_pointShader;
+    m_pointShader = NULL;
+  }
+
+  // Shading is optional; the setting is kept but ignored without it
+  m_eyeDomeLighting = new EyeDomeLighting;
+  if(!m_eyeDomeLighting->create())
+  {
+    qDebug() << "Eye-dome lighting unavailable.";
+    delete m_eyeDomeLighting;
+    m_eyeDomeLighting = NULL;
+  }
+
   glDisable(GL_LIGHTING);
 
   // Bind logo to texture
@@ -355,6 +935,34 @@ void Viewer::init()
 }
 
 void Viewer::draw()
+{
+  drawShadedPoints(pointsToDraw());
+}
+
+void Viewer::drawShadedPoints(int count)
+{
+  // Each stereo eye draws through here, shaded within its own viewport
+  bool shade = m_eyeDomeLightingEnabled && m_eyeDomeLighting
+      && m_eyeDomeLighting->begin();
+
+  drawPoints(count);
+
+  if(shade)
+  {
+    m_eyeDomeLighting->end(m_eyeDomeStrength, m_eyeDomeRadius,
+                           camera()->zNear(), camera()->zFar(),
+                           camera()->type() == Camera::PERSPECTIVE);
+  }
+}
+
+int Viewer::pointsToDraw() const
+{
+  // Density thins the budget with level of detail and the cloud otherwise
+  int total = levelOfDetailReady() ? m_pointBudget : m_vertexCount;
+  return total * m_density/100.0;
+}
+
+int Viewer::drawPoints(int count, int first)
 {
   // Apply turntable frame
   glPushMatrix();
@@ -368,42 +976,231 @@ void Viewer::draw()
   if(m_multisample)
     glEnable(GL_MULTISAMPLE);
 
-  glEnableClientState(GL_VERTEX_ARRAY);
+  bool levelOfDetail = levelOfDetailReady();
 
-  if(m_colorPoints)
-    glEnableClientState(GL_COLOR_ARRAY);
+  // Map quantized positions back to the bounding box
+  if(!levelOfDetail && m_compactPositions)
+  {
+    glTranslatef(m_dequantizeOffset.x(), m_dequantizeOffset.y(),
+                 m_dequantizeOffset.z());
+    glScalef(m_dequantizeScale.x(), m_dequantizeScale.y(),
+             m_dequantizeScale.z());
+  }
 
-  if(!m_colorBuffer.isCreated())
+  if(m_pointShader)
   {
-    m_vertexBuffer.bind();
-    glVertexPointer(3, GL_FLOAT, 0, 0);
-    glColorPointer(3, GL_FLOAT, 0, 0);
-    m_vertexBuffer.release();
+    // Points keep their size at the distance of the scene center
+    float referenceDepth = 0.0f;
+    if(camera()->type() == Camera::PERSPECTIVE)
+      referenceDepth = (camera()->position() - camera()->sceneCenter()).norm();
+
+    m_pointShader->bind(m_pointSize, referenceDepth, m_smoothPoints,
+                        m_colorPoints);
   } else {
-    m_vertexBuffer.bind();
-    glVertexPointer(3, GL_FLOAT, 0, 0);
-    m_vertexBuffer.release();
+    glEnableClientState(GL_VERTEX_ARRAY);
 
-    m_colorBuffer.bind();
-    glColorPointer(3, GL_FLOAT, 0, 0);
-    m_colorBuffer.release();
+    if(m_colorPoints)
+      glEnableClientState(GL_COLOR_ARRAY);
   }
 
-  glDrawArrays(GL_POINTS, 0, m_vertexCount * m_density/100.0);
+  bool timing = !m_picking
+      && (m_performanceOverlay || m_frameStatistics.isLogging());
+  if(timing)
+    m_frameStatistics.beginDraw();
 
-  glDisableClientState(GL_COLOR_ARRAY);
-  glDisableClientState(GL_VERTEX_ARRAY);
+  int covered = 0;
+  if(levelOfDetail)
+  {
+    m_pointsDrawn = drawLevelOfDetail(count);
+    covered = m_pointsDrawn;
+  } else {
+    // Prefixes cut inside a sorted stratum would cover part of the scene
+    if(m_spatialOrder && first == 0 && !m_preview)
+      count = PointCloud::strataPrefix(count, m_vertexCount);
 
-  glDepthMask(GL_TRUE);
+    covered = qBound(0, m_vertexCount - first, count);
+    if(m_chunks.isEmpty())
+    {
+      m_pointsDrawn = covered;
+      drawArrays(m_vertexBuffer, m_colorBuffer, m_vertexArray,
+                 m_compactPositions ? GL_SHORT : GL_FLOAT, first, covered);
+    } else {
+      m_pointsDrawn = drawChunks(first, covered);
+    }
+  }
 
-  // Restore transforms
-  glPopMatrix();
-}
+  if(timing)
+    m_frameStatistics.endDraw(m_pointsDrawn);
+
+  if(m_pointShader)
+  {
+    m_pointShader->release();
+  } else {
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+  }
+
+  glDepthMask(GL_TRUE);
+
+  // Restore transforms
+  glPopMatrix();
+
+  return covered;
+}
+
+void Viewer::drawArrays(QGLBuffer &vertices, QGLBuffer &colors,
+                        PointShader::VertexArray &array, GLenum positionType,
+                        int first, int count)
+{
+  if(count <= 0)
+    return;
+
+  GLint firsts[1] = { first };
+  GLsizei counts[1] = { count };
+  drawArrays(vertices, colors, array, positionType, firsts, counts, 1);
+}
+
+void Viewer::drawArrays(QGLBuffer &vertices, QGLBuffer &colors,
+                        PointShader::VertexArray &array, GLenum positionType,
+                        const GLint *first, const GLsizei *count, int ranges)
+{
+  if(m_pointShader)
+  {
+    m_pointShader->draw(array, vertices, colors, positionType, first, count,
+                        ranges);
+    return;
+  }
+
+  if(!vertices.isCreated() || ranges <= 0)
+    return;
+
+  vertices.bind();
+  glVertexPointer(3, positionType, 0, 0);
+  // Without color, positions double as colors
+  if(!colors.isCreated())
+    glColorPointer(3, positionType, 0, 0);
+  vertices.release();
+
+  if(colors.isCreated())
+  {
+    // Normalized to [0,1] by OpenGL
+    colors.bind();
+    glColorPointer(3, GL_UNSIGNED_BYTE, 0, 0);
+    colors.release();
+  }
+
+  for(int i = 0; i < ranges; ++i)
+    glDrawArrays(GL_POINTS, first[i], count[i]);
+}
+
+// Where a prefix of the cloud ends among strata: in which one and how far
+// into it
+struct StrataPosition
+{
+  int stratum;
+  double fraction;
+};
+
+static StrataPosition strataPosition(const QVector<int>& ends, int points)
+{
+  StrataPosition position;
+  position.stratum = std::lower_bound(ends.begin(), ends.end(), points)
+      - ends.begin();
+  position.stratum = qMin(position.stratum, ends.count() - 1);
+
+  int start = position.stratum > 0 ? ends[position.stratum - 1] : 0;
+  position.fraction = qBound(0.0, (double)(points - start)
+                             /(ends[position.stratum] - start), 1.0);
+  return position;
+}
+
+// Points of a chunk within the prefix; exact at the end of a stratum, as
+// the chunk's points of each stratum are a random subset of it
+static int chunkPrefix(const PointCloud::Chunk& chunk,
+                       const StrataPosition& position)
+{
+  int start = position.stratum > 0 ? chunk.strata[position.stratum - 1] : 0;
+  return start + qRound(position.fraction
+                        * (chunk.strata[position.stratum] - start));
+}
+
+int Viewer::drawChunks(int first, int count)
+{
+  if(count <= 0)
+    return 0;
+
+  GLdouble planes[6][4];
+  camera()->getFrustumPlanesCoefficients(planes);
+
+  StrataPosition begin = strataPosition(m_strata, first);
+  StrataPosition end = strataPosition(m_strata, first + count);
+
+  m_chunkFirsts.resize(0);
+  m_chunkCounts.resize(0);
+  int drawn = 0;
+
+  // Eyes see past the mono frustum, and one range list serves both of them
+  // when stereo is drawn in a single pass; draw every chunk
+  bool culling = m_frustumCulling && !stereoEnabled();
+
+  foreach(const PointCloud::Chunk& chunk, m_chunks)
+  {
+    if(culling && !chunkVisible(chunk, planes))
+      continue;
+
+    int from = chunkPrefix(chunk, begin);
+    int to = chunkPrefix(chunk, end);
+    if(to <= from)
+      continue;
+
+    m_chunkFirsts.append(chunk.first + from);
+    m_chunkCounts.append(to - from);
+    drawn += to - from;
+  }
+
+  drawArrays(m_vertexBuffer, m_colorBuffer, m_vertexArray,
+             m_compactPositions ? GL_SHORT : GL_FLOAT,
+             m_chunkFirsts.constData(), m_chunkCounts.constData(),
+             m_chunkFirsts.count());
+
+  return drawn;
+}
+
+bool Viewer::chunkVisible(const PointCloud::Chunk &chunk,
+                          GLdouble planes[6][4])
+{
+  // Chunks are in the turntable frame
+  QVector3D local = 0.5f * (chunk.minimum + chunk.maximum);
+  Vec center = manipulatedFrame()->inverseCoordinatesOf(
+        Vec(local.x(), local.y(), local.z()));
+  float radius = 0.5f * (chunk.maximum - chunk.minimum).length();
+
+  // Planes face outward
+  for(int i = 0; i < 6; ++i)
+  {
+    double distance = planes[i][0] * center.x + planes[i][1] * center.y
+        + planes[i][2] * center.z - planes[i][3];
+    if(distance > radius)
+      return false;
+  }
+
+  return true;
+}
 
 void Viewer::drawRedCyanStereo()
 {
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  if(drawStereoBuffer())
+  {
+    glColorMask(GL_TRUE, GL_FALSE, GL_FALSE, GL_TRUE);
+    drawStereoHalf(0);
+    glColorMask(GL_FALSE, GL_TRUE, GL_TRUE, GL_TRUE);
+    drawStereoHalf(1);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    return;
+  }
+
   camera()->loadProjectionMatrixStereo(!m_swapLeftRight);
   camera()->loadModelViewMatrixStereo(!m_swapLeftRight);
 
@@ -428,6 +1225,16 @@ void Viewer::drawRedBlueStereo()
 {
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  if(drawStereoBuffer())
+  {
+    glColorMask(GL_TRUE, GL_FALSE, GL_FALSE, GL_TRUE);
+    drawStereoHalf(0);
+    glColorMask(GL_FALSE, GL_FALSE, GL_TRUE, GL_TRUE);
+    drawStereoHalf(1);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    return;
+  }
+
   camera()->loadProjectionMatrixStereo(!m_swapLeftRight);
   camera()->loadModelViewMatrixStereo(!m_swapLeftRight);
 
@@ -457,6 +1264,9 @@ void Viewer::drawSideBySideStereo()
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  if(drawSinglePassStereo(false))
+    return;
+
   // Set left side viewport
   glViewport(vp[0], vp[1], vp[2]/2.0, vp[3]);
   // Load left eye transforms
@@ -487,6 +1297,9 @@ void Viewer::drawStackedStereo()
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+  if(drawSinglePassStereo(true))
+    return;
+
   // Set top  viewport
   glViewport(vp[0], vp[1], vp[2], vp[3]/2.0);
   // Load left eye transforms
@@ -511,6 +1324,18 @@ void Viewer::drawStackedStereo()
 
 void Viewer::drawHardwareStereo()
 {
+  if(drawStereoBuffer())
+  {
+    glDrawBuffer(GL_BACK_LEFT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawStereoHalf(0);
+
+    glDrawBuffer(GL_BACK_RIGHT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    drawStereoHalf(1);
+    return;
+  }
+
   // Clear left buffer
   glDrawBuffer(GL_BACK_LEFT);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -534,6 +1359,224 @@ void Viewer::drawHardwareStereo()
   draw();
  }
 
+bool Viewer::singlePassStereoAvailable() const
+{
+  return m_pointShader && m_pointShader->supportsStereo();
+}
+
+void Viewer::setSinglePassStereo(bool value)
+{
+  m_singlePassStereo = value;
+  update();
+}
+
+void Viewer::setMeasureMode(Viewer::MeasureMode mode)
+{
+  if(m_measureMode == mode)
+    return;
+
+  m_measureMode = mode;
+  m_measurePoints.clear();
+  emit measureModeChanged(mode);
+  emit measurementChanged(QString());
+
+  switch(mode)
+  {
+  case DistanceMeasure:
+    displayMessage("Shift-click two points to measure distance"); break;
+  case AreaMeasure:
+    displayMessage("Shift-click the corners of an area"); break;
+  case HeightMeasure:
+    displayMessage("Shift-click two points to measure height"); break;
+  default:
+    break;
+  }
+
+  update();
+}
+
+void Viewer::clearMeasurement()
+{
+  if(m_measurePoints.isEmpty())
+    return;
+
+  m_measurePoints.clear();
+  emit measurementChanged(QString());
+  update();
+}
+
+void Viewer::select(const QPoint &pixel)
+{
+  PickedPoint point;
+  if(!pickPoint(pixel, point))
+  {
+    displayMessage("No point under cursor");
+    return;
+  }
+
+  if(m_measureMode == NoMeasure)
+  {
+    QString message = QString("%1, %2, %3").arg(point.position.x())
+        .arg(point.position.y()).arg(point.position.z());
+    if(point.index >= 0)
+      message = QString("Point %1 at ").arg(point.index) + message;
+    displayMessage(message);
+    return;
+  }
+
+  // Two point measurements start over with a third point
+  if(m_measureMode != AreaMeasure && m_measurePoints.count() >= 2)
+    m_measurePoints.clear();
+
+  m_measurePoints.append(point.position);
+  emit measurementChanged(measurement());
+  update();
+}
+
+QString Viewer::measurement() const
+{
+  const QVector<QVector3D>& points = m_measurePoints;
+
+  switch(m_measureMode)
+  {
+  case DistanceMeasure:
+    if(points.count() == 2)
+      return QString("Distance %1").arg((points[1] - points[0]).length());
+    break;
+  case HeightMeasure:
+    if(points.count() == 2)
+    {
+      // Up is z in cloud coordinates
+      QVector3D offset = points[1] - points[0];
+      return QString("Height %1, horizontal %2").arg(qAbs(offset.z()))
+          .arg(offset.toVector2D().length());
+    }
+    break;
+  case AreaMeasure:
+    if(points.count() >= 3)
+    {
+      // Area of the closed polygon from the sum of cross products of its
+      // edges; corners are taken relative to the first to keep precision
+      // with large coordinates
+      QVector3D normal;
+      float perimeter = 0.0f;
+      for(int i = 0; i < points.count(); ++i)
+      {
+        QVector3D a = points[i] - points[0];
+        QVector3D b = points[(i + 1) % points.count()] - points[0];
+        normal += QVector3D::crossProduct(a, b);
+        perimeter += (b - a).length();
+      }
+      return QString("Area %1, perimeter %2").arg(0.5f * normal.length())
+          .arg(perimeter);
+    }
+    break;
+  default:
+    break;
+  }
+
+  return QString();
+}
+
+bool Viewer::drawSinglePassStereo(bool vertical)
+{
+  if(!m_singlePassStereo || !singlePassStereoAvailable())
+    return false;
+
+  // Second eye relative to the first, which is left on the matrix stacks
+  GLfloat matrix[16];
+  camera()->loadProjectionMatrixStereo(m_swapLeftRight);
+  camera()->loadModelViewMatrixStereo(m_swapLeftRight);
+  glGetFloatv(GL_PROJECTION_MATRIX, matrix);
+  QMatrix4x4 secondProjection = QMatrix4x4(matrix).transposed();
+  glGetFloatv(GL_MODELVIEW_MATRIX, matrix);
+  QMatrix4x4 secondView = QMatrix4x4(matrix).transposed();
+
+  camera()->loadProjectionMatrixStereo(!m_swapLeftRight);
+  camera()->loadModelViewMatrixStereo(!m_swapLeftRight);
+  glGetFloatv(GL_MODELVIEW_MATRIX, matrix);
+  QMatrix4x4 firstView = QMatrix4x4(matrix).transposed();
+
+  m_pointShader->setStereo(secondView * firstView.inverted(),
+                           secondProjection, vertical);
+  draw();
+  m_pointShader->clearStereo();
+
+  return true;
+}
+
+bool Viewer::drawStereoBuffer()
+{
+  if(!m_singlePassStereo || !singlePassStereoAvailable())
+    return false;
+
+  GLint vp[4];
+  glGetIntegerv(GL_VIEWPORT, vp);
+
+  QSize size(2 * vp[2], vp[3]);
+  if(!m_stereoBuffer || m_stereoBuffer->size() != size)
+  {
+    delete m_stereoBuffer;
+    m_stereoBuffer = new QGLFramebufferObject(size,
+                                              QGLFramebufferObject::Depth);
+    if(!m_stereoBuffer->isValid())
+    {
+      delete m_stereoBuffer;
+      m_stereoBuffer = NULL;
+      return false;
+    }
+  }
+
+  m_stereoBuffer->bind();
+  glViewport(0, 0, size.width(), size.height());
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  drawSinglePassStereo(false);
+
+  m_stereoBuffer->release();
+  glViewport(vp[0], vp[1], vp[2], vp[3]);
+
+  return true;
+}
+
+void Viewer::drawStereoHalf(int eye)
+{
+  // Keeps the color mask and draw buffer of the caller
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  glLoadIdentity();
+
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_BLEND);
+  glEnable(GL_TEXTURE_2D);
+  glBindTexture(GL_TEXTURE_2D, m_stereoBuffer->texture());
+  glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+
+  float left = 0.5f * eye;
+  glBegin(GL_QUADS);
+  glTexCoord2f(left, 0.0f);
+  glVertex2f(-1.0f, -1.0f);
+  glTexCoord2f(left + 0.5f, 0.0f);
+  glVertex2f(1.0f, -1.0f);
+  glTexCoord2f(left + 0.5f, 1.0f);
+  glVertex2f(1.0f, 1.0f);
+  glTexCoord2f(left, 1.0f);
+  glVertex2f(-1.0f, 1.0f);
+  glEnd();
+
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+  glPopAttrib();
+}
+
 void Viewer::postDraw()
 {
   // Call base class post draw
@@ -566,63 +1609,230 @@ void Viewer::postDraw()
     // Restore OpenGL state
     glPopAttrib();
   }
+
+  drawMeasurement();
+
+  if(m_performanceOverlay)
+    drawPerformanceOverlay();
 }
 
-void Viewer::fastDraw()
+void Viewer::drawMeasurement()
 {
-  if(!m_fastInteraction)
-  {
-    draw();
+  const QVector<QVector3D>& points = m_measurePoints;
+  if(points.isEmpty())
     return;
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+
+  // Drawn over the points
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_LIGHTING);
+  glDisable(GL_TEXTURE_2D);
+
+  // Points are picked in the turntable frame
+  glPushMatrix();
+  glMultMatrixd(manipulatedFrame()->matrix());
+
+  glColor3f(1.0f, 0.8f, 0.0f);
+  glLineWidth(2.0f);
+  bool closed = m_measureMode == AreaMeasure && points.count() >= 3;
+  glBegin(closed ? GL_LINE_LOOP : GL_LINE_STRIP);
+  foreach(const QVector3D& point, points)
+    glVertex3f(point.x(), point.y(), point.z());
+  glEnd();
+
+  // Vertical and horizontal legs of a height measurement
+  if(m_measureMode == HeightMeasure && points.count() == 2)
+  {
+    QVector3D corner(points[1].x(), points[1].y(), points[0].z());
+    glColor3f(0.0f, 0.8f, 1.0f);
+    glLineWidth(1.0f);
+    glBegin(GL_LINE_STRIP);
+    glVertex3f(points[0].x(), points[0].y(), points[0].z());
+    glVertex3f(corner.x(), corner.y(), corner.z());
+    glVertex3f(points[1].x(), points[1].y(), points[1].z());
+    glEnd();
   }
 
-  int pointsToDraw = qMin((int)(m_vertexCount * m_density/100.0),
-                          m_fastInteractionMax);
+  glColor3f(1.0f, 0.8f, 0.0f);
+  glPointSize(8.0f);
+  glBegin(GL_POINTS);
+  foreach(const QVector3D& point, points)
+    glVertex3f(point.x(), point.y(), point.z());
+  glEnd();
 
-//  qDebug() << "Fast draw points" << pointsToDraw;
-  glPointSize(m_pointSize);
+  glPopMatrix();
 
-  if(!m_depthMasking)
-    glDepthMask(GL_FALSE);
+  QString text = measurement();
+  if(!text.isEmpty())
+  {
+    glColor3f(1.0f, 1.0f, 1.0f);
+    drawText(10, height() - 10, text);
+  }
 
-  if(m_multisample)
-    glEnable(GL_MULTISAMPLE);
+  glPopAttrib();
+}
 
-  glEnableClientState(GL_VERTEX_ARRAY);
+void Viewer::drawPerformanceOverlay()
+{
+  const QVector<FrameStatistics::Frame>& history = m_frameStatistics.history();
+  if(history.isEmpty())
+    return;
 
-  if(m_colorPoints)
-    glEnableClientState(GL_COLOR_ARRAY);
+  // Averages over the graphed frames steady the numbers
+  double interval = 0.0, cpu = 0.0, gpu = 0.0, maxInterval = 0.0;
+  int gpuFrames = 0;
+  foreach(const FrameStatistics::Frame& frame, history)
+  {
+    interval += frame.intervalMs;
+    cpu += frame.cpuMs;
+    maxInterval = qMax(maxInterval, frame.intervalMs);
+    if(frame.gpuMs >= 0.0)
+    {
+      gpu += frame.gpuMs;
+      ++gpuFrames;
+    }
+  }
+  interval /= history.count();
+  cpu /= history.count();
+
+  const FrameStatistics::Frame& last = history.last();
+
+  QStringList lines;
+  lines << QString("Frame %1 ms (%2 fps)").arg(interval, 0, 'f', 1)
+           .arg(interval > 0.0 ? 1000.0/interval : 0.0, 0, 'f', 0);
+  lines << QString("CPU draw %1 ms").arg(cpu, 0, 'f', 2);
+  lines << (gpuFrames > 0 ? QString("GPU draw %1 ms").arg(gpu/gpuFrames, 0, 'f', 2)
+                          : QString("GPU draw n/a"));
+  lines << QString("Points %L1").arg(last.points);
+  lines << QString("VBO memory %L1 MB")
+           .arg(last.bufferMemory/(1024.0 * 1024.0), 0, 'f', 1);
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  startScreenCoordinatesSystem();
+
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_POINT_SMOOTH);
+  glDisable(GL_MULTISAMPLE);
+  glEnable(GL_BLEND);
+
+  // Graph of frame times, newest on the right; lines mark 60 and 30 fps
+  const int margin = 10;
+  const int graphHeight = 60;
+  const int barWidth = 2;
+  const int left = margin;
+  const int bottom = margin + graphHeight + 5 * 16;
+  double scale = graphHeight/qMax(maxInterval, 1000.0/30.0);
+  int right = left + FrameStatistics::HistorySize * barWidth;
+
+  glColor4f(0.0f, 0.0f, 0.0f, 0.5f);
+  glRecti(left - 4, margin - 4, right + 4, bottom + 4);
+
+  glLineWidth(barWidth);
+  glBegin(GL_LINES);
+  int x = right - history.count() * barWidth + barWidth/2;
+  foreach(const FrameStatistics::Frame& frame, history)
+  {
+    glColor3f(0.6f, 0.6f, 0.6f);
+    glVertex2i(x, bottom);
+    glVertex2i(x, bottom - qRound(frame.intervalMs * scale));
+    if(frame.gpuMs > 0.0)
+    {
+      glColor3f(0.3f, 0.8f, 0.3f);
+      glVertex2i(x, bottom);
+      glVertex2i(x, bottom - qRound(frame.gpuMs * scale));
+    }
+    x += barWidth;
+  }
+  glEnd();
 
-  if(!m_colorBuffer.isCreated())
+  glLineWidth(1.0f);
+  glColor3f(0.9f, 0.3f, 0.3f);
+  glBegin(GL_LINES);
+  for(int fps = 60; fps >= 30; fps /= 2)
   {
-    m_vertexBuffer.bind();
-    glVertexPointer(3, GL_FLOAT, 0, 0);
-    glColorPointer(3, GL_FLOAT, 0, 0);
-    m_vertexBuffer.release();
-  } else {
-    m_vertexBuffer.bind();
-    glVertexPointer(3, GL_FLOAT, 0, 0);
-    m_vertexBuffer.release();
+    int y = bottom - qRound(1000.0/fps * scale);
+    glVertex2i(left, y);
+    glVertex2i(right, y);
+  }
+  glEnd();
 
-    m_colorBuffer.bind();
-//    glColorPointer(3, GL_UNSIGNED_BYTE, 0, 0);
-    // Modified to use floats for color; testing effect on performance
-    glColorPointer(3, GL_FLOAT, 0, 0);
-    m_colorBuffer.release();
+  stopScreenCoordinatesSystem();
+
+  glColor3f(1.0f, 1.0f, 1.0f);
+  for(int i = 0; i < lines.count(); ++i)
+    drawText(margin, margin + 12 + i * 16, lines[i]);
+
+  glPopAttrib();
+}
+
+void Viewer::fastDraw()
+{
+  if(!m_fastInteraction)
+  {
+    draw();
+    return;
   }
 
-//  glDrawArrays(GL_POINTS, 0, m_vertexCount * 25/100.0);
-  glDrawArrays(GL_POINTS, 0, pointsToDraw);
+  drawShadedPoints(qMin(pointsToDraw(), m_interactionBudget));
+}
 
-  glDisableClientState(GL_COLOR_ARRAY);
-  glDisableClientState(GL_VERTEX_ARRAY);
+bool Viewer::isInteracting() const
+{
+  if(camera()->frame()->isManipulated() || camera()->frame()->isSpinning()
+     || manipulatedFrame()->isSpinning())
+    return true;
 
-  glDepthMask(GL_TRUE);
+  // Paths are bound to F1-F12
+  for(unsigned int i = 1; i <= 12; ++i)
+  {
+    KeyFrameInterpolator *kfi = camera()->keyFrameInterpolator(i);
+    if(kfi && kfi->interpolationIsStarted())
+      return true;
+  }
+
+  return false;
+}
+
+void Viewer::updateInteractionBudget(double frameMs)
+{
+  // Smooth out single slow frames, e.g. from octree node uploads
+  if(m_interactionFrameMs <= 0.0)
+    m_interactionFrameMs = frameMs;
+  else
+    m_interactionFrameMs = 0.7 * m_interactionFrameMs + 0.3 * frameMs;
+
+  // Points drawn scale roughly linearly with time; step towards the target
+  // with a dead band so the count doesn't hunt around it
+  double targetMs = 1000.0/m_targetFrameRate;
+  double ratio = targetMs/qMax(m_interactionFrameMs, 0.1);
+  if(ratio > 1.0 && ratio < 1.2)
+    return;
+  if(ratio < 1.0 && ratio > 0.9)
+    return;
 
+  ratio = qBound(0.5, ratio, 1.25);
+  qint64 budget = m_interactionBudget * ratio;
+  int total = qMax(pointsToDraw(), MinInteractionBudget);
+  m_interactionBudget = qBound((qint64)MinInteractionBudget, budget,
+                               (qint64)total);
 }
 
 void Viewer::paintGL()
 {
+  bool timing = m_performanceOverlay || m_frameStatistics.isLogging();
+  if(timing)
+    m_frameStatistics.beginFrame();
+
+  // Time interactive frames to adapt the number of points drawn
+  bool moving = isInteracting();
+  bool interacting = m_fastInteraction && moving;
+  QElapsedTimer frameTimer;
+  if(interacting)
+    frameTimer.start();
+  else
+    m_interactionFrameMs = 0.0;
+
   if(stereoEnabled())
   {
     switch(m_stereoMode)
@@ -641,79 +1851,767 @@ void Viewer::paintGL()
   }
   else
   {
-    // Clears screen, set model view matrix...
-    preDraw();
-    // Used defined method. Default calls draw()
-    if(camera()->frame()->isManipulated())
-      fastDraw();
-    else
-      draw();
+    // A still view is refined over several frames
+    if(moving || !drawRefinement())
+    {
+      // Clears screen, set model view matrix...
+      preDraw();
+      // Used defined method. Default calls draw()
+      if(interacting)
+        fastDraw();
+      else
+        draw();
+    }
     // Add visual hints: axis, camera, grid...
     postDraw();
   }
-  Q_EMIT drawFinished(true);
 
-}
+  if(interacting)
+  {
+    // Wait for drawing so the time covers the GPU, not just command
+    // submission; frames arrive at the rate of input events, so the time
+    // between them isn't the cost of a frame
+    glFinish();
+    updateInteractionBudget(frameTimer.nsecsElapsed()/1e6);
+  }
 
-bool Viewer::bindToVertexBuffer(const QVector<float> &vertices)
-{
-  // Ensure number of vertices is divisible by 3
-  if(vertices.count() % 3)
-    return false;
+  if(timing)
+    m_frameStatistics.endFrame(bufferMemory());
 
-  // Make OpenGL context current
-  makeCurrent();
+  Q_EMIT drawFinished(true);
 
-  // Destroy currently allocated VBO
-  if(m_vertexBuffer.isCreated())
-    m_vertexBuffer.destroy();
+}
 
-  // Create VBO
-  if(!m_vertexBuffer.create())
+bool Viewer::drawRefinement()
+{
+  // The shuffled cloud is drawn in slices of the density reduced prefix
+  // until all of it is shown.  Octree nodes are already picked by screen
+  // size.
+  // Shading needs all points of the view in one depth buffer
+  int slice = qMax(pointsToDraw(), MinRefinementSlice);
+  if(levelOfDetailReady() || slice >= m_vertexCount
+     || (m_eyeDomeLightingEnabled && m_eyeDomeLighting)
+     || !QGLFramebufferObject::hasOpenGLFramebufferObjects())
   {
-    // Trigger error and return
+    m_refinedPoints = 0;
     return false;
   }
 
-  // Bind VBO
-  if(!m_vertexBuffer.bind())
+  // Slices accumulate at device resolution
+  QSize size = QSize(width(), height()) * devicePixelRatio();
+  if(!m_refinementBuffer || m_refinementBuffer->size() != size)
   {
-    return false;
+    delete m_refinementBuffer;
+    m_refinementBuffer = new QGLFramebufferObject(size,
+                                                  QGLFramebufferObject::Depth);
+    m_refinedPoints = 0;
+    if(!m_refinementBuffer->isValid())
+    {
+      delete m_refinementBuffer;
+      m_refinementBuffer = NULL;
+      return false;
+    }
   }
 
-  // Load VBO
-  m_vertexBuffer.allocate(vertices.constData(),
-                          vertices.count() * sizeof(float));
+  QVector<double> key = refinementKey();
+  if(key != m_refinementKey)
+  {
+    m_refinementKey = key;
+    m_refinedPoints = 0;
+  }
 
-  m_vertexCount = vertices.count()/3;
+  if(m_refinedPoints < m_vertexCount)
+  {
+    m_refinementBuffer->bind();
 
-  return glGetError() == GL_NO_ERROR;
+    // The first slice starts over; later ones add to color and depth
+    if(m_refinedPoints == 0)
+    {
+      preDraw();
+    } else {
+      camera()->loadProjectionMatrix();
+      camera()->loadModelViewMatrix();
+    }
+
+    m_refinedPoints += drawPoints(slice, m_refinedPoints);
+
+    m_refinementBuffer->release();
+
+    // Next slice once pending events are handled
+    if(m_refinedPoints < m_vertexCount)
+      QTimer::singleShot(0, this, SLOT(update()));
+  }
+
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  startScreenCoordinatesSystem();
+
+  glDisable(GL_DEPTH_TEST);
+  glDisable(GL_BLEND);
+  glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+  drawTexture(QRectF(0, 0, width(), height()), m_refinementBuffer->texture());
+
+  stopScreenCoordinatesSystem();
+  glPopAttrib();
+
+  // Matrices for postDraw()
+  camera()->loadProjectionMatrix();
+  camera()->loadModelViewMatrix();
+
+  return true;
 }
 
-bool Viewer::loadColorsToBuffer(const QVector<float> &colors)
+QVector<double> Viewer::refinementKey() const
 {
-  // Ensure RGB
-  if(colors.count() % 3)
+  QVector<double> key;
+
+  GLdouble matrix[16];
+  camera()->getProjectionMatrix(matrix);
+  for(int i = 0; i < 16; ++i)
+    key << matrix[i];
+  camera()->getModelViewMatrix(matrix);
+  for(int i = 0; i < 16; ++i)
+    key << matrix[i];
+
+  // Turntable
+  const GLdouble *frame = manipulatedFrame()->matrix();
+  for(int i = 0; i < 16; ++i)
+    key << frame[i];
+
+  key << m_pointSize << m_smoothPoints << m_colorPoints << m_depthMasking
+      << m_multisample << m_density << m_vertexCount;
+
+  return key;
+}
+
+bool Viewer::pickPoint(const QPoint &pixel, Viewer::PickedPoint &point)
+{
+  point = PickedPoint();
+
+  bool levelOfDetail = levelOfDetailReady();
+  if(!levelOfDetail && m_vertexCount == 0)
     return false;
 
-  // Make context current
   makeCurrent();
 
-  if(m_colorBuffer.isCreated())
-    m_colorBuffer.destroy();
+  // Only a small window around the cursor is drawn, at device resolution
+  int ratio = devicePixelRatio();
+  int size = PickWindow * ratio;
+  if(!m_pickBuffer || m_pickBuffer->width() != size)
+  {
+    delete m_pickBuffer;
+    m_pickBuffer = new QGLFramebufferObject(size, size,
+                                            QGLFramebufferObject::Depth);
+    if(!m_pickBuffer->isValid())
+    {
+      delete m_pickBuffer;
+      m_pickBuffer = NULL;
+      return false;
+    }
+  }
+
+  // Without ids the nearest point is found from depth alone
+  bool ids = m_pointShader && m_pointShader->supportsPicking();
+
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  m_pickBuffer->bind();
+  glViewport(0, 0, size, size);
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glEnable(GL_DEPTH_TEST);
+  glDisable(GL_BLEND);
+  glDisable(GL_DITHER);
+
+  // Projection narrowed to the window around the pixel, as gluPickMatrix
+  double screenWidth = camera()->screenWidth();
+  double screenHeight = camera()->screenHeight();
+  double x = pixel.x() + 0.5;
+  double y = screenHeight - pixel.y() - 0.5;
+  glMatrixMode(GL_PROJECTION);
+  glPushMatrix();
+  glLoadIdentity();
+  glTranslated((screenWidth - 2.0 * x)/PickWindow,
+               (screenHeight - 2.0 * y)/PickWindow, 0.0);
+  glScaled(screenWidth/PickWindow, screenHeight/PickWindow, 1.0);
+  camera()->loadProjectionMatrix(false);
+  glMatrixMode(GL_MODELVIEW);
+  glPushMatrix();
+  camera()->loadModelViewMatrix();
+
+  // The points on screen: a still view shows all refined slices
+  int count = pointsToDraw();
+  if(!levelOfDetail)
+    count = qMax(count, m_refinedPoints);
+
+  int pointsDrawn = m_pointsDrawn;
+  m_picking = ids;
+  m_pickNodes.clear();
+  if(ids)
+    m_pointShader->setPicking(true);
+
+  drawPoints(count);
+
+  if(ids)
+    m_pointShader->setPicking(false);
+  m_picking = false;
+  m_pointsDrawn = pointsDrawn;
+
+  QVector<unsigned char> colors(4 * size * size);
+  QVector<GLfloat> depths(size * size);
+  glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, colors.data());
+  glReadPixels(0, 0, size, size, GL_DEPTH_COMPONENT, GL_FLOAT, depths.data());
+
+  glMatrixMode(GL_PROJECTION);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+  glPopMatrix();
+  m_pickBuffer->release();
+  glPopAttrib();
+
+  // Point closest to the cursor, then closest to the eye
+  int best = -1;
+  double bestDistance = 0.0;
+  for(int j = 0; j < size; ++j)
+  {
+    for(int i = 0; i < size; ++i)
+    {
+      int k = j * size + i;
+      if(depths[k] >= 1.0f)
+        continue;
+
+      double dx = i + 0.5 - 0.5 * size;
+      double dy = j + 0.5 - 0.5 * size;
+      double distance = dx * dx + dy * dy;
+      if(best < 0 || distance < bestDistance
+         || (distance == bestDistance && depths[k] < depths[best]))
+      {
+        best = k;
+        bestDistance = distance;
+      }
+    }
+  }
+
+  if(best < 0)
+    return false;
+
+  // Position from depth; replaced by the exact point where it is known
+  int i = best % size;
+  int j = best/size;
+  Vec screen(pixel.x() + 0.5 + (i + 0.5)/ratio - 0.5 * PickWindow,
+             pixel.y() + 0.5 - (j + 0.5)/ratio + 0.5 * PickWindow,
+             depths[best]);
+  Vec local = camera()->unprojectedCoordinatesOf(screen, manipulatedFrame());
+  point.position = QVector3D(local.x, local.y, local.z);
+  point.valid = true;
+
+  const unsigned char *color = colors.constData() + 4 * best;
+  quint32 id = color[0] | color[1] << 8 | color[2] << 16
+      | (quint32)color[3] << 24;
+  if(ids && id != 0)
+  {
+    int index = id - 1;
+    if(levelOfDetail)
+    {
+      // Nodes are in order of their first id
+      int n = m_pickNodes.count() - 1;
+      while(n > 0 && m_pickNodes[n].first > index)
+        --n;
+
+      if(n >= 0)
+      {
+        point.node = m_pickNodes[n].second;
+        index -= m_pickNodes[n].first;
+
+        // Out of core the node may not be in host memory any more
+        const PointCloud points = m_octree->nodePoints(point.node);
+        if(index < points.count())
+          point.position = points.point(index);
+      }
+    } else {
+      point.index = index;
+
+      // Cloud isn't kept while previewing a load
+      if(!m_preview && index < m_pointCloud.count())
+        point.position = m_pointCloud.point(index);
+    }
+  }
+
+  // Octree nodes and depth don't give the cloud index; the nearest point
+  // in the cloud's spatial index does, built by the first such pick
+  if(point.index < 0 && !m_preview && !m_pointCloud.isEmpty())
+  {
+    point.index = m_pointCloud.kdTree().nearest(point.position);
+    point.position = m_pointCloud.point(point.index);
+  }
+
+  return true;
+}
+
+bool Viewer::uploadPointCloud(const PointCloud &cloud)
+{
+  // Decide on position format
+  qint64 fullSize = (qint64)cloud.count()
+      * (3 * sizeof(float) + (cloud.hasColor() ? 3 : 0));
+
+  bool compact = (m_vertexFormat == CompactFormat)
+      || (m_vertexFormat == AutomaticFormat && gpuMemoryBudget() > 0
+          && fullSize > gpuMemoryBudget());
+
+  // Whatever the format, full precision can't go past an int buffer size
+  if((qint64)cloud.count() * 3 * sizeof(float) > INT_MAX)
+    compact = true;
 
-  if(!m_colorBuffer.create())
+  bool result = compact ? bindToCompactVertexBuffer(cloud)
+                        : bindToVertexBuffer(cloud.pointData(), cloud.count());
+  if(!result)
     return false;
 
-  if(!m_colorBuffer.bind())
+  if(cloud.hasColor())
+  {
+    if(!loadColorsToBuffer(cloud.colorData(), cloud.count()))
+    {
+      qDebug() << "Failed loading color data.";
+      return false;
+    }
+  } else {
+    if(m_colorBuffer.isCreated())
+    {
+      m_colorBuffer.destroy();
+    }
+  }
+
+  return true;
+}
+
+bool Viewer::bindToVertexBuffer(const float *vertices, int count)
+{
+  qint64 size = (qint64)count * 3 * sizeof(float);
+  if(size > INT_MAX || !allocateBuffer(m_vertexBuffer, vertices, size))
+    return false;
+
+  m_vertexCount = count;
+  m_compactPositions = false;
+
+  return true;
+}
+
+bool Viewer::bindToCompactVertexBuffer(const PointCloud &cloud)
+{
+  const int count = cloud.count();
+
+  qint64 size = (qint64)count * 3 * sizeof(GLshort);
+  if(size > INT_MAX || !allocateBuffer(m_vertexBuffer, NULL, size))
+    return false;
+
+  // Quantize each axis of the bounding box to the full range of a short;
+  // draw transform maps values back
+  QVector3D min = cloud.boundingBoxMinimum();
+  QVector3D extent = cloud.boundingBoxMaximum() - min;
+  float scale[3];
+  for(int axis = 0; axis < 3; ++axis)
+    scale[axis] = extent[axis] > 0.0f ? 65535.0f/extent[axis] : 0.0f;
+
+  m_dequantizeScale = QVector3D(extent.x()/65535.0f, extent.y()/65535.0f,
+                                extent.z()/65535.0f);
+  m_dequantizeOffset = min + 32768.0f * m_dequantizeScale;
+
+  // Convert and upload in blocks to bound host memory
+  QVector<GLshort> block(qMin(count, QuantizeBlockSize) * 3);
+  const float *points = cloud.pointData();
+
+  m_vertexBuffer.bind();
+  for(int first = 0; first < count; first += QuantizeBlockSize)
+  {
+    int n = qMin(QuantizeBlockSize, count - first);
+    const float *p = points + (size_t)first * 3;
+    for(int i = 0; i < n * 3; ++i)
+    {
+      int axis = i % 3;
+      block[i] = qBound(-32768, qRound((p[i] - min[axis]) * scale[axis]) - 32768,
+                        32767);
+    }
+
+    m_vertexBuffer.write(first * 3 * sizeof(GLshort), block.constData(),
+                         n * 3 * sizeof(GLshort));
+  }
+  m_vertexBuffer.release();
+
+  m_vertexCount = count;
+  m_compactPositions = true;
+
+  return glGetError() == GL_NO_ERROR;
+}
+
+bool Viewer::loadColorsToBuffer(const unsigned char *colors, int count)
+{
+  qint64 size = (qint64)count * 3;
+  return size <= INT_MAX && allocateBuffer(m_colorBuffer, colors, size);
+}
+
+bool Viewer::allocateBuffer(QGLBuffer &buffer, const void *data, int size)
+{
+  // Make OpenGL context current
+  makeCurrent();
+
+  // Destroy currently allocated VBO
+  if(buffer.isCreated())
+    buffer.destroy();
+
+  // Create VBO
+  if(!buffer.create())
+  {
+    // Trigger error and return
+    return false;
+  }
+
+  // Bind VBO
+  if(!buffer.bind())
+  {
     return false;
+  }
+
+  // Load VBO; data may be NULL to only reserve space
+  buffer.allocate(data, size);
+  buffer.release();
 
-  m_colorBuffer.allocate(colors.constData(),
-                          colors.count() * sizeof(float));
+  // Contents changed under a refined view
+  m_refinedPoints = 0;
+
+  // A new buffer may have the name of the one destroyed
+  if(&buffer == &m_vertexBuffer || &buffer == &m_colorBuffer)
+    m_vertexArray.invalidate();
 
   return glGetError() == GL_NO_ERROR;
 }
 
+bool Viewer::levelOfDetailReady() const
+{
+  return m_levelOfDetail && m_octreeReady;
+}
+
+void Viewer::buildOctree()
+{
+  releaseOctree();
+
+  // Build in a worker thread; the flat buffers, if any, are drawn meanwhile
+  m_octree = new Octree(m_pointCloud);
+  QThread *thread = new QThread(this);
+  m_octree->moveToThread(thread);
+
+  connect(thread, SIGNAL(started()), m_octree, SLOT(run()));
+  connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+  connect(m_octree, SIGNAL(finished()), thread, SLOT(quit()));
+  connect(m_octree, SIGNAL(finished()), SLOT(octreeBuilt()));
+
+  displayMessage("Building level of detail...");
+
+  thread->start();
+}
+
+void Viewer::octreeBuilt()
+{
+  Octree *octree = qobject_cast<Octree *>(sender());
+  if(!octree)
+    return;
+
+  // Ignore abandoned builds
+  if(octree != m_octree || !octree->isBuilt())
+  {
+    if(octree == m_octree)
+      m_octree = NULL;
+    octree->deleteLater();
+    return;
+  }
+
+  m_octreeReady = true;
+
+  // Nodes replace the flat buffers
+  m_vertexBuffer.destroy();
+  m_colorBuffer.destroy();
+  m_vertexCount = 0;
+  m_preview = false;
+
+  update();
+}
+
+void Viewer::releaseOctree()
+{
+  if(!m_octree)
+    return;
+
+  if(m_octreeReady)
+  {
+    delete m_octree;
+  } else {
+    // Build still running; octreeBuilt() deletes it once it stops
+    m_octree->cancel();
+  }
+
+  m_octree = NULL;
+  m_octreeReady = false;
+}
+
+int Viewer::drawLevelOfDetail(int budget)
+{
+  ++m_frameCount;
+  m_octree->beginFrame();
+
+  GLdouble planes[6][4];
+  camera()->getFrustumPlanesCoefficients(planes);
+
+  // Visit visible nodes largest on screen first; parents always come before
+  // their children since they are larger
+  typedef QPair<float, int> Candidate;
+  std::priority_queue<Candidate> queue;
+
+  float rootSize = nodeScreenSize(0, planes);
+  if(rootSize >= 0.0f)
+    queue.push(Candidate(rootSize, 0));
+
+  int drawn = 0;
+  int uploadsLeft = MaxNodeUploadsPerFrame;
+  bool incomplete = false;
+
+  while(!queue.empty() && drawn < budget)
+  {
+    Candidate candidate = queue.top();
+    queue.pop();
+
+    const Octree::Node& node = m_octree->node(candidate.second);
+
+    // Nodes above out of core chunks may be empty; go straight to children
+    if(node.count > 0)
+    {
+      // Larger nodes are read from disk first
+      int priority = qMin(candidate.first, 1e6f);
+      NodeBuffer *buffer = nodeBuffer(candidate.second, priority, uploadsLeft);
+      if(!buffer)
+      {
+        // Not resident yet; parent stands in for it and its children.  Nodes
+        // read from disk trigger a redraw through nodeLoaded().
+        incomplete = incomplete || uploadsLeft == 0;
+        continue;
+      }
+
+      // Node points are shuffled, so a prefix is an even subsample
+      int count = qMin(node.count, budget - drawn);
+      if(m_picking)
+      {
+        // Ids of this node follow those of nodes drawn before it
+        m_pickNodes.append(qMakePair(drawn, candidate.second));
+        m_pointShader->setPickBase(drawn);
+      }
+      drawArrays(buffer->vertices, buffer->colors, buffer->array, GL_FLOAT, 0,
+                 count);
+      drawn += count;
+
+      // Refine while this node's points would leave gaps on screen
+      float spacing = 2.0f * candidate.first/qSqrt(node.count);
+      if(spacing <= m_pointSize)
+        continue;
+    }
+
+    for(int i = 0; i < 8; ++i)
+    {
+      if(node.children[i] < 0)
+        continue;
+
+      float size = nodeScreenSize(node.children[i], planes);
+      if(size >= 0.0f)
+        queue.push(Candidate(size, node.children[i]));
+    }
+  }
+
+  // Keep drawing until all selected nodes are uploaded
+  if(incomplete)
+    QTimer::singleShot(0, this, SLOT(update()));
+
+  return drawn;
+}
+
+float Viewer::nodeScreenSize(int index, GLdouble planes[6][4])
+{
+  const Octree::Node& node = m_octree->node(index);
+
+  // Nodes are in the turntable frame
+  QVector3D local = node.center();
+  Vec center = manipulatedFrame()->inverseCoordinatesOf(
+        Vec(local.x(), local.y(), local.z()));
+  float radius = node.radius();
+
+  // Planes face outward
+  for(int i = 0; i < 6; ++i)
+  {
+    double distance = planes[i][0] * center.x + planes[i][1] * center.y
+        + planes[i][2] * center.z - planes[i][3];
+    if(distance > radius)
+      return -1.0f;
+  }
+
+  // Projected radius in pixels
+  float ratio = camera()->pixelGLRatio(center);
+  if(ratio <= 0.0f)
+    return FLT_MAX;
+
+  return radius/ratio;
+}
+
+Viewer::NodeBuffer *Viewer::nodeBuffer(int index, int priority,
+                                       int &uploadsLeft)
+{
+  NodeBuffer *buffer = m_nodeBuffers.value(index, NULL);
+  if(buffer)
+  {
+    buffer->lastUsed = m_frameCount;
+    return buffer;
+  }
+
+  // Out of core this only queues a read unless the node is in host memory
+  const PointCloud points = m_octree->nodePoints(index, priority);
+  if(points.isEmpty() || uploadsLeft <= 0)
+    return NULL;
+
+  qint64 size = (qint64)points.count()
+      * (3 * sizeof(float) + (points.hasColor() ? 3 : 0));
+  if(!reserveNodeMemory(size))
+    return NULL;
+
+  --uploadsLeft;
+
+  buffer = new NodeBuffer;
+  buffer->size = size;
+  buffer->lastUsed = m_frameCount;
+
+  bool result = allocateBuffer(buffer->vertices, points.pointData(),
+                               points.count() * 3 * sizeof(float));
+  if(result && points.hasColor())
+    result = allocateBuffer(buffer->colors, points.colorData(),
+                            points.count() * 3);
+
+  if(!result)
+  {
+    buffer->vertices.destroy();
+    buffer->colors.destroy();
+    delete buffer;
+    return NULL;
+  }
+
+  m_nodeBuffers.insert(index, buffer);
+  m_nodeBufferMemory += size;
+
+  return buffer;
+}
+
+bool Viewer::reserveNodeMemory(qint64 size)
+{
+  // Evict least recently used nodes not drawn in the current frame
+  while(m_nodeBufferMemory + size > levelOfDetailMemoryBudget())
+  {
+    int oldest = -1;
+    int oldestFrame = m_frameCount;
+
+    QHash<int, NodeBuffer *>::const_iterator i;
+    for(i = m_nodeBuffers.constBegin(); i != m_nodeBuffers.constEnd(); ++i)
+    {
+      if(i.value()->lastUsed < oldestFrame)
+      {
+        oldest = i.key();
+        oldestFrame = i.value()->lastUsed;
+      }
+    }
+
+    if(oldest < 0)
+      return false;
+
+    NodeBuffer *buffer = m_nodeBuffers.take(oldest);
+    buffer->vertices.destroy();
+    buffer->colors.destroy();
+    m_nodeBufferMemory -= buffer->size;
+    delete buffer;
+  }
+
+  return true;
+}
+
+void Viewer::clearNodeBuffers()
+{
+  if(m_nodeBuffers.isEmpty())
+    return;
+
+  makeCurrent();
+
+  foreach(NodeBuffer *buffer, m_nodeBuffers)
+  {
+    buffer->vertices.destroy();
+    buffer->colors.destroy();
+    delete buffer;
+  }
+
+  m_nodeBuffers.clear();
+  m_nodeBufferMemory = 0;
+}
+
+qint64 Viewer::levelOfDetailMemoryBudget() const
+{
+  if(gpuMemoryBudget() > 0)
+    return gpuMemoryBudget();
+
+  return DefaultLevelOfDetailMemory;
+}
+
+qint64 Viewer::bufferMemory() const
+{
+  // Computed rather than queried; QGLBuffer::size() reads back from the
+  // driver, which is too slow for every frame
+  qint64 vertexSize = m_compactPositions ? 3 * sizeof(GLshort)
+                                         : 3 * sizeof(float);
+  qint64 size = m_nodeBufferMemory;
+  if(m_vertexBuffer.isCreated())
+    size += m_vertexCount * vertexSize;
+  if(m_colorBuffer.isCreated())
+    size += m_vertexCount * 3;
+
+  return size;
+}
+
+qint64 Viewer::detectGPUMemory()
+{
+  makeCurrent();
+
+  QOpenGLContext *context = QOpenGLContext::currentContext();
+  if(!context)
+    return 0;
+
+  // Values are reported in kilobytes
+  if(context->hasExtension("GL_NVX_gpu_memory_info"))
+  {
+    GLint available = 0;
+    glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+    return (qint64)available * 1024;
+  }
+
+  if(context->hasExtension("GL_ATI_meminfo"))
+  {
+    GLint info[4] = { 0, 0, 0, 0 };
+    glGetIntegerv(GL_VBO_FREE_MEMORY_ATI, info);
+    return (qint64)info[0] * 1024;
+  }
+
+  return 0;
+}
+
+qint64 Viewer::gpuMemoryBudget() const
+{
+  // Leave headroom for framebuffers and other allocations when using the
+  // driver's figure
+  if(m_gpuMemoryBudget > 0)
+    return m_gpuMemoryBudget;
+
+  return m_detectedGPUMemory * 0.8;
+}
+
 void Viewer::notifyStereoParametersChanged()
 {
   emit IODistanceChanged((double) camera()->IODistance());
@@ -727,8 +2625,14 @@ void Viewer::keyPressEvent(QKeyEvent *e)
   {
   case Qt::Key_P:
     toggleSmoothPoints(); break;
+  case Qt::Key_E:
+    setEyeDomeLighting(!m_eyeDomeLightingEnabled); break;
   case Qt::Key_Escape:
-    if(isFullScreen()) setFullScreen(false); break;
+    if(!m_measurePoints.isEmpty())
+      clearMeasurement();
+    else if(isFullScreen())
+      setFullScreen(false);
+    break;
   case Qt::Key_R:
     restoreView(); break;
   case Qt::Key_S:
@@ -741,6 +2645,13 @@ void Viewer::keyPressEvent(QKeyEvent *e)
     else if(e->modifiers() == Qt::ShiftModifier)
       resetTurntable();
     break;
+  case Qt::Key_F:
+    // Shift-F; plain 'f' is the QGLViewer frame rate display
+    if(e->modifiers() == Qt::ShiftModifier)
+      togglePerformanceOverlay();
+    else
+      QGLViewer::keyPressEvent(e);
+    break;
   case Qt::Key_Plus:
   case Qt::Key_Equal:
     increaseTurntableSpeed(); break;
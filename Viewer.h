@@ -3,8 +3,14 @@
 
 #include <QGLViewer/qglviewer.h>
 #include <QGLBuffer>
+#include <QGLFramebufferObject>
 #include <QPixmap>
+#include <QHash>
 #include "PointCloud.h"
+#include "Octree.h"
+#include "FrameStatistics.h"
+#include "PointShader.h"
+#include "EyeDomeLighting.h"
 
 using namespace qglviewer;
 class Viewer : public QGLViewer
@@ -12,8 +18,14 @@ class Viewer : public QGLViewer
     Q_OBJECT
 public:
   explicit Viewer(QWidget *parent = 0);
+  ~Viewer();
 
   bool setPointCloud(const PointCloud& cloud);
+  // Cloud in host memory, in drawing order: grouped into chunks, so only
+  // random within each.  Empty while previewing or out of core.
+  const PointCloud& pointCloud() const { return m_pointCloud; }
+  // Out of core hierarchy written by OctreeWriter
+  bool openOctree(const QString& path);
 
   bool multisampleAvailable() const;
 
@@ -34,6 +46,87 @@ public:
 
   StereoMode stereoMode() const { return m_stereoMode; }
 
+  // Single pass stereo draws both eyes with one instanced draw per buffer;
+  // it needs the shader renderer and GLSL 1.30, otherwise each eye is drawn
+  // in turn
+  bool singlePassStereo() const { return m_singlePassStereo; }
+  bool singlePassStereoAvailable() const;
+
+  // Vertex layout in GPU memory.  Colors are always 8-bit; compact format also
+  // quantizes positions to 16 bits relative to the bounding box.  Automatic
+  // picks compact only when full precision would exceed the GPU memory budget.
+  enum VertexFormat
+  {
+    AutomaticFormat,
+    FullFormat,
+    CompactFormat
+  };
+
+  VertexFormat vertexFormat() const { return m_vertexFormat; }
+
+  // Spatial order sorts the points of a flat cloud by Morton code within
+  // strata (see PointCloud::sortStrata()) and draws whole strata only, so
+  // the points drawn stay a uniform sample
+  bool spatialOrder() const { return m_spatialOrder; }
+
+  // Flat clouds are partitioned into chunks of nearby points; with frustum
+  // culling, chunks outside the view are skipped
+  bool frustumCulling() const { return m_frustumCulling; }
+
+  // Level of detail draws octree nodes picked by screen size up to the point
+  // budget instead of a prefix of the whole cloud
+  bool levelOfDetail() const { return m_levelOfDetail; }
+  int pointBudget() const { return m_pointBudget; }
+  // Whether frames are drawn from the octree; it is built in the background
+  bool levelOfDetailReady() const;
+  // Whether points are drawn with shaders; chosen in init() with the
+  // fixed-function pipeline as fallback
+  bool shaderRendering() const { return m_pointShader != NULL; }
+  // Eye-dome lighting shades points from depth; needs shaders and
+  // framebuffer objects and is ignored without them
+  bool eyeDomeLighting() const { return m_eyeDomeLightingEnabled; }
+  double eyeDomeStrength() const { return m_eyeDomeStrength; }
+  double eyeDomeRadius() const { return m_eyeDomeRadius; }
+
+  // Points drawn in the last frame
+  int pointsDrawn() const { return m_pointsDrawn; }
+
+  // Point under the cursor, found from the points as drawn.  With shaders
+  // ids are drawn around the cursor to identify the exact point, and node
+  // is the octree node it was drawn from with level of detail.  Otherwise
+  // the position comes from depth.  Where the cloud is in memory, index is
+  // into it, found through its k-d tree when ids don't give it; else -1.
+  struct PickedPoint
+  {
+    PickedPoint() : valid(false), index(-1), node(-1) {}
+
+    bool valid;
+    int index;
+    int node;
+    // Cloud coordinates, i.e. in the turntable frame
+    QVector3D position;
+  };
+
+  bool pickPoint(const QPoint& pixel, PickedPoint& point);
+
+  // Measurements are made from points picked with Shift-click
+  enum MeasureMode
+  {
+    NoMeasure,
+    DistanceMeasure,
+    AreaMeasure,
+    HeightMeasure
+  };
+
+  MeasureMode measureMode() const { return m_measureMode; }
+  const QVector<QVector3D>& measurePoints() const { return m_measurePoints; }
+  // Result of the current measurement as text; empty until enough points
+  QString measurement() const;
+
+  // Overlay with frame, draw and GPU times, points and buffer memory
+  bool performanceOverlay() const { return m_performanceOverlay; }
+  bool frameLogging() const { return m_frameStatistics.isLogging(); }
+
   QStringList openGLInfo();
   QStringList pointCloudInfo();
 
@@ -44,17 +137,35 @@ signals:
   void pointColorChanged(bool);
   void depthMaskingChanged(bool);
   void multisampleChanged(bool);
+  void spatialOrderChanged(bool);
+  void vertexFormatChanged(Viewer::VertexFormat);
 
   void fastInteractionChanged(bool);
+  void targetFrameRateChanged(int);
+  void performanceOverlayChanged(bool);
+
+  void levelOfDetailChanged(bool);
+  void eyeDomeLightingChanged(bool);
+  void eyeDomeStrengthChanged(double);
+  void eyeDomeRadiusChanged(double);
+  void pointBudgetChanged(int);
 
   // Signals for changes in stereo parameters
   void IODistanceChanged(double);
   void focusDistanceChanged(double);
   void physicalScreenWidthChanged(double);
   void stereoModeChanged(StereoMode);
+
+  void measureModeChanged(Viewer::MeasureMode);
+  void measurementChanged(QString);
   void error(QString);
 
 public slots:
+  // Progressive display while a cloud is loading; setPointCloud() replaces
+  // the preview with the final cloud
+  void beginPointCloud(int count, bool hasColor);
+  void appendPoints(int first, const PointCloud& chunk);
+
   void setPointSize(int pointSize);
   void setPointDensity(int density);
   void setSmoothPoints(bool smoothPoints);
@@ -65,6 +176,30 @@ public slots:
   void setMultisample(bool value);
 
   void setFastInteraction(bool value);
+  // Frames per second fast interaction adapts its point count to
+  void setTargetFrameRate(int framesPerSecond);
+
+  void setPerformanceOverlay(bool value);
+  void togglePerformanceOverlay();
+  // Writes frame statistics as CSV until stopped
+  bool startFrameLog(const QString& path);
+  void stopFrameLog();
+
+  void setVertexFormat(VertexFormat format);
+  void setSpatialOrder(bool value);
+  void setFrustumCulling(bool value);
+  // Budget in megabytes; 0 uses the amount reported by the driver, if any
+  void setGPUMemoryBudget(int megabytes);
+  // Node cache of out of core hierarchies in megabytes; 0 uses the default
+  void setHostMemoryBudget(int megabytes);
+
+  void setLevelOfDetail(bool value);
+
+  void setEyeDomeLighting(bool value);
+  void setEyeDomeStrength(double strength);
+  // Radius in pixels
+  void setEyeDomeRadius(double radius);
+  void setPointBudget(int points);
 
   void restoreView();
 
@@ -76,6 +211,13 @@ public slots:
   void setStereo(bool stereo = true);
   void toggleStereo();
   void setStereoMode(StereoMode mode);
+  void setSinglePassStereo(bool value);
+
+  void setMeasureMode(Viewer::MeasureMode mode);
+  void clearMeasurement();
+  // Picks the point under pixel; with a measure mode it is added to the
+  // measurement
+  void select(const QPoint& pixel);
 
   void toggleTurntable();
   void resetTurntable();
@@ -88,6 +230,10 @@ public slots:
 
   void savePathMovie();
 
+protected slots:
+  void octreeBuilt();
+  void releaseOctree();
+
 protected:
   void init();
   void draw();
@@ -96,26 +242,141 @@ protected:
   void drawSideBySideStereo();
   void drawStackedStereo();
   void drawHardwareStereo();
+  // Both eyes into the current viewport, split side by side or stacked
+  bool drawSinglePassStereo(bool vertical);
+  // Both eyes side by side into m_stereoBuffer for modes that combine them
+  bool drawStereoBuffer();
+  void drawStereoHalf(int eye);
   void postDraw();
+  void drawPerformanceOverlay();
+  void drawMeasurement();
   void fastDraw();
   void paintGL();
   void keyPressEvent(QKeyEvent *);
 
-  bool bindToVertexBuffer(const QVector<float> &vertices);
-  bool loadColorsToBuffer(const QVector<float> &colors);
+  bool uploadPointCloud(const PointCloud& cloud);
+  bool bindToVertexBuffer(const float *vertices, int count);
+  bool bindToCompactVertexBuffer(const PointCloud& cloud);
+  bool loadColorsToBuffer(const unsigned char *colors, int count);
+  bool allocateBuffer(QGLBuffer &buffer, const void *data, int size);
+
+  int pointsToDraw() const;
+  // Camera or turntable moving, or a camera path playing
+  bool isInteracting() const;
+  void updateInteractionBudget(double frameMs);
+  // Draws count points of the cloud starting at first, or the octree with
+  // a budget of count.  Returns the points of the cloud's range covered,
+  // drawn or culled.
+  int drawPoints(int count, int first = 0);
+  // Draws points with eye-dome lighting when enabled
+  void drawShadedPoints(int count);
+  void drawArrays(QGLBuffer &vertices, QGLBuffer &colors,
+                  PointShader::VertexArray &array, GLenum positionType,
+                  int first, int count);
+  void drawArrays(QGLBuffer &vertices, QGLBuffer &colors,
+                  PointShader::VertexArray &array, GLenum positionType,
+                  const GLint *first, const GLsizei *count, int ranges);
+
+  // Orders the flat cloud for drawing, from shuffled: sorted strata with
+  // spatial order, then partitioned into chunks
+  void arrangePointCloud();
+  // Draws the share of each visible chunk of count points from first in
+  // the order before partitioning; returns the points drawn
+  int drawChunks(int first, int count);
+  bool chunkVisible(const PointCloud::Chunk& chunk, GLdouble planes[6][4]);
+
+  // Accumulates further slices of the cloud into a framebuffer while the
+  // view is still and shows it; false if the view is drawn directly
+  bool drawRefinement();
+  QVector<double> refinementKey() const;
+
+  void buildOctree();
+  int drawLevelOfDetail(int budget);
+  float nodeScreenSize(int index, GLdouble planes[6][4]);
+
+  struct NodeBuffer
+  {
+    QGLBuffer vertices;
+    QGLBuffer colors;
+    PointShader::VertexArray array;
+    qint64 size;
+    int lastUsed;
+  };
+
+  NodeBuffer *nodeBuffer(int index, int priority, int &uploadsLeft);
+  bool reserveNodeMemory(qint64 size);
+  void clearNodeBuffers();
+  qint64 levelOfDetailMemoryBudget() const;
+
+  // Vertex buffer memory holding the cloud and octree nodes
+  qint64 bufferMemory() const;
+
+  qint64 detectGPUMemory();
+  qint64 gpuMemoryBudget() const;
 
   void notifyStereoParametersChanged();
 
 private:
   QString speedToString();
+  // Histogram as a short line of bars for pointCloudInfo()
+  static QString histogramText(const QVector<qint64>& histogram);
 
   // Vertex buffer object for point cloud
   QGLBuffer m_vertexBuffer;
   QGLBuffer m_colorBuffer;
 
+  // Shader renderer, if supported, and the vertex array of the cloud
+  PointShader *m_pointShader;
+  PointShader::VertexArray m_vertexArray;
+
+  // Eye-dome lighting pass, if supported, and its settings
+  EyeDomeLighting *m_eyeDomeLighting;
+  bool m_eyeDomeLightingEnabled;
+  double m_eyeDomeStrength;
+  double m_eyeDomeRadius;
+
   // Total number of vertices for point cloud
   int m_vertexCount;
 
+  // Vertex format selection and state of uploaded buffers
+  VertexFormat m_vertexFormat;
+  bool m_compactPositions;
+  bool m_spatialOrder;
+
+  // Chunks of the flat cloud, the strata they are counted over, and the
+  // ranges of the last draw
+  QVector<PointCloud::Chunk> m_chunks;
+  QVector<int> m_strata;
+  bool m_frustumCulling;
+  QVector<GLint> m_chunkFirsts;
+  QVector<GLsizei> m_chunkCounts;
+  QVector3D m_dequantizeOffset;
+  QVector3D m_dequantizeScale;
+  qint64 m_detectedGPUMemory;
+  qint64 m_gpuMemoryBudget;
+  qint64 m_hostMemoryBudget;
+
+  // Level of detail hierarchy and the nodes resident in GPU memory
+  bool m_levelOfDetail;
+  int m_pointBudget;
+  Octree *m_octree;
+  bool m_octreeReady;
+  QHash<int, NodeBuffer *> m_nodeBuffers;
+  qint64 m_nodeBufferMemory;
+  int m_frameCount;
+  int m_pointsDrawn;
+
+  // Progressive refinement of a still view; restarts when the key of view
+  // and display options changes
+  QGLFramebufferObject *m_refinementBuffer;
+  QVector<double> m_refinementKey;
+  int m_refinedPoints;
+
+  // Set while showing a partially loaded cloud
+  bool m_preview;
+  QVector3D m_previewMin;
+  QVector3D m_previewMax;
+
   // Point cloud display options
   float m_density;
   float m_pointSize;
@@ -125,7 +386,14 @@ private:
   bool m_multisample;
   bool m_fastInteraction;
 
-  int m_fastInteractionMax;
+  // Points drawn while interacting, adapted to the target frame rate
+  int m_targetFrameRate;
+  int m_interactionBudget;
+  double m_interactionFrameMs;
+
+  // Frame timing; only measured while shown or logged
+  FrameStatistics m_frameStatistics;
+  bool m_performanceOverlay;
 
   // Swap eyes for stereo
   bool m_swapLeftRight;
@@ -133,6 +401,18 @@ private:
   bool m_stereo;
   // Stereo mode
   StereoMode m_stereoMode;
+  bool m_singlePassStereo;
+  // Eyes side by side for anaglyph and hardware stereo in a single pass
+  QGLFramebufferObject *m_stereoBuffer;
+
+  // Window around the cursor drawn when picking, and while ids are drawn
+  // the first id of each octree node drawn
+  QGLFramebufferObject *m_pickBuffer;
+  bool m_picking;
+  QVector<QPair<int, int> > m_pickNodes;
+
+  MeasureMode m_measureMode;
+  QVector<QVector3D> m_measurePoints;
 
   // Onscreen logo
   QPixmap m_logoPixmap;
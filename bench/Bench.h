@@ -0,0 +1,76 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <QCommandLineOption>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+#include <algorithm>
+
+// Helpers shared by the benchmarks
+namespace Bench
+{
+  inline double milliseconds(qint64 nanoseconds)
+  {
+    return nanoseconds/1e6;
+  }
+
+  inline double megabytes(qint64 bytes)
+  {
+    return bytes/(1024.0 * 1024.0);
+  }
+
+  // Mean, median and 95th percentile of a series
+  inline QJsonObject summary(QVector<double> values)
+  {
+    QJsonObject result;
+    if(values.isEmpty())
+      return result;
+
+    std::sort(values.begin(), values.end());
+
+    double sum = 0.0;
+    foreach(double value, values)
+      sum += value;
+
+    result["mean"] = sum/values.count();
+    result["median"] = values.at(values.count()/2);
+    result["p95"] = values.at(qMin(values.count() - 1,
+                                   (int)(values.count() * 0.95)));
+    result["max"] = values.last();
+
+    return result;
+  }
+
+  inline QCommandLineOption outputOption()
+  {
+    return QCommandLineOption(QStringList() << "o" << "output",
+                              "Write JSON to file instead of stdout.", "file");
+  }
+
+  // Writes result to path, or to stdout if path is empty
+  inline bool writeJson(const QJsonObject& result, const QString& path)
+  {
+    QByteArray json = QJsonDocument(result).toJson();
+
+    if(path.isEmpty())
+    {
+      QTextStream(stdout) << json;
+      return true;
+    }
+
+    QFile file(path);
+    if(!file.open(QIODevice::WriteOnly) || file.write(json) != json.size())
+    {
+      QTextStream(stderr) << "Unable to write " << path << endl;
+      return false;
+    }
+
+    return true;
+  }
+}
+
+#endif // BENCH_H
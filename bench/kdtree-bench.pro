@@ -0,0 +1,11 @@
+# k-d tree build and query micro-benchmark; see kdtree.cpp for usage
+
+TARGET = nimbus-kdtree-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../Nimbus.pri)
+
+SOURCES += kdtree.cpp
+HEADERS += Bench.h
@@ -0,0 +1,221 @@
+// Measures k-d tree build time and query latency on uniform clouds of
+// several sizes, and how point order affects queries that read the points
+// they find, reporting JSON, e.g.
+//
+//   nimbus-kdtree-bench --points 1000000,10000000,100000000 > kdtree.json
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTextStream>
+#include <QtCore/qmath.h>
+#include <algorithm>
+#include <cfloat>
+#include "PointGenerator.h"
+#include "KdTree.h"
+#include "Parallel.h"
+#include "Random.h"
+#include "MemoryUsage.h"
+#include "Bench.h"
+
+// Times query(position) at random positions in the unit cube and returns
+// latencies in microseconds with the mean number of points found
+template <typename Query>
+static QJsonObject timeQueries(int queries, quint64 seed, Query query)
+{
+  Random random(seed, 1);
+  QVector<double> latencies;
+  qint64 found = 0;
+
+  QElapsedTimer timer;
+  for(int i = 0; i < queries; ++i)
+  {
+    QVector3D position(random.uniform(-0.5, 0.5), random.uniform(-0.5, 0.5),
+                       random.uniform(-0.5, 0.5));
+
+    timer.start();
+    found += query(position);
+    latencies << timer.nsecsElapsed()/1e3;
+  }
+
+  QJsonObject result;
+  result["latencyUs"] = Bench::summary(latencies);
+  result["meanFound"] = queries > 0 ? (double)found/queries : 0.0;
+  return result;
+}
+
+// Times queries that read back the points they find, over a cloud's own
+// tree: cropping a box and summing positions within a radius, both holding
+// about points points
+static QJsonObject timeReads(const PointCloud& cloud, int queries,
+                             quint64 seed, int points)
+{
+  QJsonObject result;
+  const KdTree& tree = cloud.kdTree();
+
+  const int count = cloud.count();
+  double half = 0.5 * qPow((double)points/count, 1.0/3.0);
+  QVector3D extent(half, half, half);
+  result["crop"] = timeQueries(queries, seed, [&](const QVector3D& p) {
+    return cloud.crop(p - extent, p + extent).count();
+  });
+
+  double radius = qPow(3.0 * points/(4.0 * M_PI * count), 1.0/3.0);
+  const float *data = cloud.pointData();
+  result["radiusSum"] = timeQueries(queries, seed, [&](const QVector3D& p) {
+    QVector<int> found = tree.withinRadius(p, radius);
+    std::sort(found.begin(), found.end());
+
+    QVector3D sum;
+    foreach(int i, found)
+    {
+      const float *q = data + (size_t)i * 3;
+      sum += QVector3D(q[0], q[1], q[2]);
+    }
+
+    // Keep the sum from being optimized away
+    return sum.isNull() ? 0 : found.count();
+  });
+
+  return result;
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("nimbus-kdtree-bench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Measures k-d tree build and query "
+                                   "performance.");
+  parser.addHelpOption();
+  QCommandLineOption pointsOption("points", "Comma separated cloud sizes.",
+                                  "counts", "1000000,10000000,100000000");
+  QCommandLineOption queriesOption("queries", "Queries of each kind.",
+                                   "count", "10000");
+  QCommandLineOption neighborsOption("k", "Neighbors per nearest query.",
+                                     "count", "8");
+  QCommandLineOption boxOption("box-points", "Points expected in each box "
+                               "query.", "count", "1000");
+  QCommandLineOption readOption("read-points", "Points read back by each "
+                                "query comparing point orders.", "count",
+                                "100000");
+  QCommandLineOption seedOption("seed", "Seed of clouds and queries.",
+                                "seed", "1");
+  QCommandLineOption outputOption = Bench::outputOption();
+  parser.addOption(pointsOption);
+  parser.addOption(queriesOption);
+  parser.addOption(neighborsOption);
+  parser.addOption(boxOption);
+  parser.addOption(readOption);
+  parser.addOption(seedOption);
+  parser.addOption(outputOption);
+  parser.process(app);
+
+  const int queries = qMax(1, parser.value(queriesOption).toInt());
+  const int k = qMax(1, parser.value(neighborsOption).toInt());
+  const int boxPoints = qMax(1, parser.value(boxOption).toInt());
+  const int readPoints = qMax(1, parser.value(readOption).toInt());
+  // Reading queries are slower; fewer of them
+  const int readQueries = qMin(queries, 100);
+  const quint64 seed = parser.value(seedOption).toULongLong();
+
+  QTextStream err(stderr);
+  QJsonArray runs;
+
+  foreach(const QString& value, parser.value(pointsOption).split(','))
+  {
+    bool ok = false;
+    int count = value.trimmed().toInt(&ok);
+    if(!ok || count <= 0)
+    {
+      err << "Invalid point count " << value << endl;
+      return 1;
+    }
+
+    err << "Building tree over " << count << " points" << endl;
+
+    // Uniform in the unit cube, so expected counts follow from volume
+    PointGenerator generator;
+    generator.setSeed(seed);
+    PointCloud cloud = generator.createPointCloud("Cube", count, false);
+
+    QJsonObject run;
+    run["points"] = count;
+
+    QElapsedTimer timer;
+    timer.start();
+    const KdTree& tree = cloud.kdTree();
+    run["buildMs"] = Bench::milliseconds(timer.nsecsElapsed());
+    run["treeMemoryMB"] = Bench::megabytes(tree.memoryUsage());
+
+    run["nearest"] = timeQueries(queries, seed, [&](const QVector3D& p) {
+      return tree.nearest(p) >= 0 ? 1 : 0;
+    });
+    run["kNearest"] = timeQueries(queries, seed, [&](const QVector3D& p) {
+      return tree.nearest(p, k).count();
+    });
+
+    // Sphere and cube holding the expected numbers of points
+    double radius = qPow(3.0 * k/(4.0 * M_PI * count), 1.0/3.0);
+    run["radius"] = timeQueries(queries, seed, [&](const QVector3D& p) {
+      return tree.withinRadius(p, radius).count();
+    });
+
+    double half = 0.5 * qPow((double)boxPoints/count, 1.0/3.0);
+    QVector3D extent(half, half, half);
+    run["box"] = timeQueries(queries, seed, [&](const QVector3D& p) {
+      return tree.withinBox(p - extent, p + extent).count();
+    });
+
+    // Linear scan for comparison; few queries as each reads every point
+    run["scanNearest"] = timeQueries(qMin(queries, 10), seed,
+                                     [&](const QVector3D& p) {
+      const float *points = cloud.pointData();
+      float best = FLT_MAX;
+      for(int i = 0; i < count; ++i)
+      {
+        const float *q = points + (size_t)i * 3;
+        float x = q[0] - p.x(), y = q[1] - p.y(), z = q[2] - p.z();
+        best = qMin(best, x * x + y * y + z * z);
+      }
+      return best < FLT_MAX ? 1 : 0;
+    });
+
+    // Generated points are in random order, as a shuffled cloud is; the
+    // same points sorted into spatial strata as the viewer draws them
+    QJsonObject order;
+    order["shuffled"] = timeReads(cloud, readQueries, seed, readPoints);
+
+    PointCloud sorted = cloud;
+    timer.restart();
+    sorted.sortStrata();
+    order["sortMs"] = Bench::milliseconds(timer.nsecsElapsed());
+
+    timer.restart();
+    sorted.kdTree();
+    order["spatialBuildMs"] = Bench::milliseconds(timer.nsecsElapsed());
+    order["spatial"] = timeReads(sorted, readQueries, seed, readPoints);
+
+    run["pointOrder"] = order;
+
+    runs.append(run);
+  }
+
+  QJsonObject result;
+  result["queries"] = queries;
+  result["k"] = k;
+  result["readPoints"] = readPoints;
+  result["leafSize"] = KdTree::LeafSize;
+  result["threads"] = Parallel::threadCount();
+  result["runs"] = runs;
+  result["peakResidentMB"] = Bench::megabytes(MemoryUsage::peakResident());
+
+  if(!Bench::writeJson(result, parser.value(outputOption)))
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,11 @@
+# PLY decoder throughput benchmark; see loader.cpp for usage
+
+TARGET = nimbus-loader-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../Nimbus.pri)
+
+SOURCES += loader.cpp
+HEADERS += Bench.h
@@ -0,0 +1,169 @@
+// Loads the same PLY files with each decoder that can read them and reports
+// points per second as JSON, e.g.
+//
+//   nimbus-loader-bench scene.ply > loader.json
+//
+// Without files, a binary and an ASCII file of --points generated points are
+// written to a temporary directory and loaded.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <algorithm>
+#include "PLYLoader.h"
+#include "PLYWriter.h"
+#include "PointGenerator.h"
+#include "Parallel.h"
+#include "MemoryUsage.h"
+#include "Bench.h"
+
+// Writes cloud to path
+static bool writeScene(const QString& path, const PointCloud& cloud,
+                       bool ascii)
+{
+  PLYWriter writer;
+  writer.setAscii(ascii);
+  return writer.open(path, cloud.count(), cloud.hasColor())
+      && writer.write(cloud) && writer.close();
+}
+
+// Median load time of path with decoder over repeats runs; empty if the
+// decoder can't read the file
+static QJsonObject timeDecoder(const QString& path, PLYLoader::Decoder decoder,
+                               int repeats)
+{
+  QJsonObject result;
+  QVector<double> times;
+  int points = 0;
+
+  for(int i = 0; i < repeats; ++i)
+  {
+    PLYLoader loader;
+    if(!loader.open(path))
+      return result;
+    loader.setDecoder(decoder);
+
+    QElapsedTimer timer;
+    timer.start();
+    PointCloud cloud = loader.load();
+    qint64 elapsed = timer.nsecsElapsed();
+
+    if(cloud.isEmpty())
+      return result;
+
+    points = cloud.count();
+    times << Bench::milliseconds(elapsed);
+  }
+
+  std::sort(times.begin(), times.end());
+  double median = times.at(times.count()/2);
+
+  result["points"] = points;
+  result["medianMs"] = median;
+  result["pointsPerSecond"] = median > 0.0 ? points * 1000.0/median : 0.0;
+  return result;
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("nimbus-loader-bench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Compares PLY decoder throughput.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("files", "PLY files to load.", "[files...]");
+  QCommandLineOption pointsOption("points", "Points of the generated file.",
+                                  "count", "10000000");
+  QCommandLineOption repeatOption("repeat", "Loads per decoder; the median "
+                                  "is reported.", "count", "3");
+  QCommandLineOption seedOption("seed", "Seed of the generated file.", "seed",
+                                "1");
+  QCommandLineOption outputOption = Bench::outputOption();
+  parser.addOption(pointsOption);
+  parser.addOption(repeatOption);
+  parser.addOption(seedOption);
+  parser.addOption(outputOption);
+  parser.process(app);
+
+  const int repeats = qMax(1, parser.value(repeatOption).toInt());
+  const quint64 seed = parser.value(seedOption).toULongLong();
+
+  QTextStream err(stderr);
+  QTemporaryDir directory;
+  QStringList paths = parser.positionalArguments();
+
+  if(paths.isEmpty())
+  {
+    int count = qMax(1, parser.value(pointsOption).toInt());
+    PointGenerator generator;
+    generator.setSeed(seed);
+    PointCloud cloud = generator.createPointCloud("Cube", count, false);
+
+    for(int ascii = 0; ascii < 2; ++ascii)
+    {
+      QString path = directory.path() + (ascii ? "/ascii.ply" : "/binary.ply");
+      err << "Writing " << cloud.count() << " points to " << path << endl;
+      if(!directory.isValid() || !writeScene(path, cloud, ascii))
+      {
+        err << "Unable to write " << path << endl;
+        return 1;
+      }
+      paths << path;
+    }
+  }
+
+  QJsonArray files;
+  foreach(const QString& path, paths)
+  {
+    err << "Loading " << path << endl;
+
+    QJsonObject file;
+    file["file"] = QFileInfo(path).fileName();
+    file["megabytes"] = Bench::megabytes(QFileInfo(path).size());
+
+    QJsonObject callbacks = timeDecoder(path, PLYLoader::CallbackDecoder,
+                                        repeats);
+    if(callbacks.isEmpty())
+    {
+      err << "Unable to load " << path << endl;
+      return 1;
+    }
+    file["callbacks"] = callbacks;
+
+    QJsonObject binary = timeDecoder(path, PLYLoader::BinaryDecoder, repeats);
+    if(!binary.isEmpty())
+    {
+      file["binary"] = binary;
+      file["binarySpeedup"] = callbacks["medianMs"].toDouble()
+          /qMax(binary["medianMs"].toDouble(), 1e-3);
+    }
+
+    QJsonObject ascii = timeDecoder(path, PLYLoader::AsciiDecoder, repeats);
+    if(!ascii.isEmpty())
+    {
+      file["ascii"] = ascii;
+      file["asciiSpeedup"] = callbacks["medianMs"].toDouble()
+          /qMax(ascii["medianMs"].toDouble(), 1e-3);
+    }
+
+    files.append(file);
+  }
+
+  QJsonObject result;
+  result["repeats"] = repeats;
+  result["threads"] = Parallel::threadCount();
+  result["files"] = files;
+  result["peakResidentMB"] = Bench::megabytes(MemoryUsage::peakResident());
+
+  if(!Bench::writeJson(result, parser.value(outputOption)))
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,361 @@
+// Loads a point cloud without the main window and renders a scripted orbit
+// of camera poses, reporting timings as JSON.  Runs without a GPU on a
+// software GL driver, e.g.
+//
+//   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run -s "-screen 0 1920x1080x24" \
+//     nimbus-bench --frames 120 scene.ply > result.json
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QMap>
+#include <QOpenGLContext>
+#include <QOpenGLTimerQuery>
+#include <QTextStream>
+#include <QtCore/qmath.h>
+#include "PLYLoader.h"
+#include "Viewer.h"
+#include "MemoryUsage.h"
+#include "Bench.h"
+
+// Pose i of an orbit around the scene, alternating between the whole scene
+// and a closer view so that level of detail has to refine; zoom scales the
+// distances, so small values fly through the scene
+static void setPose(Viewer& viewer, int i, int count, double zoom)
+{
+  Vec center = viewer.sceneCenter();
+  double radius = viewer.sceneRadius();
+
+  double angle = 2.0 * M_PI * i/count;
+  double distance = zoom * ((i % 2) ? 1.0 * radius : 2.5 * radius);
+  double height = 0.5 * distance;
+
+  viewer.camera()->setPosition(center + Vec(distance * qCos(angle),
+                                            distance * qSin(angle), height));
+  viewer.camera()->setUpVector(Vec(0.0, 0.0, 1.0));
+  viewer.camera()->lookAt(center);
+}
+
+// Renders warmup plus frames poses of the orbit and returns per frame
+// timings with their summaries
+static QJsonObject renderOrbit(QApplication& app, Viewer& viewer, int warmup,
+                               int frames, double zoom)
+{
+  // GPU time needs timer queries (GL 3.3 or ARB_timer_query)
+  viewer.makeCurrent();
+  QOpenGLTimerQuery query;
+  bool gpuTiming = query.create();
+
+  QElapsedTimer timer;
+  QJsonArray frameList;
+  QVector<double> cpuTimes, frameTimes, gpuTimes;
+
+  for(int i = 0; i < warmup + frames; ++i)
+  {
+    setPose(viewer, i % frames, frames, zoom);
+
+    viewer.makeCurrent();
+    if(gpuTiming)
+      query.begin();
+
+    // Draw synchronously; CPU time ends once commands are submitted and
+    // frame time once the GPU has finished them
+    timer.start();
+    viewer.updateGL();
+    qint64 cpu = timer.nsecsElapsed();
+
+    viewer.makeCurrent();
+    if(gpuTiming)
+      query.end();
+    glFinish();
+    qint64 frame = timer.nsecsElapsed();
+
+    // Level of detail picks up node uploads and reads on later frames
+    app.processEvents();
+
+    if(i < warmup)
+      continue;
+
+    QJsonObject entry;
+    entry["cpuMs"] = Bench::milliseconds(cpu);
+    entry["frameMs"] = Bench::milliseconds(frame);
+    entry["pointsDrawn"] = viewer.pointsDrawn();
+    cpuTimes << Bench::milliseconds(cpu);
+    frameTimes << Bench::milliseconds(frame);
+
+    if(gpuTiming)
+    {
+      double gpu = Bench::milliseconds(query.waitForResult());
+      entry["gpuMs"] = gpu;
+      gpuTimes << gpu;
+    }
+
+    frameList.append(entry);
+  }
+
+  QJsonObject result;
+  result["frames"] = frameList;
+  result["cpuMs"] = Bench::summary(cpuTimes);
+  result["frameMs"] = Bench::summary(frameTimes);
+  if(gpuTiming)
+    result["gpuMs"] = Bench::summary(gpuTimes);
+
+  return result;
+}
+
+// Orbit results without the per frame list
+static QJsonObject summaries(QJsonObject orbit)
+{
+  orbit.remove("frames");
+  return orbit;
+}
+
+int main(int argc, char *argv[])
+{
+  Q_INIT_RESOURCE(Nimbus);
+
+  QApplication app(argc, argv);
+  QApplication::setApplicationName("nimbus-bench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Measures point cloud load and render "
+                                   "performance.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("file", "PLY or .nimbus file to load.");
+  QCommandLineOption framesOption("frames", "Frames to render.", "count", "60");
+  QCommandLineOption warmupOption("warmup", "Frames rendered before "
+                                  "measuring.", "count", "5");
+  QCommandLineOption widthOption("width", "Viewport width.", "pixels", "1280");
+  QCommandLineOption heightOption("height", "Viewport height.", "pixels",
+                                  "720");
+  QCommandLineOption pointSizeOption("point-size", "Point size.", "pixels",
+                                     "1");
+  QCommandLineOption lodOption("lod", "Draw with octree level of detail.");
+  QCommandLineOption budgetOption("budget", "Level of detail point budget.",
+                                  "points", "3000000");
+  QCommandLineOption edlOption("edl", "Shade with eye-dome lighting.");
+  QCommandLineOption stereoOption("stereo", "Draw in stereo, once with each "
+                                  "eye in turn and once in a single pass: "
+                                  "red-cyan, red-blue, side-by-side, stacked "
+                                  "or hardware.", "mode");
+  QCommandLineOption spatialOrderOption("spatial-order", "Draw in shuffled "
+                                        "and then spatial point order.");
+  QCommandLineOption cullingOption("culling", "Draw without and then with "
+                                   "frustum culling of chunks.");
+  QCommandLineOption zoomOption("zoom", "Scale of orbit distances; below 1 "
+                                "views part of the scene.", "factor", "1");
+  QCommandLineOption outputOption = Bench::outputOption();
+  parser.addOption(framesOption);
+  parser.addOption(warmupOption);
+  parser.addOption(widthOption);
+  parser.addOption(heightOption);
+  parser.addOption(pointSizeOption);
+  parser.addOption(lodOption);
+  parser.addOption(budgetOption);
+  parser.addOption(edlOption);
+  parser.addOption(stereoOption);
+  parser.addOption(spatialOrderOption);
+  parser.addOption(cullingOption);
+  parser.addOption(zoomOption);
+  parser.addOption(outputOption);
+  parser.process(app);
+
+  if(parser.positionalArguments().count() != 1)
+    parser.showHelp(1);
+
+  const QString path = parser.positionalArguments().first();
+  const int frames = qMax(1, parser.value(framesOption).toInt());
+  const int warmup = qMax(0, parser.value(warmupOption).toInt());
+  const double zoom = parser.value(zoomOption).toDouble() > 0.0
+      ? parser.value(zoomOption).toDouble() : 1.0;
+
+  QTextStream err(stderr);
+
+  QMap<QString, Viewer::StereoMode> stereoModes;
+  stereoModes.insert("red-cyan", Viewer::Red_Cyan);
+  stereoModes.insert("red-blue", Viewer::Red_Blue);
+  stereoModes.insert("side-by-side", Viewer::Side_by_Side);
+  stereoModes.insert("stacked", Viewer::Stacked);
+  stereoModes.insert("hardware", Viewer::Hardware);
+
+  const bool stereo = parser.isSet(stereoOption);
+  if(stereo && !stereoModes.contains(parser.value(stereoOption)))
+  {
+    err << "Unknown stereo mode " << parser.value(stereoOption) << endl;
+    return 1;
+  }
+  const Viewer::StereoMode stereoMode = stereoModes.value(
+        parser.value(stereoOption));
+
+  // Spatial order and chunks only apply to flat buffers
+  const bool spatialOrder = parser.isSet(spatialOrderOption);
+  const bool culling = parser.isSet(cullingOption);
+  if((spatialOrder || culling)
+     && (stereo || parser.isSet(lodOption) || (spatialOrder && culling)))
+  {
+    err << "Spatial order and culling are compared one at a time, without "
+           "stereo or level of detail" << endl;
+    return 1;
+  }
+
+  QJsonObject result;
+  result["file"] = QFileInfo(path).fileName();
+
+  // Load in this thread, then shuffle like the loader's worker does
+  QElapsedTimer timer;
+  timer.start();
+
+  PLYLoader loader;
+  if(!loader.open(path))
+  {
+    err << "Unable to open " << path << endl;
+    return 1;
+  }
+
+  PointCloud cloud = loader.load();
+  result["loadMs"] = Bench::milliseconds(timer.nsecsElapsed());
+
+  if(cloud.isEmpty())
+  {
+    err << "Unable to load " << path << endl;
+    return 1;
+  }
+
+  timer.restart();
+  cloud.shuffle();
+  result["shuffleMs"] = Bench::milliseconds(timer.nsecsElapsed());
+  result["points"] = cloud.count();
+  result["hostMemoryMB"] = Bench::megabytes(cloud.memoryUsage());
+
+  Viewer viewer;
+  viewer.resize(parser.value(widthOption).toInt(),
+                parser.value(heightOption).toInt());
+  viewer.show();
+  app.processEvents();
+
+  viewer.setPointSize(parser.value(pointSizeOption).toInt());
+  viewer.setPointBudget(parser.value(budgetOption).toInt());
+  viewer.setEyeDomeLighting(parser.isSet(edlOption));
+
+  // Upload happens in the viewer's context; finish so it is fully counted
+  viewer.makeCurrent();
+  timer.restart();
+  viewer.setPointCloud(cloud);
+  viewer.makeCurrent();
+  glFinish();
+  result["uploadMs"] = Bench::milliseconds(timer.nsecsElapsed());
+
+  if(parser.isSet(lodOption))
+  {
+    viewer.setLevelOfDetail(true);
+
+    // Octree is built in the background
+    timer.restart();
+    while(!viewer.levelOfDetailReady())
+      app.processEvents(QEventLoop::WaitForMoreEvents, 100);
+    result["octreeMs"] = Bench::milliseconds(timer.nsecsElapsed());
+  }
+
+  result["zoom"] = zoom;
+  result["levelOfDetail"] = viewer.levelOfDetailReady();
+  result["eyeDomeLighting"] = viewer.eyeDomeLighting();
+  result["peakResidentMB"] = Bench::megabytes(MemoryUsage::peakResident());
+
+  viewer.makeCurrent();
+  result["renderer"] = QString(reinterpret_cast<const char *>(
+                                 glGetString(GL_RENDERER)));
+  result["glVersion"] = QString(reinterpret_cast<const char *>(
+                                  glGetString(GL_VERSION)));
+  result["shaders"] = viewer.shaderRendering();
+
+  QJsonObject orbit;
+  if(stereo)
+  {
+    // Same orbit drawn both ways for comparison; the top level results are
+    // from the way the viewer would draw
+    viewer.setStereoMode(stereoMode);
+    viewer.setStereo(true);
+
+    QJsonObject comparison;
+    comparison["mode"] = parser.value(stereoOption);
+    comparison["singlePassAvailable"] = viewer.singlePassStereoAvailable();
+
+    viewer.setSinglePassStereo(false);
+    orbit = renderOrbit(app, viewer, warmup, frames, zoom);
+    comparison["twoPass"] = summaries(orbit);
+
+    if(viewer.singlePassStereoAvailable())
+    {
+      double twoPassMs = orbit["frameMs"].toObject()["median"].toDouble();
+
+      viewer.setSinglePassStereo(true);
+      orbit = renderOrbit(app, viewer, warmup, frames, zoom);
+      comparison["singlePass"] = summaries(orbit);
+
+      double singlePassMs = orbit["frameMs"].toObject()["median"].toDouble();
+      if(singlePassMs > 0.0)
+        comparison["medianSpeedup"] = twoPassMs/singlePassMs;
+    }
+
+    result["stereo"] = comparison;
+  } else if(spatialOrder) {
+    // Same orbit in both orders; the top level results are spatial
+    QJsonObject comparison;
+
+    orbit = renderOrbit(app, viewer, warmup, frames, zoom);
+    comparison["shuffled"] = summaries(orbit);
+    double shuffledMs = orbit["frameMs"].toObject()["median"].toDouble();
+
+    // Sorting and uploading again
+    viewer.makeCurrent();
+    timer.restart();
+    viewer.setSpatialOrder(true);
+    viewer.makeCurrent();
+    glFinish();
+    comparison["reorderMs"] = Bench::milliseconds(timer.nsecsElapsed());
+
+    orbit = renderOrbit(app, viewer, warmup, frames, zoom);
+    comparison["spatial"] = summaries(orbit);
+
+    double spatialMs = orbit["frameMs"].toObject()["median"].toDouble();
+    if(spatialMs > 0.0)
+      comparison["medianSpeedup"] = shuffledMs/spatialMs;
+
+    result["spatialOrder"] = comparison;
+  } else if(culling) {
+    // Same orbit drawing every chunk and only those in view; the top level
+    // results are culled
+    QJsonObject comparison;
+
+    viewer.setFrustumCulling(false);
+    orbit = renderOrbit(app, viewer, warmup, frames, zoom);
+    comparison["unculled"] = summaries(orbit);
+    double unculledMs = orbit["frameMs"].toObject()["median"].toDouble();
+
+    viewer.setFrustumCulling(true);
+    orbit = renderOrbit(app, viewer, warmup, frames, zoom);
+    comparison["culled"] = summaries(orbit);
+
+    double culledMs = orbit["frameMs"].toObject()["median"].toDouble();
+    if(culledMs > 0.0)
+      comparison["medianSpeedup"] = unculledMs/culledMs;
+
+    result["culling"] = comparison;
+  } else {
+    orbit = renderOrbit(app, viewer, warmup, frames, zoom);
+  }
+
+  for(QJsonObject::const_iterator i = orbit.constBegin();
+      i != orbit.constEnd(); ++i)
+    result[i.key()] = i.value();
+
+  result["peakResidentMB"] = Bench::megabytes(MemoryUsage::peakResident());
+
+  if(!Bench::writeJson(result, parser.value(outputOption)))
+    return 1;
+
+  return 0;
+}
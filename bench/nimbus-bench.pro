@@ -0,0 +1,11 @@
+# Headless load and render benchmark; see main.cpp for usage
+
+TARGET = nimbus-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../Nimbus.pri)
+
+SOURCES += main.cpp
+HEADERS += Bench.h
@@ -0,0 +1,11 @@
+# Point shuffle throughput and uniformity check; see shuffle.cpp for usage
+
+TARGET = nimbus-shuffle-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../Nimbus.pri)
+
+SOURCES += shuffle.cpp
+HEADERS += Bench.h
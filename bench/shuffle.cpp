@@ -0,0 +1,283 @@
+// Times PointCloud::shuffle() and checks its result, reporting JSON, e.g.
+//
+//   nimbus-shuffle-bench --points 100000000 > shuffle.json
+//
+// Each point stores its original index, so the shuffled cloud reveals the
+// permutation.  Checks that it is a permutation, that it is the same for every
+// thread count, and that it is uniform: a chi-square test over original index
+// against shuffled position, and one over all orderings of a few points.
+// Exits with 1 if a check fails.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <QtCore/qmath.h>
+#include <algorithm>
+#include <vector>
+#include "PointCloud.h"
+#include "Parallel.h"
+#include "MemoryUsage.h"
+#include "Bench.h"
+
+// Indices are split over x and y, as a float holds 24 bits exactly
+static const int IndexBits = 20;
+
+// Buckets per axis of the index against position table
+static const int Buckets = 32;
+
+// Points and trials of the test over all orderings
+static const int OrderingPoints = 5;
+static const int OrderingTrials = 120000;
+
+// Chi-square statistics beyond this many standard deviations fail
+static const double ChiSquareLimit = 5.0;
+
+// Cloud whose points hold their own index
+static PointCloud indexCloud(int count)
+{
+  PointCloud cloud(count);
+  float *p = cloud.pointData();
+
+  const int BlockSize = 1 << 20;
+  Parallel::forEach((count + BlockSize - 1)/BlockSize, [&](int block) {
+    int last = qMin(count, (block + 1) * BlockSize);
+    for(int i = block * BlockSize; i < last; ++i)
+    {
+      p[(size_t)i * 3] = i & ((1 << IndexBits) - 1);
+      p[(size_t)i * 3 + 1] = i >> IndexBits;
+      p[(size_t)i * 3 + 2] = 0.0f;
+    }
+  });
+
+  return cloud;
+}
+
+static quint32 originalIndex(const float *p, int i)
+{
+  return ((quint32)p[(size_t)i * 3 + 1] << IndexBits)
+      | (quint32)p[(size_t)i * 3];
+}
+
+// Chi-square statistic of observed counts against an equal expected count,
+// with its distance from the mean in standard deviations
+static QJsonObject chiSquare(const std::vector<qint64>& observed)
+{
+  qint64 total = 0;
+  for(size_t i = 0; i < observed.size(); ++i)
+    total += observed[i];
+
+  double expected = (double)total/observed.size();
+  double statistic = 0.0;
+  for(size_t i = 0; i < observed.size(); ++i)
+  {
+    double d = observed[i] - expected;
+    statistic += d * d/expected;
+  }
+
+  int freedom = observed.size() - 1;
+  double deviations = (statistic - freedom)/qSqrt(2.0 * freedom);
+
+  QJsonObject result;
+  result["chiSquare"] = statistic;
+  result["degreesOfFreedom"] = freedom;
+  result["deviations"] = deviations;
+  result["pass"] = qAbs(deviations) < ChiSquareLimit;
+  return result;
+}
+
+struct Order
+{
+  bool valid;
+  quint64 fingerprint;
+  // Counts of original index bucket against shuffled position bucket
+  std::vector<qint64> table;
+};
+
+static Order readOrder(const PointCloud& cloud)
+{
+  const int count = cloud.count();
+  const float *p = cloud.pointData();
+
+  Order order;
+  order.valid = true;
+  order.fingerprint = 14695981039346656037ULL;
+  order.table.assign(Buckets * Buckets, 0);
+
+  std::vector<bool> seen(count, false);
+  for(int i = 0; i < count; ++i)
+  {
+    quint32 index = originalIndex(p, i);
+    if(index >= (quint32)count || seen[index])
+    {
+      order.valid = false;
+      return order;
+    }
+    seen[index] = true;
+
+    // FNV-1a over the indices
+    order.fingerprint = (order.fingerprint ^ index) * 1099511628211ULL;
+
+    int from = (qint64)index * Buckets/count;
+    int to = (qint64)i * Buckets/count;
+    ++order.table[from * Buckets + to];
+  }
+
+  return order;
+}
+
+// Shuffles n points with trials seeds and counts how often each ordering
+// comes up
+static QJsonObject orderingTest(quint64 seed)
+{
+  int orderings = 1;
+  for(int i = 2; i <= OrderingPoints; ++i)
+    orderings *= i;
+
+  PointCloud source = indexCloud(OrderingPoints);
+  std::vector<qint64> observed(orderings, 0);
+
+  for(int trial = 0; trial < OrderingTrials; ++trial)
+  {
+    PointCloud cloud = source;
+    cloud.shuffle(seed + trial);
+
+    // Rank of the ordering in the factorial number system
+    const float *p = cloud.pointData();
+    int rank = 0;
+    for(int i = 0; i < OrderingPoints; ++i)
+    {
+      int smaller = 0;
+      for(int j = i + 1; j < OrderingPoints; ++j)
+        smaller += originalIndex(p, j) < originalIndex(p, i);
+      rank = rank * (OrderingPoints - i) + smaller;
+    }
+    ++observed[rank];
+  }
+
+  QJsonObject result = chiSquare(observed);
+  result["points"] = OrderingPoints;
+  result["trials"] = OrderingTrials;
+  return result;
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("nimbus-shuffle-bench");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Times point shuffling and checks that "
+                                   "it is a uniform, repeatable "
+                                   "permutation.");
+  parser.addHelpOption();
+  QCommandLineOption pointsOption("points", "Points to shuffle.", "count",
+                                  "100000000");
+  QCommandLineOption repeatOption("repeat", "Shuffles per thread count.",
+                                  "count", "3");
+  QCommandLineOption seedOption("seed", "Shuffle seed.", "seed", "1");
+  QCommandLineOption outputOption = Bench::outputOption();
+  parser.addOption(pointsOption);
+  parser.addOption(repeatOption);
+  parser.addOption(seedOption);
+  parser.addOption(outputOption);
+  parser.process(app);
+
+  const int count = qMax(2, parser.value(pointsOption).toInt());
+  const int repeats = qMax(1, parser.value(repeatOption).toInt());
+  const quint64 seed = parser.value(seedOption).toULongLong();
+
+  QTextStream err(stderr);
+
+  err << "Creating " << count << " points" << endl;
+  PointCloud source = indexCloud(count);
+
+  // Serial first, so every other count is compared against it
+  QList<int> threadCounts;
+  threadCounts << 1;
+  if(QThread::idealThreadCount() > 2)
+    threadCounts << 2;
+  if(QThread::idealThreadCount() > 1)
+    threadCounts << QThread::idealThreadCount();
+
+  const int maxThreads = QThreadPool::globalInstance()->maxThreadCount();
+  bool pass = true;
+
+  QJsonArray runs;
+  Order reference;
+  foreach(int threads, threadCounts)
+  {
+    err << "Shuffling with " << threads << " threads" << endl;
+    QThreadPool::globalInstance()->setMaxThreadCount(threads);
+
+    PointCloud cloud;
+    QVector<double> times;
+    for(int i = 0; i < repeats; ++i)
+    {
+      // Shares the source's storage; the shuffle gathers into new storage
+      cloud = source;
+
+      QElapsedTimer timer;
+      timer.start();
+      cloud.shuffle(seed);
+      times << Bench::milliseconds(timer.nsecsElapsed());
+    }
+
+    Order order = readOrder(cloud);
+    cloud = PointCloud();
+
+    QJsonObject run;
+    run["threads"] = threads;
+    run["ms"] = Bench::summary(times);
+    double median = run["ms"].toObject()["median"].toDouble();
+    run["pointsPerSecond"] = median > 0.0 ? count * 1000.0/median : 0.0;
+    run["valid"] = order.valid;
+
+    if(runs.isEmpty())
+    {
+      reference = order;
+    } else {
+      bool same = order.valid && order.fingerprint == reference.fingerprint;
+      run["sameAsSerial"] = same;
+      pass = pass && same;
+    }
+
+    pass = pass && order.valid;
+    runs.append(run);
+  }
+
+  QThreadPool::globalInstance()->setMaxThreadCount(maxThreads);
+
+  QJsonObject result;
+  result["points"] = count;
+  result["repeats"] = repeats;
+  result["seed"] = QString::number(seed);
+  result["runs"] = runs;
+
+  // Every index bucket should spread evenly over all position buckets
+  if(reference.valid && count >= 5 * Buckets * Buckets)
+  {
+    QJsonObject uniformity = chiSquare(reference.table);
+    uniformity["buckets"] = Buckets;
+    result["positionUniformity"] = uniformity;
+    pass = pass && uniformity["pass"].toBool();
+  }
+
+  err << "Shuffling " << OrderingPoints << " points " << OrderingTrials
+      << " times" << endl;
+  QJsonObject orderings = orderingTest(seed);
+  result["orderingUniformity"] = orderings;
+  pass = pass && orderings["pass"].toBool();
+
+  result["pass"] = pass;
+  result["peakResidentMB"] = Bench::megabytes(MemoryUsage::peakResident());
+
+  if(!Bench::writeJson(result, parser.value(outputOption)))
+    return 1;
+
+  return pass ? 0 : 1;
+}
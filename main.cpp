@@ -3,8 +3,63 @@
 #include <QtPlugin>
 #include <QStringList>
 #include <QFileInfo>
+#include <QTextStream>
 #include "MainWindow.h"
 #include "Viewer.h"
+#include "PLYLoader.h"
+#include "PLYWriter.h"
+#include "NimbusFile.h"
+
+// Writes a voxel downsampled copy of input to output without showing a
+// window; native if output ends in .nimbus and PLY otherwise
+static int downsampleFile(const QString& input, const QString& output,
+                          float voxelSize, PointCloud::VoxelPoint point)
+{
+  QTextStream err(stderr);
+
+  PLYLoader loader;
+  if(!loader.open(input))
+  {
+    err << "Unable to open " << input << endl;
+    return 1;
+  }
+
+  PointCloud cloud = loader.load();
+  if(cloud.isEmpty())
+  {
+    err << "Unable to load " << input << endl;
+    return 1;
+  }
+
+  PointCloud reduced = cloud.voxelDownsample(voxelSize, point);
+  err << "Downsampled " << cloud.count() << " points to " << reduced.count()
+      << endl;
+
+  bool written = false;
+  if(output.endsWith(".nimbus", Qt::CaseInsensitive))
+  {
+    // Recorded as shuffled so opening it doesn't shuffle again
+    reduced.shuffle();
+    written = NimbusFile::write(output, reduced, loader.cameraPositions(),
+                                loader.cameraUpVectors(),
+                                loader.cameraAimVectors(),
+                                loader.cameraAspectRatios(), true);
+  } else {
+    PLYWriter ply;
+    ply.addComment(QString("Voxel downsampled from %1 with voxel size %2")
+                   .arg(QFileInfo(input).fileName()).arg(voxelSize));
+    written = ply.open(output, reduced.count(), reduced.hasColor())
+        && ply.write(reduced) && ply.close();
+  }
+
+  if(!written)
+  {
+    err << "Unable to write " << output << endl;
+    return 1;
+  }
+
+  return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -21,13 +76,42 @@ int main(int argc, char *argv[])
     a.setAttribute(Qt::AA_UseHighDpiPixmaps);
 #endif
 
-    MainWindow w;
-    w.show();
-
     QCommandLineParser parser;
+    parser.addHelpOption();
+    parser.addPositionalArgument("file", "Point cloud to open.");
+    QCommandLineOption voxelOption("voxel-size", "Write a copy of file "
+                                   "downsampled to a voxel grid with cells "
+                                   "of this size to --output and exit.",
+                                   "size");
+    QCommandLineOption voxelPointOption("voxel-point", "Point kept per "
+                                        "cell: centroid or nearest.",
+                                        "point", "centroid");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    "Downsampled file, .ply or .nimbus.",
+                                    "file");
+    parser.addOption(voxelOption);
+    parser.addOption(voxelPointOption);
+    parser.addOption(outputOption);
     parser.process(a);
     QStringList args = parser.positionalArguments();
 
+    if(parser.isSet(voxelOption))
+    {
+      float size = parser.value(voxelOption).toFloat();
+      QString point = parser.value(voxelPointOption);
+      if(args.count() != 1 || !parser.isSet(outputOption) || size <= 0.0f
+         || (point != "centroid" && point != "nearest"))
+        parser.showHelp(1);
+
+      return downsampleFile(args.first(), parser.value(outputOption), size,
+                            point == "nearest"
+                            ? PointCloud::VoxelNearestCentroid
+                            : PointCloud::VoxelCentroid);
+    }
+
+    MainWindow w;
+    w.show();
+
     if(!args.isEmpty())
       w.openFile(args.first());
 